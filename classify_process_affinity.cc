@@ -1,21 +1,305 @@
 #include "classify_process_affinity.hh"
+#include "cpu_noise.hh"
+#include "cpulist.hh"
+#include "stat_uring.hh"
 
+#include <unistd.h>
+
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 
 using namespace process_affinity;
 
-int main(int arg, char **argv) {
+void usage(const char *prog) {
+  std::cerr << prog
+            << " [-t] [-u] [-f FORMAT] [-j WORKERS] [-w SECONDS | -p CPULIST]"
+            << std::endl;
+  std::cerr << prog << " [-t] [-f FORMAT] -c CGROUP [-c CGROUP]..."
+            << std::endl;
+  std::cerr << prog << " -n" << std::endl;
+  std::cerr << "  -t  classify every thread, not only thread-group leaders"
+            << std::endl;
+  std::cerr << "  -u  read the stat files in batches with io_uring, if the "
+               "kernel allows it"
+            << std::endl;
+  std::cerr << "  -f  print text (the default), json lines or binary records; "
+               "json and binary stream every task unsorted as it is read"
+            << std::endl;
+  std::cerr << "  -j  use WORKERS threads rather than one per online CPU; "
+               "not with -u, -w or -f json|binary"
+            << std::endl;
+  std::cerr << "  -w  keep running, and every SECONDS print the tasks which "
+               "appeared (+) and disappeared (-)"
+            << std::endl;
+  std::cerr << "  -c  classify only the tasks in the cgroup v2 directory "
+               "CGROUP and the cgroups below it"
+            << std::endl;
+  std::cerr << "  -n  print the unpinnable and bound tasks on each CPU, and "
+               "which CPUs could be isolated;"
+            << std::endl
+            << "      it always examines every thread, so it takes no other "
+               "options"
+            << std::endl;
+  std::cerr << "  -p  move every pinnable thread to the CPUs in CPULIST, "
+               "like \"taskset -a -p -c CPULIST\" for each process"
+            << std::endl;
+}
+
+// Move every pinnable thread and report the threads which were not moved.
+int repin(const std::vector<uint32_t> &cpus, const unsigned int workers) {
+  TaskTable table;
+  read_task_table(table, "/proc/", true);
+  std::vector<pid_t> tids{};
+  for (size_t row = 0U; row < table.size(); row++) {
+    if (table.is_settable(row)) {
+      tids.push_back(table.tid(row));
+    }
+  }
+  const std::vector<repin_outcome> outcomes =
+      repin_threads(tids, cpus, workers);
+  for (const repin_outcome &outcome : outcomes) {
+    if (outcome.error) {
+      std::cout << outcome.tid << " "
+                << table.name(table.find_tid(outcome.tid).value()) << ": "
+                << ((ESRCH == outcome.error) ? "exited"
+                                             : strerror(outcome.error))
+                << std::endl;
+    }
+  }
+  const repin_summary summary = summarize(outcomes);
+  std::cout << "Moved " << summary.moved << " threads to "
+            << cpulist::format_cpulist(cpus) << ", " << summary.vanished
+            << " exited, " << summary.failed << " failed." << std::endl;
+  return summary.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Print the names and tids of rows, like "ksoftirqd/0(14) migration/0(15)".
+void print_tasks(const NoiseMap &map, const char *label,
+                 const std::vector<size_t> &rows) {
+  if (rows.empty()) {
+    return;
+  }
+  std::cout << "    " << label << ":";
+  for (const size_t row : rows) {
+    std::cout << " " << map.name(row) << "(" << map.task(row).tid << ")";
+  }
+  std::cout << "\n";
+}
+
+// Print the tasks which disturb each CPU from a single scan of every thread.
+int noise() {
+  NoiseMap map;
+  if (!read_noise_map(map)) {
+    return EXIT_FAILURE;
+  }
+  for (const uint32_t cpu : map.cpus()) {
+    const cpu_noise &cn = map.noise(cpu);
+    std::cout << "CPU " << cpu << ": " << cn.unpinnable.size()
+              << " unpinnable, " << cn.bound.size() << " bound, "
+              << cn.last_ran << " last ran here\n";
+    print_tasks(map, "unpinnable", cn.unpinnable);
+    print_tasks(map, "bound", cn.bound);
+  }
+  std::cout << map.floating_pinnable() << " pinnable and "
+            << map.floating_unpinnable()
+            << " unpinnable tasks may run on any CPU.\n";
+  const std::vector<uint32_t> quiet = map.quiet_candidates();
+  if (quiet.size() == map.cpus().size()) {
+    std::cout << "Every CPU has the same unpinnable tasks.\n";
+  } else {
+    std::cout << "CPUs with the fewest unpinnable tasks: "
+              << cpulist::format_cpulist(quiet) << "\n";
+  }
+  std::cout << "Moving the bound tasks off those CPUs and excluding them from "
+               "the affinity of the rest, as with -p, leaves only their "
+               "unpinnable tasks.\n";
+  std::cout.flush();
+  return EXIT_SUCCESS;
+}
+
+// How often watch() rereads every stat file to catch tids which were reused
+// between refreshes, which an ordinary refresh cannot tell from the old task.
+constexpr unsigned long REVALIDATE_SECONDS = 60U;
+
+// Print the initial classification, then the changes at each interval.
+void watch(const bool all_threads, const unsigned long interval) {
+  TaskCache cache("/proc/", all_threads);
+  cache.refresh();
   std::set<struct tid_data, decltype(tid_data_compare) *> tset{
       tid_data_compare};
-  read_thread_data(tset);
-  for (struct tid_data td : tset) {
-    std::cout << td.thread_name << ": ";
-    if (td.is_settable) {
-      std::cout << "pinnable." << std::endl;
-    } else {
-      std::cout << "unpinnable" << std::endl;
+  cache.fill(tset);
+  RecordWriter writer(STDOUT_FILENO, output_format::text);
+  for (const struct tid_data &td : tset) {
+    writer.write(td);
+  }
+  writer.flush();
+  unsigned long since_revalidate = 0U;
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(interval));
+    since_revalidate += interval;
+    const bool revalidate = (since_revalidate >= REVALIDATE_SECONDS);
+    if (revalidate) {
+      since_revalidate = 0U;
+    }
+    const task_diff diff = cache.refresh(revalidate);
+    for (const struct tid_data &td : diff.removed) {
+      std::cout << "- " << td.tid << " " << td.thread_name << "\n";
     }
+    for (const struct tid_data &td : diff.added) {
+      std::cout << "+ " << td.tid << " " << td.thread_name << ": "
+                << (td.is_settable ? "pinnable." : "unpinnable") << "\n";
+    }
+    std::cout.flush();
+  }
+}
+
+// Visit every task, reading the stat files synchronously or with io_uring.
+bool scan(const bool all_threads, const bool use_uring,
+          const std::function<bool(pid_t, const stat_fields &)> &visitor) {
+  if (use_uring) {
+    StatUring ring;
+    return for_each_task_stat_uring("/proc/", all_threads, ring, visitor);
+  }
+  return for_each_task_stat("/proc/", all_threads, visitor);
+}
+
+// Write every task as it is read, without building a set.
+int stream(const bool all_threads, const bool use_uring,
+           const output_format format) {
+  RecordWriter writer(STDOUT_FILENO, format);
+  if (!scan(all_threads, use_uring,
+            [&](pid_t tid, const stat_fields &fields) {
+              writer.write(tid, fields.thread_name, fields.is_settable());
+              return true;
+            })) {
+    return EXIT_FAILURE;
+  }
+  return writer.flush() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+  bool all_threads = false;
+  bool use_uring = false;
+  bool noise_map = false;
+  std::vector<std::string> cgroups{};
+  unsigned long interval = 0U;
+  unsigned int workers = 0U;
+  output_format format = output_format::text;
+  std::optional<std::vector<uint32_t>> repin_cpus{};
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "tunc:f:j:w:p:"))) {
+    switch (opt) {
+    case 't':
+      all_threads = true;
+      break;
+    case 'u':
+      use_uring = true;
+      break;
+    case 'n':
+      noise_map = true;
+      break;
+    case 'c':
+      cgroups.push_back(optarg);
+      break;
+    case 'f': {
+      const std::optional<output_format> parsed = parse_output_format(optarg);
+      if (!parsed.has_value()) {
+        std::cerr << "Illegal format " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      format = parsed.value();
+      break;
+    }
+    case 'j':
+      workers = strtoul(optarg, nullptr, 10);
+      if (0U == workers) {
+        std::cerr << "Illegal worker count " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      repin_cpus = cpulist::parse_cpulist(optarg);
+      if (!repin_cpus.has_value()) {
+        std::cerr << "Illegal cpulist " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'w':
+      interval = strtoul(optarg, nullptr, 10);
+      if (0U == interval) {
+        std::cerr << "Illegal interval " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if ((interval || (output_format::text != format)) &&
+      repin_cpus.has_value()) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (interval && (output_format::text != format)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  // Only the set-building scan and -p have workers.
+  if (workers && !repin_cpus.has_value() &&
+      (interval || use_uring || (output_format::text != format))) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (noise_map && ((2 != argc) || (optind != argc))) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (noise_map) {
+    exit(noise());
+  }
+  if (!cgroups.empty() &&
+      (interval || repin_cpus.has_value() || use_uring || workers)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (repin_cpus.has_value()) {
+    exit(repin(repin_cpus.value(), workers));
+  }
+  if (interval) {
+    watch(all_threads, interval);
+  }
+  if (cgroups.empty() && (output_format::text != format)) {
+    exit(stream(all_threads, use_uring, format));
+  }
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  if (!cgroups.empty()) {
+    if (!read_cgroup_thread_data(tset, cgroups, all_threads)) {
+      exit(EXIT_FAILURE);
+    }
+  } else if (use_uring) {
+    scan(all_threads, true, [&](pid_t tid, const stat_fields &fields) {
+      tset.emplace(tid, fields.is_settable(), std::string(fields.thread_name));
+      return true;
+    });
+  } else if (workers) {
+    read_thread_data_parallel(tset, "/proc/", workers, false, all_threads);
+  } else if (all_threads) {
+    read_all_thread_data(tset);
+  } else {
+    read_thread_data(tset);
+  }
+  RecordWriter writer(STDOUT_FILENO, format);
+  for (const struct tid_data &td : tset) {
+    writer.write(td);
   }
-  exit(EXIT_SUCCESS);
+  exit(writer.flush() ? EXIT_SUCCESS : EXIT_FAILURE);
 }
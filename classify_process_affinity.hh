@@ -1,11 +1,18 @@
 #ifndef CLASSIFY_PROCESS_AFFINITY_H
 #define CLASSIFY_PROCESS_AFFINITY_H
 
+#include <fcntl.h>
+
+#include <array>
 #include <filesystem>
+#include <functional>
 #include <optional>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace process_affinity {
 
@@ -13,6 +20,29 @@ constexpr uint32_t PF_NO_SETAFFINITY = 0x04000000;
 // Differs from the upstream patch because flags processing begins after the
 // thread name.
 constexpr uint32_t PF_NO_SET_AFFINITY_POSITION = 8U;
+// Field 22 in "man 5 proc", numbered from 0 like the flags.  Together with the
+// tid, the start time identifies a task even if its tid is later reused.
+constexpr uint32_t STARTTIME_POSITION = 21U;
+// Comfortably larger than any /proc/<pid>/stat line: 52 fields of at most 20
+// digits each plus a TASK_COMM_LEN thread name.
+constexpr size_t STAT_BUF_SIZE = 2048U;
+
+using stat_buf_t = std::array<char, STAT_BUF_SIZE>;
+
+// A status file is about 1.4 kB, with Cpus_allowed growing by 9 bytes per 32
+// CPUs.
+constexpr size_t STATUS_BUF_SIZE = 4096U;
+
+// The fields of a stat line which classification needs.  thread_name points
+// into the buffer which was parsed, so it is valid only as long as the buffer.
+struct stat_fields {
+  pid_t tid = 0;
+  std::string_view thread_name{};
+  uint32_t flags = 0U;
+  // 0 if the line ends before the start time.
+  uint64_t starttime = 0U;
+  bool is_settable() const { return !(flags & PF_NO_SETAFFINITY); }
+};
 
 struct tid_data {
   tid_data(pid_t tidval, bool tset, std::string tname)
@@ -36,15 +66,455 @@ read_thread_stat(const std::string &stat_file_pathname);
 // its affinity can be set.
 std::optional<bool> thread_affinity_is_settable(const std::string &stat_str);
 
+// Read the stat file at the given path, relative to dirfd if it is not
+// absolute, into buf with a single read().  Return a view of the contents, or
+// std::nullopt if the file cannot be read.  Does not allocate.
+std::optional<std::string_view> read_thread_stat(const char *pathname,
+                                                 stat_buf_t &buf,
+                                                 int dirfd = AT_FDCWD);
+
+// Tokenize the contents of a stat file without copying it.  The thread name is
+// everything between the first '(' and the last ')', so names which themselves
+// contain ')' or spaces are handled.  Returns std::nullopt for a malformed
+// line.
+std::optional<stat_fields> parse_thread_stat(std::string_view stat);
+
+// A predicate which a scan applies to each task as its stat file is parsed,
+// so that tasks which do not match are never copied or passed on.  The
+// default matches every task.
+struct task_filter {
+  // If set, match only tasks whose affinity is, or is not, settable.
+  std::optional<bool> settable{};
+  // Match only tasks whose names start with name_prefix.
+  std::string_view name_prefix{};
+  bool matches(const stat_fields &fields) const;
+};
+
 // Populate a caller-provided set with data about affinity-settability of
 // threads in the indicated directory, by default /proc. The path is for unit
 // tests.   Note that the comparator function is provided as a function pointer,
 // thus decltype() *.  See
 //  https://stackoverflow.com/questions/2620862/using-custom-stdset-comparator
+// Only tasks which match filter are added.  This is a wrapper around
+// for_each_task_stat(), which callers that do not need the set should use
+// instead, since its memory use does not grow with the number of tasks.
 void read_thread_data(
     std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::string &procfs_top = "/proc/", bool verbose = false,
+    const task_filter &filter = task_filter{});
+
+// Like read_thread_data(), but classify every thread of every process rather
+// than only thread-group leaders, by reading /proc/<pid>/task/<tid>/stat.
+// Directories are listed with getdents64() and files are opened with openat()
+// relative to the held procfs and task directory descriptors, so no path
+// strings are built.  A process whose task directory is missing is classified
+// from /proc/<pid>/stat.
+void read_all_thread_data(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::string &procfs_top = "/proc/", bool verbose = false);
+
+// Call fn(dirfd, name, tid) for each task directory in procfs_top, or for each
+// thread's directory if all_threads is set, until fn returns false.  name is
+// relative to dirfd, and both are valid only during the call, so that callers
+// can open any file of the task with openat() without building a path.
+// Returns false if procfs_top cannot be opened.
+bool for_each_task_dir(
+    const std::string &procfs_top, bool all_threads,
+    const std::function<bool(int, const char *, pid_t)> &fn);
+
+// Call visitor(tid, fields) for each task in procfs_top, or for each thread if
+// all_threads is set, in directory order and without sorting, deduplicating or
+// allocating, until visitor returns false.  fields.thread_name is valid only
+// during the call.  Returns false if procfs_top cannot be opened.
+bool for_each_task_stat(
+    const std::string &procfs_top, bool all_threads,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor);
+
+// Like for_each_task_stat(), but visit only the tasks which match filter.
+bool for_each_task_stat(
+    const std::string &procfs_top, bool all_threads, const task_filter &filter,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor);
+
+// The stat file paths of a procfs scan, relative to the top procfs directory,
+// stored NUL-terminated in a single arena so that a batch of opens can be
+// issued after the directory listing is complete.
+class TaskPaths {
+public:
+  void add(pid_t tid, std::string_view relpath);
+  size_t size() const { return tids_.size(); }
+  pid_t tid(size_t i) const { return tids_[i]; }
+  const char *path(size_t i) const { return arena_.data() + offsets_[i]; }
+
+private:
+  std::vector<pid_t> tids_{};
+  std::vector<uint32_t> offsets_{};
+  std::string arena_{};
+};
+
+// Add "<pid>/stat" to paths for each task in procfs_top, or
+// "<pid>/task/<tid>/stat" for each thread if all_threads is set.  Returns
+// false if procfs_top cannot be opened.
+bool list_task_stat_paths(const std::string &procfs_top, bool all_threads,
+                          TaskPaths &paths);
+
+// Append to tids the pids listed in cgroup.procs, or with threads the tids
+// listed in cgroup.threads, of the cgroup v2 directory cgroup_dir and of every
+// cgroup below it, since a pod's processes are in the cgroups of its
+// containers.  Returns false if cgroup_dir itself cannot be read.
+bool read_cgroup_tids(const std::string &cgroup_dir, bool threads,
+                      std::vector<pid_t> &tids);
+
+// Like read_thread_data(), but classify only the tasks in cgroup_dirs and
+// their descendants, so that the cost is proportional to the size of the
+// cgroups rather than of the machine.  With all_threads, classify each thread
+// in cgroup.threads rather than each process in cgroup.procs.  Returns false
+// if a cgroup or procfs_top cannot be read.
+bool read_cgroup_thread_data(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::vector<std::string> &cgroup_dirs, bool all_threads,
     const std::string &procfs_top = "/proc/", bool verbose = false);
 
+// The number of CPUs which are online, which is the default number of workers
+// for read_thread_data_parallel().
+unsigned int default_worker_count();
+
+// Like read_thread_data(), or with all_threads like read_all_thread_data(),
+// but split the processes into contiguous chunks which a pool of worker
+// threads classify.  Each worker reads the stat files of its processes into
+// its own buffer and appends the results to its own vector, and the vectors
+// are merged into tid_set in directory order once all workers have finished,
+// so that the result matches that of the sequential scan.  Passing
+// workers == 0 selects default_worker_count().
+void read_thread_data_parallel(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::string &procfs_top = "/proc/", unsigned int workers = 0U,
+    bool verbose = false, bool all_threads = false);
+
+// Deduplicated storage for thread names.  Each distinct name is stored once in
+// a single character arena and identified by a dense 32-bit id.  Lookup uses
+// an open-addressing table of ids, so interning allocates only when the arena
+// or the table grows.
+class NamePool {
+public:
+  // Return the id of name, adding it if it is new.
+  uint32_t intern(std::string_view name);
+  std::optional<uint32_t> find(std::string_view name) const;
+  // The view points into the arena, which a later intern() may reallocate, so
+  // it is valid only until then.  Keep the id rather than the view.
+  std::string_view name(uint32_t id) const {
+    return std::string_view(arena_.data() + offsets_[id],
+                            offsets_[id + 1U] - offsets_[id]);
+  }
+  // The number of distinct names.
+  size_t size() const { return offsets_.size() - 1U; }
+  size_t memory_usage() const;
+
+private:
+  void grow();
+  std::string arena_{};
+  // Name id is at arena_[offsets_[id], offsets_[id + 1]).
+  std::vector<uint32_t> offsets_{0U};
+  // id + 1 of the name which hashes to each slot, or 0 if the slot is empty.
+  std::vector<uint32_t> slots_{};
+};
+
+// Classification results stored as parallel arrays of tid, flags and name id,
+// so that a task costs 16 bytes plus its share of the interned names.  Unlike
+// the std::set which read_thread_data() fills, every tid is kept even if
+// several threads share a name.
+class TaskTable {
+public:
+  void add(pid_t tid, uint32_t flags, std::string_view name);
+  // Sort the rows by tid and index them by name.  Lookups before finalize(),
+  // or after a later add(), fall back to a linear search.
+  void finalize();
+  size_t size() const { return tids_.size(); }
+  pid_t tid(size_t row) const { return tids_[row]; }
+  uint32_t flags(size_t row) const { return flags_[row]; }
+  bool is_settable(size_t row) const {
+    return !(flags_[row] & PF_NO_SETAFFINITY);
+  }
+  std::string_view name(size_t row) const {
+    return names_.name(name_ids_[row]);
+  }
+  // Return the row of tid, if it is present.
+  std::optional<size_t> find_tid(pid_t tid) const;
+  // Return the rows of all tasks named name, in tid order.
+  std::vector<size_t> find_name(std::string_view name) const;
+  size_t memory_usage() const;
+
+private:
+  std::vector<pid_t> tids_{};
+  std::vector<uint32_t> flags_{};
+  std::vector<uint32_t> name_ids_{};
+  NamePool names_{};
+  // Built by finalize(): rows sorted by name id, then tid, and the position of
+  // the first row of each name id in that order.
+  std::vector<uint32_t> name_rows_{};
+  std::vector<uint32_t> name_starts_{};
+  bool finalized_ = false;
+};
+
+// Populate a TaskTable with every task in procfs_top, or with every thread if
+// all_threads is set, and finalize() it.
+void read_task_table(TaskTable &table, const std::string &procfs_top = "/proc/",
+                     bool all_threads = false);
+
+// The fields of a stat line, numbered from 0 as in the comment at the top of
+// classify_process_affinity_lib.cc, which is one less than in "man 5 proc".
+enum stat_field : uint32_t {
+  STAT_PID,
+  STAT_COMM,
+  STAT_STATE,
+  STAT_PPID,
+  STAT_PGRP,
+  STAT_SESSION,
+  STAT_TTY_NR,
+  STAT_TPGID,
+  STAT_FLAGS,
+  STAT_MINFLT,
+  STAT_CMINFLT,
+  STAT_MAJFLT,
+  STAT_CMAJFLT,
+  STAT_UTIME,
+  STAT_STIME,
+  STAT_CUTIME,
+  STAT_CSTIME,
+  STAT_PRIORITY,
+  STAT_NICE,
+  STAT_NUM_THREADS,
+  STAT_ITREALVALUE,
+  STAT_STARTTIME,
+  STAT_VSIZE,
+  STAT_RSS,
+  STAT_RSSLIM,
+  STAT_STARTCODE,
+  STAT_ENDCODE,
+  STAT_STARTSTACK,
+  STAT_KSTKESP,
+  STAT_KSTKEIP,
+  STAT_SIGNAL,
+  STAT_BLOCKED,
+  STAT_SIGIGNORE,
+  STAT_SIGCATCH,
+  STAT_WCHAN,
+  STAT_NSWAP,
+  STAT_CNSWAP,
+  STAT_EXIT_SIGNAL,
+  STAT_PROCESSOR,
+  STAT_RT_PRIORITY,
+  STAT_POLICY,
+  STAT_DELAYACCT_BLKIO_TICKS,
+  STAT_GUEST_TIME,
+  STAT_CGUEST_TIME,
+  STAT_START_DATA,
+  STAT_END_DATA,
+  STAT_START_BRK,
+  STAT_ARG_START,
+  STAT_ARG_END,
+  STAT_ENV_START,
+  STAT_ENV_END,
+  STAT_EXIT_CODE,
+  STAT_FIELD_COUNT
+};
+
+// Every field of the stat files of a procfs scan, stored as one typed
+// contiguous array per field so that filters and aggregations over a column
+// can be vectorized.  Row i of every column describes the same task.  The
+// columns are public for reading, but only add() should modify them.
+class StatSnapshot {
+public:
+  // Parse one stat line and append it as a new row.  Fields missing from the
+  // end of the line, as with older kernels, are 0.  Returns false and leaves
+  // the snapshot unchanged if the line is malformed through the flags.
+  bool add(std::string_view stat);
+  size_t size() const { return pid.size(); }
+  std::string_view name(size_t row) const { return names.name(name_id[row]); }
+  // The pinnability check of thread_affinity_is_settable() as a view over
+  // the flags column.
+  bool is_settable(size_t row) const {
+    return !(flags[row] & PF_NO_SETAFFINITY);
+  }
+  // Return the rows for which pred(*this, row) is true.
+  template <typename Pred> std::vector<size_t> select(Pred pred) const {
+    std::vector<size_t> rows{};
+    for (size_t row = 0U; row < size(); row++) {
+      if (pred(*this, row)) {
+        rows.push_back(row);
+      }
+    }
+    return rows;
+  }
+
+  NamePool names{};
+  std::vector<uint32_t> name_id{};
+  std::vector<char> state{};
+  std::vector<int32_t> pid{}, ppid{}, pgrp{}, session{}, tty_nr{}, tpgid{};
+  std::vector<uint32_t> flags{};
+  std::vector<uint64_t> minflt{}, cminflt{}, majflt{}, cmajflt{}, utime{},
+      stime{};
+  std::vector<int64_t> cutime{}, cstime{}, priority{}, nice{}, num_threads{},
+      itrealvalue{};
+  std::vector<uint64_t> starttime{}, vsize{};
+  std::vector<int64_t> rss{};
+  std::vector<uint64_t> rsslim{}, startcode{}, endcode{}, startstack{},
+      kstkesp{}, kstkeip{}, signal{}, blocked{}, sigignore{}, sigcatch{},
+      wchan{}, nswap{}, cnswap{};
+  std::vector<int32_t> exit_signal{}, processor{};
+  std::vector<uint32_t> rt_priority{}, policy{};
+  std::vector<uint64_t> delayacct_blkio_ticks{}, guest_time{};
+  std::vector<int64_t> cguest_time{};
+  std::vector<uint64_t> start_data{}, end_data{}, start_brk{}, arg_start{},
+      arg_end{}, env_start{}, env_end{};
+  std::vector<int32_t> exit_code{};
+};
+
+// Return the numeric value of one field of a stat line, skipping the fields
+// before it without converting them.  Signed fields are returned as their
+// two's complement, as in StatSnapshot.  Returns std::nullopt for STAT_COMM,
+// STAT_STATE or a line which ends before the field.
+std::optional<uint64_t> parse_stat_field(std::string_view stat,
+                                         stat_field field);
+
+// Like parse_stat_field(), but extract count fields, which must be in
+// increasing order, into values in a single pass over the line.  Returns false
+// if any field is missing.
+bool parse_stat_fields(std::string_view stat, const stat_field *fields,
+                       size_t count, uint64_t *values);
+
+// Return the value of the line "key:\t<value>" of a /proc/<pid>/status file,
+// without the newline, or std::nullopt if there is no such line.
+std::optional<std::string_view> parse_status_field(std::string_view status,
+                                                   std::string_view key);
+
+// Append a row to snapshot for every task in procfs_top, or for every thread
+// if all_threads is set.  Each stat file is read and parsed once.
+void read_stat_snapshot(StatSnapshot &snapshot,
+                        const std::string &procfs_top = "/proc/",
+                        bool all_threads = false);
+
+// The result of moving one thread with sched_setaffinity().
+struct repin_outcome {
+  pid_t tid = 0;
+  // 0 on success, otherwise the errno from sched_setaffinity().  ESRCH means
+  // that the thread exited before it could be moved, EINVAL that no CPU in
+  // the list is online or permitted by the thread's cpuset, and EPERM that
+  // the caller lacks CAP_SYS_NICE.
+  int error = 0;
+};
+
+struct repin_summary {
+  size_t moved = 0U;
+  size_t vanished = 0U;
+  size_t failed = 0U;
+};
+
+// Set the CPU affinity of every thread in tids to cpus in-process, divided
+// among a pool of worker threads, without a fork/exec of taskset for each.
+// Passing workers == 0 selects default_worker_count().  Returns one outcome
+// per tid, in the order of tids.  If cpus is empty or names a CPU which
+// cpu_set_t cannot represent, every outcome is EINVAL.
+std::vector<repin_outcome> repin_threads(const std::vector<pid_t> &tids,
+                                         const std::vector<uint32_t> &cpus,
+                                         unsigned int workers = 0U);
+
+repin_summary summarize(const std::vector<repin_outcome> &outcomes);
+
+// Tasks which appeared and disappeared between two TaskCache::refresh() calls.
+struct task_diff {
+  std::vector<tid_data> added{};
+  std::vector<tid_data> removed{};
+  bool empty() const { return added.empty() && removed.empty(); }
+};
+
+// Classification results which persist across scans of procfs, for callers
+// which reclassify periodically.  Each refresh lists the procfs directories,
+// but reads and parses stat files only for tids which were not present in the
+// previous scan, so the cost beyond the directory listing is proportional to
+// the churn rather than to the task count.
+class TaskCache {
+public:
+  TaskCache(const std::string &procfs_top = "/proc/", bool all_threads = false)
+      : procfs_top_(procfs_top), all_threads_(all_threads) {}
+
+  // Rescan procfs and return the tasks which appeared or disappeared.  A tid
+  // which is reused between refreshes is detected only if revalidate is set,
+  // which rereads every stat file and compares start times.
+  task_diff refresh(bool revalidate = false);
+  size_t size() const { return tasks_.size(); }
+  // Add the cached classification to a set like read_thread_data() fills.
+  void fill(
+      std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set) const;
+  // Return the cached start time of tid, if it is present.
+  std::optional<uint64_t> starttime(pid_t tid) const;
+
+private:
+  struct cached_task {
+    uint64_t starttime;
+    uint64_t generation;
+    tid_data data;
+  };
+  std::string procfs_top_;
+  bool all_threads_;
+  // Incremented on each refresh; tasks not seen in the current generation are
+  // gone.
+  uint64_t generation_ = 0U;
+  std::unordered_map<pid_t, cached_task> tasks_{};
+};
+
+enum class output_format { text, json, binary };
+
+// Accepts "text", "json" or "binary".
+std::optional<output_format> parse_output_format(std::string_view name);
+
+// One classified task as a binary RecordWriter stream encodes it: a
+// little-endian int32 tid, a uint8 which is 1 if the task is pinnable, a
+// reserved zero byte and a uint16 name length, followed by the name bytes.
+struct task_record {
+  pid_t tid = 0;
+  bool is_settable = true;
+  std::string_view thread_name{};
+};
+
+constexpr size_t TASK_RECORD_HEADER_SIZE = 8U;
+
+// Decode the record at the front of in and advance in past it.  name points
+// into in.  Returns std::nullopt without advancing if in holds less than a
+// whole record.
+std::optional<task_record> decode_task_record(std::string_view &in);
+
+// Formats classification results into a buffer which is written to fd with a
+// single write() whenever it fills, so that a scan of many tasks costs a few
+// system calls rather than one flush per line like std::endl.  The text format
+// matches what the classifier has always printed; json emits one object per
+// line.
+class RecordWriter {
+public:
+  RecordWriter(int fd, output_format format, size_t buffer_size = 65536U)
+      : fd_(fd), format_(format), capacity_(buffer_size) {
+    buffer_.reserve(capacity_);
+  }
+  ~RecordWriter() { flush(); }
+  RecordWriter(const RecordWriter &) = delete;
+  RecordWriter &operator=(const RecordWriter &) = delete;
+
+  void write(pid_t tid, std::string_view thread_name, bool is_settable);
+  void write(const tid_data &td) {
+    write(td.tid, td.thread_name, td.is_settable);
+  }
+  // Write out the buffer.  Returns false if a write fails, after which
+  // further output is discarded.
+  bool flush();
+
+private:
+  void append_json_string(std::string_view str);
+  int fd_;
+  output_format format_;
+  size_t capacity_;
+  bool failed_ = false;
+  std::string buffer_{};
+};
+
 } // namespace process_affinity
 
 #endif
@@ -0,0 +1,602 @@
+// Microbenchmarks for the classifier.
+// "scale" measures how read_thread_data_parallel() scales with the number of
+// workers against a large synthetic procfs tree.
+// "parse" compares the std::string stat path with the allocation-free one over
+// the procfs/ fixtures.
+// "suite" runs every classifier entry point and parser against synthetic trees
+// of the given sizes and reports tasks/sec and allocations/task.
+// "memory" compares the heap usage per task of the std::set of tid_data with
+// that of a TaskTable.
+// "uring" compares reading every stat file with std::ifstream, with
+// openat()/read()/close() and with StatUring, over /proc and over a synthetic
+// tree, and reports the read(2) and io_uring_enter() calls per file.
+// "replay" classifies the tasks of a procfs archive, either one captured by
+// procfs_archive or one of a synthetic tree of TASKS, which it compares with
+// scanning the tree itself.
+
+#include "classify_process_affinity.hh"
+#include "cpu_noise.hh"
+#include "procfs_archive.hh"
+#include "stat_uring.hh"
+#include "synthetic_procfs.hh"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+using namespace process_affinity;
+namespace fs = std::filesystem;
+
+namespace {
+std::atomic<uint64_t> allocations{0U};
+std::atomic<int64_t> live_bytes{0};
+// Each allocation is preceded by its size, padded to preserve alignment.
+constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+// GCC sees through the header arithmetic and mistakes the free() below for
+// one of memory returned by operator new.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void release(void *p) {
+  if (nullptr == p) {
+    return;
+  }
+  char *base = static_cast<char *>(p) - HEADER_SIZE;
+  live_bytes.fetch_sub(*reinterpret_cast<size_t *>(base),
+                       std::memory_order_relaxed);
+  free(base);
+}
+#pragma GCC diagnostic pop
+} // namespace
+
+// Count every heap allocation in the program, and the bytes in use.
+void *operator new(size_t size) {
+  allocations.fetch_add(1U, std::memory_order_relaxed);
+  live_bytes.fetch_add(size, std::memory_order_relaxed);
+  char *p = static_cast<char *>(malloc(size + HEADER_SIZE));
+  if (nullptr == p) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<size_t *>(p) = size;
+  return p + HEADER_SIZE;
+}
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+
+namespace {
+
+constexpr size_t DEFAULT_TASKS = 20000U;
+constexpr size_t DEFAULT_ITERATIONS = 100000U;
+constexpr size_t DEFAULT_MEMORY_TASKS = 100000U;
+constexpr size_t REPETITIONS = 3U;
+const char *FIXTURES[] = {"procfs/14/stat", "procfs/1422/stat",
+                          "procfs/10851/stat", "procfs/140857/stat"};
+
+// Create a synthetic procfs tree in a new temporary directory.
+optional<fs::path> make_tree(const size_t tasks,
+                             synthetic_procfs_summary &summary) {
+  char tmpl[] = "/tmp/procfs_benchXXXXXX";
+  if (nullptr == mkdtemp(tmpl)) {
+    cerr << "Unable to create temporary directory." << endl;
+    return nullopt;
+  }
+  synthetic_procfs_options options{};
+  options.tasks = tasks;
+  optional<synthetic_procfs_summary> result =
+      make_synthetic_procfs(tmpl, options);
+  if (!result.has_value()) {
+    fs::remove_all(tmpl);
+    return nullopt;
+  }
+  summary = result.value();
+  return fs::path{tmpl};
+}
+
+double time_scan(const string &top, const unsigned int workers) {
+  double best = 0.0;
+  for (size_t rep = 0U; rep < REPETITIONS; rep++) {
+    set<struct tid_data, decltype(tid_data_compare) *> tset{tid_data_compare};
+    const auto start = steady_clock::now();
+    read_thread_data_parallel(tset, top, workers);
+    const duration<double> elapsed = steady_clock::now() - start;
+    if ((0U == rep) || (elapsed.count() < best)) {
+      best = elapsed.count();
+    }
+  }
+  return best;
+}
+
+// The original path: a std::string per file built through a filebuf, then
+// substr() per field.
+bool string_parse(const char *pathname) {
+  optional<string> stat_str = read_thread_stat(string(pathname));
+  return stat_str.has_value() &&
+         thread_affinity_is_settable(stat_str.value()).value_or(false);
+}
+
+// One read() into a reused buffer, then string_view tokenization.
+bool view_parse(const char *pathname, stat_buf_t &buf) {
+  optional<string_view> stat_str = read_thread_stat(pathname, buf);
+  if (!stat_str.has_value()) {
+    return false;
+  }
+  optional<stat_fields> fields = parse_thread_stat(stat_str.value());
+  return fields.has_value() && fields->is_settable();
+}
+
+template <typename Fn>
+void report_parse(const string &label, const size_t iterations, Fn fn) {
+  const size_t files = iterations * size(FIXTURES);
+  size_t settable = 0U;
+  const uint64_t allocs_before = allocations.load();
+  const auto start = steady_clock::now();
+  for (size_t i = 0U; i < iterations; i++) {
+    for (const char *pathname : FIXTURES) {
+      settable += fn(pathname);
+    }
+  }
+  const duration<double, nano> elapsed = steady_clock::now() - start;
+  const uint64_t allocs = allocations.load() - allocs_before;
+  cout << label << ": " << (elapsed.count() / files) << " ns/file "
+       << (static_cast<double>(allocs) / files) << " allocations/file ("
+       << settable << " settable)" << endl;
+}
+
+int parse_benchmark(const size_t iterations) {
+  report_parse("string", iterations, string_parse);
+  stat_buf_t buf;
+  report_parse("string_view", iterations, [&buf](const char *pathname) {
+    return view_parse(pathname, buf);
+  });
+  return EXIT_SUCCESS;
+}
+
+// A realistic mix: most names are shared by many tasks, like the threads of a
+// thread pool, while kworker names are long and nearly unique.
+string task_name(const size_t i) {
+  switch (i % 4U) {
+  case 0U:
+    return "kworker/" + to_string(i % 256U) + ":" + to_string(i) + "-events";
+  case 1U:
+    return "php-fpm";
+  case 2U:
+    return "DOM Worker";
+  default:
+    return "java-gc-" + to_string(i % 64U);
+  }
+}
+
+int memory_benchmark(const size_t tasks) {
+  int64_t before = live_bytes.load();
+  set<struct tid_data, decltype(tid_data_compare) *> tset{tid_data_compare};
+  for (size_t i = 0U; i < tasks; i++) {
+    tset.emplace(i + 1U, (i % 4U), task_name(i));
+  }
+  const int64_t set_bytes = live_bytes.load() - before;
+  cout << "std::set: " << tset.size() << " of " << tasks << " tasks kept, "
+       << (static_cast<double>(set_bytes) / tset.size()) << " bytes/task"
+       << endl;
+
+  before = live_bytes.load();
+  TaskTable table;
+  for (size_t i = 0U; i < tasks; i++) {
+    table.add(i + 1U, (i % 4U) ? 4194560U : 69238848U, task_name(i));
+  }
+  table.finalize();
+  const int64_t table_bytes = live_bytes.load() - before;
+  cout << "TaskTable: " << table.size() << " of " << tasks << " tasks kept, "
+       << (static_cast<double>(table_bytes) / table.size()) << " bytes/task"
+       << endl;
+  return EXIT_SUCCESS;
+}
+
+void usage(const char *prog) {
+  cerr << prog << " scale [TASKS] [MAX_WORKERS]" << endl;
+  cerr << prog << " parse [ITERATIONS]  (run from the source directory)"
+       << endl;
+  cerr << prog << " memory [TASKS]" << endl;
+  cerr << prog << " suite TASKS..." << endl;
+  cerr << prog << " uring [TASKS]" << endl;
+  cerr << prog << " replay [TASKS | ARCHIVE]" << endl;
+}
+
+int scale_benchmark(const size_t tasks, const unsigned int max_workers) {
+  if ((0U == tasks) || (0U == max_workers)) {
+    cerr << "TASKS and MAX_WORKERS must be positive." << endl;
+    return EXIT_FAILURE;
+  }
+
+  synthetic_procfs_summary summary{};
+  const optional<fs::path> top = make_tree(tasks, summary);
+  if (!top.has_value()) {
+    return EXIT_FAILURE;
+  }
+
+  // read_thread_data_parallel() reads only the thread-group leaders.
+  cout << "processes: " << summary.processes << endl;
+  double single = 0.0;
+  // Double the worker count until reaching max_workers.
+  for (unsigned int workers = 1U;; workers = min(workers * 2U, max_workers)) {
+    const double secs = time_scan(top->string(), workers);
+    if (1U == workers) {
+      single = secs;
+    }
+    cout << "workers: " << workers << " seconds: " << secs
+         << " tasks/sec: " << static_cast<uint64_t>(summary.processes / secs)
+         << " speedup: " << (single / secs) << endl;
+    if (workers == max_workers) {
+      break;
+    }
+  }
+  fs::remove_all(top.value());
+  return EXIT_SUCCESS;
+}
+
+struct measurement {
+  double seconds = 0.0;
+  uint64_t allocations = 0U;
+};
+
+// Run fn REPETITIONS times and keep the fastest run.
+template <typename Fn> measurement measure(Fn fn) {
+  measurement best{};
+  for (size_t rep = 0U; rep < REPETITIONS; rep++) {
+    const uint64_t allocs_before = allocations.load();
+    const auto start = steady_clock::now();
+    fn();
+    const duration<double> elapsed = steady_clock::now() - start;
+    if ((0U == rep) || (elapsed.count() < best.seconds)) {
+      best.seconds = elapsed.count();
+      best.allocations = allocations.load() - allocs_before;
+    }
+  }
+  return best;
+}
+
+void report(const string &label, const size_t tasks, const measurement &m) {
+  cout << "  " << left << setw(32) << label << right << setw(12)
+       << static_cast<uint64_t>(tasks / m.seconds) << " tasks/sec "
+       << setw(8) << fixed << setprecision(2)
+       << (static_cast<double>(m.allocations) / tasks) << " allocations/task"
+       << defaultfloat << endl;
+}
+
+using tid_set_t = set<struct tid_data, decltype(tid_data_compare) *>;
+
+// Measure every classifier entry point and parser against one tree.
+int suite_benchmark(const size_t tasks) {
+  synthetic_procfs_summary summary{};
+  const optional<fs::path> top = make_tree(tasks, summary);
+  if (!top.has_value()) {
+    return EXIT_FAILURE;
+  }
+  const string procfs_top = top->string();
+  const size_t leaders = summary.processes;
+  const size_t threads = summary.threads;
+  cout << leaders << " processes, " << threads << " threads:" << endl;
+
+  report("read_thread_data", leaders, measure([&]() {
+           tid_set_t tset{tid_data_compare};
+           read_thread_data(tset, procfs_top);
+         }));
+  report("read_thread_data_parallel", leaders, measure([&]() {
+           tid_set_t tset{tid_data_compare};
+           read_thread_data_parallel(tset, procfs_top);
+         }));
+  report("read_all_thread_data", threads, measure([&]() {
+           tid_set_t tset{tid_data_compare};
+           read_all_thread_data(tset, procfs_top);
+         }));
+  report("read_task_table", threads, measure([&]() {
+           TaskTable table;
+           read_task_table(table, procfs_top, true);
+         }));
+  report("read_stat_snapshot", threads, measure([&]() {
+           StatSnapshot snapshot;
+           read_stat_snapshot(snapshot, procfs_top, true);
+         }));
+  report("read_noise_map", threads, measure([&]() {
+           NoiseMap map;
+           read_noise_map(map, procfs_top);
+         }));
+  report("for_each_task_stat", threads, measure([&]() {
+           for_each_task_stat(procfs_top, true,
+                              [](pid_t, const stat_fields &) { return true; });
+         }));
+
+  // Output of every thread to /dev/null, as the CLI once did with std::endl
+  // and now does with a RecordWriter.
+  const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  ofstream null_stream("/dev/null");
+  report("stream to ostream with endl", threads, measure([&]() {
+           for_each_task_stat(procfs_top, true,
+                              [&](pid_t, const stat_fields &fields) {
+                                null_stream << fields.thread_name << ": "
+                                            << (fields.is_settable()
+                                                    ? "pinnable."
+                                                    : "unpinnable")
+                                            << endl;
+                                return true;
+                              });
+         }));
+  for (const output_format format :
+       {output_format::text, output_format::json, output_format::binary}) {
+    static const char *const labels[] = {"stream to RecordWriter, text",
+                                         "stream to RecordWriter, json",
+                                         "stream to RecordWriter, binary"};
+    report(labels[static_cast<int>(format)], threads, measure([&]() {
+             RecordWriter writer(null_fd, format);
+             for_each_task_stat(procfs_top, true,
+                                [&](pid_t tid, const stat_fields &fields) {
+                                  writer.write(tid, fields.thread_name,
+                                               fields.is_settable());
+                                  return true;
+                                });
+           }));
+  }
+  close(null_fd);
+
+  TaskCache cache(procfs_top, true);
+  cache.refresh();
+  report("TaskCache::refresh, no churn", threads,
+         measure([&]() { cache.refresh(); }));
+
+  // The parsers alone, over lines already in memory.
+  vector<string> lines{};
+  for (const fs::directory_entry &entry :
+       fs::recursive_directory_iterator(top.value())) {
+    if (("stat" == entry.path().filename()) &&
+        ("task" == entry.path().parent_path().parent_path().filename())) {
+      lines.push_back(read_thread_stat(entry.path().string()).value());
+    }
+  }
+  size_t settable = 0U;
+  // The original parser complains about every name which contains ") ".
+  ostringstream complaints;
+  streambuf *saved_cerr = cerr.rdbuf(complaints.rdbuf());
+  report("thread_affinity_is_settable", lines.size(), measure([&]() {
+           for (const string &line : lines) {
+             settable += thread_affinity_is_settable(line).value_or(false);
+           }
+         }));
+  cerr.rdbuf(saved_cerr);
+  report("parse_thread_stat", lines.size(), measure([&]() {
+           for (const string &line : lines) {
+             optional<stat_fields> fields = parse_thread_stat(line);
+             settable += fields.has_value() && fields->is_settable();
+           }
+         }));
+  report("StatSnapshot::add", lines.size(), measure([&]() {
+           StatSnapshot snapshot;
+           for (const string &line : lines) {
+             snapshot.add(line);
+           }
+         }));
+  fs::remove_all(top.value());
+  return (0U < settable) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// The read(2)-family system calls which this process has made, from
+// /proc/self/io.  Reads which io_uring performs are not counted.
+uint64_t read_syscalls() {
+  ifstream io("/proc/self/io");
+  string key;
+  uint64_t value = 0U;
+  while (io >> key >> value) {
+    if ("syscr:" == key) {
+      return value;
+    }
+  }
+  return 0U;
+}
+
+// Read every stat file under top with each method.
+int compare_readers(const string &top) {
+  TaskPaths paths;
+  if (!list_task_stat_paths(top, true, paths) || (0U == paths.size())) {
+    return EXIT_FAILURE;
+  }
+  const int proc_fd = open(top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == proc_fd) {
+    return EXIT_FAILURE;
+  }
+  const size_t files = paths.size();
+  cout << top << ": " << files << " stat files" << endl;
+  size_t read_ok = 0U;
+  const auto report_reads = [&](const string &label, auto fn,
+                                uint64_t enter_calls_before = 0U,
+                                const StatUring *ring = nullptr) {
+    const uint64_t reads_before = read_syscalls();
+    const measurement m = measure(fn);
+    const double reads =
+        static_cast<double>(read_syscalls() - reads_before) / REPETITIONS;
+    cout << "  " << left << setw(24) << label << right << setw(12)
+         << static_cast<uint64_t>(files / m.seconds) << " files/sec "
+         << setw(6) << fixed << setprecision(2) << (reads / files)
+         << " read/file";
+    if (nullptr != ring) {
+      cout << setw(8)
+           << (static_cast<double>(ring->enter_calls() - enter_calls_before) /
+               REPETITIONS / files)
+           << " io_uring_enter/file";
+    }
+    cout << defaultfloat << endl;
+  };
+
+  const string prefix = top + "/";
+  report_reads("std::ifstream", [&]() {
+    for (size_t i = 0U; i < files; i++) {
+      read_ok += read_thread_stat(prefix + paths.path(i)).has_value();
+    }
+  });
+  stat_buf_t buf;
+  report_reads("openat/read/close", [&]() {
+    for (size_t i = 0U; i < files; i++) {
+      read_ok += read_thread_stat(paths.path(i), buf, proc_fd).has_value();
+    }
+  });
+  for (const unsigned int depth : {16U, 64U, 256U}) {
+    StatUring ring(depth);
+    if (!ring.available()) {
+      cout << "  io_uring is unavailable." << endl;
+      break;
+    }
+    report_reads(
+        "StatUring, depth " + to_string(depth),
+        [&]() {
+          ring.read_files(
+              proc_fd, files, [&](size_t i) { return paths.path(i); },
+              [&](size_t, optional<string_view> contents) {
+                read_ok += contents.has_value();
+                return true;
+              });
+        },
+        ring.enter_calls(), &ring);
+  }
+  close(proc_fd);
+  return (0U < read_ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int uring_benchmark(const size_t tasks) {
+  // Tasks which exit during the scan are reported on stderr by the ifstream
+  // path.
+  ostringstream complaints;
+  streambuf *saved_cerr = cerr.rdbuf(complaints.rdbuf());
+  int ret = compare_readers("/proc");
+  cerr.rdbuf(saved_cerr);
+  synthetic_procfs_summary summary{};
+  const optional<fs::path> top = make_tree(tasks, summary);
+  if (!top.has_value()) {
+    return EXIT_FAILURE;
+  }
+  if (EXIT_SUCCESS != compare_readers(top->string())) {
+    ret = EXIT_FAILURE;
+  }
+  fs::remove_all(top.value());
+  return ret;
+}
+
+// Replay archive, which should make no system calls per task.
+void measure_replay(const ProcfsArchive &archive) {
+  const size_t tasks = archive.size();
+  size_t settable = 0U;
+  const uint64_t reads_before = read_syscalls();
+  report("for_each_archived_task_stat", tasks, measure([&]() {
+           for_each_archived_task_stat(
+               archive, true, task_filter{},
+               [&](pid_t, const stat_fields &fields) {
+                 settable += fields.is_settable();
+                 return true;
+               });
+         }));
+  report("NoiseMap from archive", tasks, measure([&]() {
+           NoiseMap map;
+           for (size_t i = 0U; i < tasks; i++) {
+             const optional<string_view> status = archive.status(i);
+             if (status.has_value()) {
+               map.add(archive.stat(i), status.value());
+             }
+           }
+           map.finalize();
+         }));
+  // Less one for reading /proc/self/io itself.
+  cout << "  read(2) calls during replay: "
+       << (read_syscalls() - reads_before - 1U) << endl;
+}
+
+int replay_benchmark(const string &arg) {
+  ProcfsArchive archive;
+  const size_t tasks = strtoul(arg.c_str(), nullptr, 10);
+  if (0U == tasks) {
+    if (!archive.open(arg)) {
+      return EXIT_FAILURE;
+    }
+    cout << arg << ": " << archive.size() << " tasks" << endl;
+    measure_replay(archive);
+    return EXIT_SUCCESS;
+  }
+
+  synthetic_procfs_summary summary{};
+  const optional<fs::path> top = make_tree(tasks, summary);
+  if (!top.has_value()) {
+    return EXIT_FAILURE;
+  }
+  const string procfs_top = top->string();
+  const string archive_path = procfs_top + ".archive";
+  int ret = EXIT_FAILURE;
+  if (capture_procfs(procfs_top, true, archive_path).has_value() &&
+      archive.open(archive_path)) {
+    cout << summary.threads << " threads, " << fs::file_size(archive_path)
+         << " byte archive:" << endl;
+    report("for_each_task_stat", summary.threads, measure([&]() {
+             for_each_task_stat(procfs_top, true,
+                                [](pid_t, const stat_fields &) {
+                                  return true;
+                                });
+           }));
+    measure_replay(archive);
+    ret = EXIT_SUCCESS;
+  }
+  fs::remove(archive_path);
+  fs::remove_all(top.value());
+  return ret;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (2 > argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const string mode{argv[1]};
+  if (("scale" == mode) && (4 >= argc)) {
+    const size_t tasks =
+        (2 < argc) ? strtoul(argv[2], nullptr, 10) : DEFAULT_TASKS;
+    const unsigned int max_workers = (3 < argc)
+                                         ? strtoul(argv[3], nullptr, 10)
+                                         : default_worker_count();
+    exit(scale_benchmark(tasks, max_workers));
+  }
+  if (("parse" == mode) && (3 >= argc)) {
+    exit(parse_benchmark(
+        (2 < argc) ? strtoul(argv[2], nullptr, 10) : DEFAULT_ITERATIONS));
+  }
+  if (("memory" == mode) && (3 >= argc)) {
+    exit(memory_benchmark((2 < argc) ? strtoul(argv[2], nullptr, 10)
+                                     : DEFAULT_MEMORY_TASKS));
+  }
+  if (("uring" == mode) && (3 >= argc)) {
+    exit(uring_benchmark((2 < argc) ? strtoul(argv[2], nullptr, 10)
+                                    : DEFAULT_TASKS));
+  }
+  if (("replay" == mode) && (3 >= argc)) {
+    exit(replay_benchmark((2 < argc) ? argv[2] : to_string(DEFAULT_TASKS)));
+  }
+  if (("suite" == mode) && (3 <= argc)) {
+    for (int arg = 2; arg < argc; arg++) {
+      const size_t tasks = strtoul(argv[arg], nullptr, 10);
+      if ((0U == tasks) || (EXIT_SUCCESS != suite_benchmark(tasks))) {
+        exit(EXIT_FAILURE);
+      }
+    }
+    exit(EXIT_SUCCESS);
+  }
+  usage(argv[0]);
+  exit(EXIT_FAILURE);
+}
@@ -30,8 +30,19 @@ $ cat /proc/93/stat
 
 #include "classify_process_affinity.hh"
 
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -39,19 +50,7 @@ namespace process_affinity {
 
 namespace {
 
-std::string extract_thread_name(const std::string &thread_stat) {
-  size_t name_start = thread_stat.find('(') + 1U;
-  size_t name_end = thread_stat.find(')') - 1U;
-  // Some thread names end with ')', because they hate us.
-  if ((')' == thread_stat.at(name_end + 1U)) &&
-      (')' == thread_stat.at(name_end + 2U))) {
-    name_end++;
-  }
-  return thread_stat.substr(name_start, (name_end - name_start) + 1U);
-}
-
-// Since the code already extracted the thread name, it's safe to assume that
-// the stat string is well-formed.
+// The stat string must be well-formed through the thread name.
 std::optional<std::string>
 extract_thread_flags(const std::string &thread_stat) {
   std::string affinity_str{};
@@ -84,6 +83,166 @@ extract_thread_flags(const std::string &thread_stat) {
   return std::nullopt;
 }
 
+// Fields printed with a signed format in do_task_stat().
+constexpr bool is_signed_field(const uint32_t field) {
+  switch (field) {
+  case STAT_PID:
+  case STAT_PPID:
+  case STAT_PGRP:
+  case STAT_SESSION:
+  case STAT_TTY_NR:
+  case STAT_TPGID:
+  case STAT_CUTIME:
+  case STAT_CSTIME:
+  case STAT_PRIORITY:
+  case STAT_NICE:
+  case STAT_NUM_THREADS:
+  case STAT_ITREALVALUE:
+  case STAT_RSS:
+  case STAT_EXIT_SIGNAL:
+  case STAT_PROCESSOR:
+  case STAT_CGUEST_TIME:
+  case STAT_EXIT_CODE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Buffer for getdents64().  Each record is a fixed header plus a short numeric
+// name, so one call returns hundreds of entries.
+constexpr size_t DIRENT_BUF_SIZE = 32768U;
+
+// Call fn(name, tid) for each entry in the directory dirfd whose name is a
+// nonzero decimal number, until fn returns false.  Returns false if fn asked
+// to stop.  A directory which cannot be read, as when a process has exited,
+// appears empty.
+template <typename Fn> bool for_each_tid_entry(int dirfd, Fn fn) {
+  alignas(struct dirent64) char dirents[DIRENT_BUF_SIZE];
+  while (true) {
+    const ssize_t bytes_read = getdents64(dirfd, dirents, sizeof(dirents));
+    if (0 >= bytes_read) {
+      return true;
+    }
+    for (ssize_t offset = 0; offset < bytes_read;) {
+      const struct dirent64 *entry =
+          reinterpret_cast<const struct dirent64 *>(dirents + offset);
+      offset += entry->d_reclen;
+      pid_t tid = 0;
+      const char *name_end = entry->d_name + strlen(entry->d_name);
+      std::from_chars_result res =
+          std::from_chars(entry->d_name, name_end, tid);
+      if ((res.ec == std::errc()) && (res.ptr == name_end) && (0 < tid) &&
+          !fn(entry->d_name, tid)) {
+        return false;
+      }
+    }
+  }
+}
+
+// Call fn(dirfd, name, tid) for the process pid_name under the procfs
+// directory proc_fd, where name is the task's directory relative to dirfd.
+// With all_threads, visit /proc/<pid>/task/<tid> for every thread until fn
+// returns false, falling back to /proc/<pid> if the task directory is missing.
+// Returns false if fn asked to stop.
+template <typename Fn>
+bool for_each_process_task(int proc_fd, const char *pid_name, pid_t pid,
+                           bool all_threads, Fn &fn) {
+  if (!all_threads) {
+    return fn(proc_fd, pid_name, pid);
+  }
+  // Holds "<pid>/task".
+  char relpath[NAME_MAX + sizeof("/task")];
+  snprintf(relpath, sizeof(relpath), "%s/task", pid_name);
+  const int task_fd =
+      openat(proc_fd, relpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == task_fd) {
+    return fn(proc_fd, pid_name, pid);
+  }
+  const bool keep_going =
+      for_each_tid_entry(task_fd, [&](const char *tid_name, pid_t tid) {
+        return fn(task_fd, tid_name, tid);
+      });
+  close(task_fd);
+  return keep_going;
+}
+
+// Call fn(dirfd, name, tid) for each task under the procfs directory proc_fd,
+// as for_each_process_task() does for one process, until fn returns false.
+template <typename Fn>
+void for_each_task(int proc_fd, bool all_threads, Fn fn) {
+  for_each_tid_entry(proc_fd, [&](const char *pid_name, pid_t pid) {
+    return for_each_process_task(proc_fd, pid_name, pid, all_threads, fn);
+  });
+}
+
+// Read and parse the stat file of the task whose directory is name relative
+// to dirfd.
+std::optional<stat_fields> read_task_stat(int dirfd, const char *name,
+                                          stat_buf_t &buf) {
+  // Holds "<tid>/stat".
+  char relpath[NAME_MAX + sizeof("/stat")];
+  snprintf(relpath, sizeof(relpath), "%s/stat", name);
+  std::optional<std::string_view> stat_str =
+      read_thread_stat(relpath, buf, dirfd);
+  if (!stat_str.has_value()) {
+    return std::nullopt;
+  }
+  return parse_thread_stat(stat_str.value());
+}
+
+int open_procfs(const std::string &procfs_top) {
+  const int proc_fd =
+      open(procfs_top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == proc_fd) {
+    std::cerr << "Unable to open " << procfs_top << ": " << strerror(errno)
+              << std::endl;
+  }
+  return proc_fd;
+}
+
+// Add a classified thread to tid_set, which keeps only the first thread of
+// each name.
+void insert_task(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    pid_t tid, const stat_fields &fields, bool verbose) {
+  std::pair<std::set<struct tid_data>::iterator, bool> result =
+      tid_set.emplace(tid, fields.is_settable(),
+                      std::string(fields.thread_name));
+  if ((!result.second) && verbose) {
+    std::cerr << "Thread " << fields.thread_name << " already present in set."
+              << std::endl;
+  }
+}
+
+// Read and parse the stat file at pathname relative to dirfd, reporting a
+// malformed one.
+std::optional<stat_fields> read_stat_at(int dirfd, const char *pathname,
+                                        pid_t tid, stat_buf_t &buf) {
+  std::optional<std::string_view> stat_str =
+      read_thread_stat(pathname, buf, dirfd);
+  if (!stat_str.has_value()) {
+    return std::nullopt;
+  }
+  std::optional<stat_fields> fields = parse_thread_stat(stat_str.value());
+  if (!fields.has_value()) {
+    std::cerr << "Malformed stat file for thread " << tid << std::endl;
+  }
+  return fields;
+}
+
+// Classify the thread whose stat file is at pathname relative to dirfd.
+void classify_stat_at(
+    int dirfd, const char *pathname, pid_t tid,
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    stat_buf_t &buf, bool verbose) {
+  const std::optional<stat_fields> fields =
+      read_stat_at(dirfd, pathname, tid, buf);
+  if (fields.has_value()) {
+    insert_task(tid_set, tid, fields.value(), verbose);
+  }
+}
+
 } // namespace
 
 bool tid_data_compare(const struct tid_data &a, const struct tid_data &b) {
@@ -120,37 +279,934 @@ std::optional<bool> thread_affinity_is_settable(const std::string &stat_str) {
   return std::nullopt;
 }
 
+std::optional<std::string_view>
+read_thread_stat(const char *pathname, stat_buf_t &buf, int dirfd) {
+  int fd = openat(dirfd, pathname, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return std::nullopt;
+  }
+  // procfs generates the whole stat line on the first read.
+  ssize_t bytes_read = read(fd, buf.data(), buf.size());
+  close(fd);
+  if (0 >= bytes_read) {
+    return std::nullopt;
+  }
+  return std::string_view(buf.data(), bytes_read);
+}
+
+std::optional<stat_fields> parse_thread_stat(std::string_view stat) {
+  stat_fields fields{};
+  const char *const end = stat.data() + stat.size();
+  std::from_chars_result res = std::from_chars(stat.data(), end, fields.tid);
+  if (res.ec != std::errc()) {
+    return std::nullopt;
+  }
+  const size_t name_start = stat.find('(');
+  const size_t name_end = stat.rfind(')');
+  if ((std::string_view::npos == name_start) ||
+      (std::string_view::npos == name_end) || (name_end < name_start)) {
+    return std::nullopt;
+  }
+  fields.thread_name = stat.substr(name_start + 1U, name_end - name_start - 1U);
+  // The state field follows ") ".  Fields are numbered as in the comment at the
+  // top of this file, with the state as field 2.
+  size_t pos = name_end + 2U;
+  for (size_t field_num = 2U; field_num < PF_NO_SET_AFFINITY_POSITION;
+       field_num++) {
+    pos = stat.find(' ', pos);
+    if (std::string_view::npos == pos) {
+      return std::nullopt;
+    }
+    pos++;
+  }
+  if (pos >= stat.size()) {
+    return std::nullopt;
+  }
+  res = std::from_chars(stat.data() + pos, end, fields.flags);
+  if ((res.ec != std::errc()) || ((res.ptr != end) && (' ' != *res.ptr))) {
+    return std::nullopt;
+  }
+  for (size_t field_num = PF_NO_SET_AFFINITY_POSITION;
+       field_num < STARTTIME_POSITION; field_num++) {
+    pos = stat.find(' ', pos);
+    if (std::string_view::npos == pos) {
+      return fields;
+    }
+    pos++;
+  }
+  if (pos < stat.size()) {
+    std::from_chars(stat.data() + pos, end, fields.starttime);
+  }
+  return fields;
+}
+
 void read_thread_data(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::string &procfs_top, bool verbose, const task_filter &filter) {
+  for_each_task_stat(procfs_top, false, filter,
+                     [&](pid_t tid, const stat_fields &fields) {
+                       insert_task(tid_set, tid, fields, verbose);
+                       return true;
+                     });
+}
+
+void read_all_thread_data(
     std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
     const std::string &procfs_top, bool verbose) {
-  fs::path proc_path(procfs_top);
-  for (const fs::directory_entry &entry : fs::directory_iterator(proc_path)) {
-    std::string tid_string = entry.path().stem().string();
-    // Entries in /proc whose filenames start with a digit are tids.
-    if (!isdigit(*tid_string.begin())) {
-      continue;
+  for_each_task_stat(procfs_top, true, task_filter{},
+                     [&](pid_t tid, const stat_fields &fields) {
+                       insert_task(tid_set, tid, fields, verbose);
+                       return true;
+                     });
+}
+
+bool task_filter::matches(const stat_fields &fields) const {
+  if (settable.has_value() && (settable.value() != fields.is_settable())) {
+    return false;
+  }
+  return 0 == fields.thread_name.compare(0U, name_prefix.size(), name_prefix);
+}
+
+bool for_each_task_dir(
+    const std::string &procfs_top, bool all_threads,
+    const std::function<bool(int, const char *, pid_t)> &fn) {
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return false;
+  }
+  for_each_task(proc_fd, all_threads, fn);
+  close(proc_fd);
+  return true;
+}
+
+bool for_each_task_stat(
+    const std::string &procfs_top, bool all_threads,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor) {
+  return for_each_task_stat(procfs_top, all_threads, task_filter{}, visitor);
+}
+
+bool for_each_task_stat(
+    const std::string &procfs_top, bool all_threads, const task_filter &filter,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor) {
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return false;
+  }
+  stat_buf_t buf;
+  // Holds "<tid>/stat".
+  char relpath[NAME_MAX + sizeof("/stat")];
+  for_each_task(proc_fd, all_threads,
+                [&](int dirfd, const char *name, pid_t tid) {
+                  snprintf(relpath, sizeof(relpath), "%s/stat", name);
+                  const std::optional<stat_fields> fields =
+                      read_stat_at(dirfd, relpath, tid, buf);
+                  return !fields.has_value() ||
+                         !filter.matches(fields.value()) ||
+                         visitor(tid, fields.value());
+                });
+  close(proc_fd);
+  return true;
+}
+
+void TaskPaths::add(pid_t tid, std::string_view relpath) {
+  tids_.push_back(tid);
+  offsets_.push_back(arena_.size());
+  arena_.append(relpath);
+  arena_.push_back('\0');
+}
+
+bool list_task_stat_paths(const std::string &procfs_top, bool all_threads,
+                          TaskPaths &paths) {
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return false;
+  }
+  // Holds "<pid>/task/<tid>/stat".
+  char relpath[2 * NAME_MAX + sizeof("/task//stat")];
+  for_each_tid_entry(proc_fd, [&](const char *pid_name, pid_t pid) {
+    int task_fd = -1;
+    if (all_threads) {
+      snprintf(relpath, sizeof(relpath), "%s/task", pid_name);
+      task_fd = openat(proc_fd, relpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
     }
-    pid_t tid = std::strtoul(tid_string.c_str(), NULL, 10);
-    if (0U == tid) {
+    if (-1 == task_fd) {
+      snprintf(relpath, sizeof(relpath), "%s/stat", pid_name);
+      paths.add(pid, relpath);
+      return true;
+    }
+    for_each_tid_entry(task_fd, [&](const char *tid_name, pid_t tid) {
+      snprintf(relpath, sizeof(relpath), "%s/task/%s/stat", pid_name,
+               tid_name);
+      paths.add(tid, relpath);
+      return true;
+    });
+    close(task_fd);
+    return true;
+  });
+  close(proc_fd);
+  return true;
+}
+
+bool read_cgroup_tids(const std::string &cgroup_dir, bool threads,
+                      std::vector<pid_t> &tids) {
+  const char *const list_name = threads ? "cgroup.threads" : "cgroup.procs";
+  std::error_code ec;
+  fs::recursive_directory_iterator it(cgroup_dir, ec);
+  if (ec) {
+    std::cerr << "Unable to read cgroup " << cgroup_dir << ": " << ec.message()
+              << std::endl;
+    return false;
+  }
+  std::vector<fs::path> cgroups{fs::path(cgroup_dir)};
+  for (; it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (it->is_directory(ec)) {
+      cgroups.push_back(it->path());
+    }
+  }
+  std::string contents{};
+  char buf[4096];
+  for (const fs::path &cgroup : cgroups) {
+    // A cgroup removed during the walk has no tasks.
+    const int fd = open((cgroup / list_name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
       continue;
     }
-    std::optional<std::string> stat_str =
-        read_thread_stat(procfs_top + "/" + tid_string + "/stat");
-    if (stat_str.has_value()) {
-      std::string thread_name = extract_thread_name(stat_str.value());
-      std::optional<bool> is_movable =
-          thread_affinity_is_settable(stat_str.value());
-      if (!is_movable.has_value()) {
-        continue;
+    contents.clear();
+    ssize_t bytes_read;
+    while (0 < (bytes_read = read(fd, buf, sizeof(buf)))) {
+      contents.append(buf, bytes_read);
+    }
+    close(fd);
+    const char *pos = contents.data();
+    const char *const end = contents.data() + contents.size();
+    while (pos < end) {
+      pid_t tid = 0;
+      const std::from_chars_result res = std::from_chars(pos, end, tid);
+      if ((res.ec == std::errc()) && (0 < tid)) {
+        tids.push_back(tid);
+      }
+      pos = static_cast<const char *>(memchr(res.ptr, '\n', end - res.ptr));
+      if (nullptr == pos) {
+        break;
       }
+      pos++;
+    }
+  }
+  return true;
+}
+
+bool read_cgroup_thread_data(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::vector<std::string> &cgroup_dirs, bool all_threads,
+    const std::string &procfs_top, bool verbose) {
+  std::vector<pid_t> tids{};
+  for (const std::string &cgroup_dir : cgroup_dirs) {
+    if (!read_cgroup_tids(cgroup_dir, all_threads, tids)) {
+      return false;
+    }
+  }
+  // Nested or repeated cgroup_dirs list the same tasks twice.
+  std::sort(tids.begin(), tids.end());
+  tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return false;
+  }
+  stat_buf_t buf;
+  // Holds "<tid>/stat".  /proc/<tid> exists for every thread, though only
+  // thread-group leaders are listed.
+  char relpath[sizeof("2147483647/stat")];
+  for (const pid_t tid : tids) {
+    snprintf(relpath, sizeof(relpath), "%d/stat", tid);
+    classify_stat_at(proc_fd, relpath, tid, tid_set, buf, verbose);
+  }
+  close(proc_fd);
+  return true;
+}
+
+unsigned int default_worker_count() {
+  const long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return (0 < online) ? static_cast<unsigned int>(online) : 1U;
+}
+
+void read_thread_data_parallel(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set,
+    const std::string &procfs_top, unsigned int workers, bool verbose,
+    bool all_threads) {
+  if (0U == workers) {
+    workers = default_worker_count();
+  }
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return;
+  }
+  // Listing the top-level directory is cheap compared to reading and parsing
+  // the stat files, so do it once up front.  The workers list the task
+  // directories of their own processes.
+  std::vector<pid_t> pids{};
+  for_each_tid_entry(proc_fd, [&pids](const char *, pid_t pid) {
+    pids.push_back(pid);
+    return true;
+  });
+  if (pids.empty()) {
+    close(proc_fd);
+    return;
+  }
+  if (workers > pids.size()) {
+    workers = pids.size();
+  }
+
+  std::vector<std::vector<struct tid_data>> results(workers);
+  std::vector<std::thread> pool{};
+  const size_t chunk = (pids.size() + workers - 1U) / workers;
+  for (unsigned int worker = 0U; worker < workers; worker++) {
+    const size_t first = worker * chunk;
+    const size_t last = std::min(first + chunk, pids.size());
+    pool.emplace_back([&, first, last, worker]() {
+      stat_buf_t buf;
+      std::vector<struct tid_data> &found = results[worker];
+      // Holds "<tid>/stat" and "<pid>".
+      char relpath[NAME_MAX + sizeof("/stat")];
+      char pid_name[sizeof("2147483647")];
+      auto classify = [&](int dirfd, const char *name, pid_t tid) {
+        snprintf(relpath, sizeof(relpath), "%s/stat", name);
+        const std::optional<stat_fields> fields =
+            read_stat_at(dirfd, relpath, tid, buf);
+        if (fields.has_value()) {
+          found.emplace_back(tid, fields->is_settable(),
+                             std::string(fields->thread_name));
+        }
+        return true;
+      };
+      for (size_t i = first; i < last; i++) {
+        snprintf(pid_name, sizeof(pid_name), "%d", pids[i]);
+        for_each_process_task(proc_fd, pid_name, pids[i], all_threads,
+                              classify);
+      }
+    });
+  }
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  close(proc_fd);
+  // Merging in worker order preserves the directory order of the sequential
+  // scan, so the first of several threads with the same name wins as before.
+  for (std::vector<struct tid_data> &found : results) {
+    for (struct tid_data &td : found) {
       std::pair<std::set<struct tid_data>::iterator, bool> result =
-          tid_set.emplace(tid, is_movable.value(), thread_name);
+          tid_set.insert(std::move(td));
+      // The set orders by name, so a rejected thread has the name of the one
+      // already present.
       if ((!result.second) && verbose) {
-        std::cerr << "Thread " << thread_name << " already present in set."
-                  << std::endl;
+        std::cerr << "Thread " << result.first->thread_name
+                  << " already present in set." << std::endl;
       }
     }
   }
 }
 
+uint32_t NamePool::intern(std::string_view name) {
+  if (slots_.size() <= 2U * size()) {
+    grow();
+  }
+  const size_t mask = slots_.size() - 1U;
+  for (size_t slot = std::hash<std::string_view>{}(name) & mask;;
+       slot = (slot + 1U) & mask) {
+    if (0U == slots_[slot]) {
+      const uint32_t id = size();
+      arena_.append(name);
+      offsets_.push_back(arena_.size());
+      slots_[slot] = id + 1U;
+      return id;
+    }
+    if (this->name(slots_[slot] - 1U) == name) {
+      return slots_[slot] - 1U;
+    }
+  }
+}
+
+std::optional<uint32_t> NamePool::find(std::string_view name) const {
+  if (slots_.empty()) {
+    return std::nullopt;
+  }
+  const size_t mask = slots_.size() - 1U;
+  for (size_t slot = std::hash<std::string_view>{}(name) & mask;
+       0U != slots_[slot]; slot = (slot + 1U) & mask) {
+    if (this->name(slots_[slot] - 1U) == name) {
+      return slots_[slot] - 1U;
+    }
+  }
+  return std::nullopt;
+}
+
+// Double the table, which must remain a power of 2, and rehash.
+void NamePool::grow() {
+  std::vector<uint32_t> old_slots(std::max<size_t>(64U, 2U * slots_.size()),
+                                  0U);
+  old_slots.swap(slots_);
+  const size_t mask = slots_.size() - 1U;
+  for (const uint32_t entry : old_slots) {
+    if (0U == entry) {
+      continue;
+    }
+    size_t slot = std::hash<std::string_view>{}(name(entry - 1U)) & mask;
+    while (0U != slots_[slot]) {
+      slot = (slot + 1U) & mask;
+    }
+    slots_[slot] = entry;
+  }
+}
+
+size_t NamePool::memory_usage() const {
+  return arena_.capacity() + (offsets_.capacity() + slots_.capacity()) *
+                                 sizeof(uint32_t);
+}
+
+void TaskTable::add(pid_t tid, uint32_t flags, std::string_view name) {
+  tids_.push_back(tid);
+  flags_.push_back(flags);
+  name_ids_.push_back(names_.intern(name));
+  finalized_ = false;
+}
+
+void TaskTable::finalize() {
+  std::vector<uint32_t> order(size());
+  for (uint32_t row = 0U; row < order.size(); row++) {
+    order[row] = row;
+  }
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return tids_[a] < tids_[b];
+  });
+  std::vector<pid_t> tids(size());
+  std::vector<uint32_t> flags(size());
+  std::vector<uint32_t> name_ids(size());
+  for (size_t row = 0U; row < order.size(); row++) {
+    tids[row] = tids_[order[row]];
+    flags[row] = flags_[order[row]];
+    name_ids[row] = name_ids_[order[row]];
+  }
+  tids_.swap(tids);
+  flags_.swap(flags);
+  name_ids_.swap(name_ids);
+
+  // Counting sort of the rows by name id keeps each name's rows in tid order.
+  name_starts_.assign(names_.size() + 1U, 0U);
+  for (const uint32_t id : name_ids_) {
+    name_starts_[id + 1U]++;
+  }
+  for (size_t id = 1U; id < name_starts_.size(); id++) {
+    name_starts_[id] += name_starts_[id - 1U];
+  }
+  name_rows_.resize(size());
+  std::vector<uint32_t> next(name_starts_.begin(), name_starts_.end() - 1);
+  for (uint32_t row = 0U; row < size(); row++) {
+    name_rows_[next[name_ids_[row]]++] = row;
+  }
+  finalized_ = true;
+}
+
+std::optional<size_t> TaskTable::find_tid(pid_t tid) const {
+  if (finalized_) {
+    std::vector<pid_t>::const_iterator it =
+        std::lower_bound(tids_.begin(), tids_.end(), tid);
+    if ((tids_.end() != it) && (tid == *it)) {
+      return it - tids_.begin();
+    }
+    return std::nullopt;
+  }
+  std::vector<pid_t>::const_iterator it =
+      std::find(tids_.begin(), tids_.end(), tid);
+  if (tids_.end() == it) {
+    return std::nullopt;
+  }
+  return it - tids_.begin();
+}
+
+std::vector<size_t> TaskTable::find_name(std::string_view name) const {
+  std::vector<size_t> rows{};
+  std::optional<uint32_t> id = names_.find(name);
+  if (!id.has_value()) {
+    return rows;
+  }
+  if (finalized_) {
+    for (uint32_t i = name_starts_[id.value()];
+         i < name_starts_[id.value() + 1U]; i++) {
+      rows.push_back(name_rows_[i]);
+    }
+    return rows;
+  }
+  for (size_t row = 0U; row < size(); row++) {
+    if (name_ids_[row] == id.value()) {
+      rows.push_back(row);
+    }
+  }
+  return rows;
+}
+
+size_t TaskTable::memory_usage() const {
+  return sizeof(*this) + names_.memory_usage() +
+         tids_.capacity() * sizeof(pid_t) +
+         (flags_.capacity() + name_ids_.capacity() + name_rows_.capacity() +
+          name_starts_.capacity()) *
+             sizeof(uint32_t);
+}
+
+void read_task_table(TaskTable &table, const std::string &procfs_top,
+                     bool all_threads) {
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return;
+  }
+  stat_buf_t buf;
+  for_each_task(
+      proc_fd, all_threads, [&](int dirfd, const char *name, pid_t tid) {
+        std::optional<stat_fields> fields = read_task_stat(dirfd, name, buf);
+        if (fields.has_value()) {
+          table.add(tid, fields->flags, fields->thread_name);
+        }
+        return true;
+      });
+  close(proc_fd);
+  table.finalize();
+}
+
+bool StatSnapshot::add(std::string_view stat) {
+  while (!stat.empty() && ('\n' == stat.back())) {
+    stat.remove_suffix(1U);
+  }
+  const size_t name_start = stat.find('(');
+  const size_t name_end = stat.rfind(')');
+  if ((std::string_view::npos == name_start) ||
+      (std::string_view::npos == name_end) || (name_end < name_start)) {
+    return false;
+  }
+  // Every numeric field, signed ones stored as their two's complement.
+  std::array<uint64_t, STAT_FIELD_COUNT> values{};
+  const char *const end = stat.data() + stat.size();
+  int64_t tid = 0;
+  std::from_chars_result res = std::from_chars(stat.data(), end, tid);
+  if (res.ec != std::errc()) {
+    return false;
+  }
+  values[STAT_PID] = tid;
+  if ((name_end + 2U) >= stat.size()) {
+    return false;
+  }
+  const char task_state = stat[name_end + 2U];
+  const char *pos = stat.data() + name_end + 3U;
+  uint32_t field = STAT_PPID;
+  for (; (field < STAT_FIELD_COUNT) && (pos < end) && (' ' == *pos);
+       field++) {
+    pos++;
+    if (is_signed_field(field)) {
+      int64_t value = 0;
+      res = std::from_chars(pos, end, value);
+      values[field] = value;
+    } else {
+      res = std::from_chars(pos, end, values[field]);
+    }
+    if (res.ec != std::errc()) {
+      return false;
+    }
+    pos = res.ptr;
+  }
+  if (field <= STAT_FLAGS) {
+    return false;
+  }
+
+  name_id.push_back(names.intern(
+      stat.substr(name_start + 1U, name_end - name_start - 1U)));
+  state.push_back(task_state);
+  pid.push_back(values[STAT_PID]);
+  ppid.push_back(values[STAT_PPID]);
+  pgrp.push_back(values[STAT_PGRP]);
+  session.push_back(values[STAT_SESSION]);
+  tty_nr.push_back(values[STAT_TTY_NR]);
+  tpgid.push_back(values[STAT_TPGID]);
+  flags.push_back(values[STAT_FLAGS]);
+  minflt.push_back(values[STAT_MINFLT]);
+  cminflt.push_back(values[STAT_CMINFLT]);
+  majflt.push_back(values[STAT_MAJFLT]);
+  cmajflt.push_back(values[STAT_CMAJFLT]);
+  utime.push_back(values[STAT_UTIME]);
+  stime.push_back(values[STAT_STIME]);
+  cutime.push_back(values[STAT_CUTIME]);
+  cstime.push_back(values[STAT_CSTIME]);
+  priority.push_back(values[STAT_PRIORITY]);
+  nice.push_back(values[STAT_NICE]);
+  num_threads.push_back(values[STAT_NUM_THREADS]);
+  itrealvalue.push_back(values[STAT_ITREALVALUE]);
+  starttime.push_back(values[STAT_STARTTIME]);
+  vsize.push_back(values[STAT_VSIZE]);
+  rss.push_back(values[STAT_RSS]);
+  rsslim.push_back(values[STAT_RSSLIM]);
+  startcode.push_back(values[STAT_STARTCODE]);
+  endcode.push_back(values[STAT_ENDCODE]);
+  startstack.push_back(values[STAT_STARTSTACK]);
+  kstkesp.push_back(values[STAT_KSTKESP]);
+  kstkeip.push_back(values[STAT_KSTKEIP]);
+  signal.push_back(values[STAT_SIGNAL]);
+  blocked.push_back(values[STAT_BLOCKED]);
+  sigignore.push_back(values[STAT_SIGIGNORE]);
+  sigcatch.push_back(values[STAT_SIGCATCH]);
+  wchan.push_back(values[STAT_WCHAN]);
+  nswap.push_back(values[STAT_NSWAP]);
+  cnswap.push_back(values[STAT_CNSWAP]);
+  exit_signal.push_back(values[STAT_EXIT_SIGNAL]);
+  processor.push_back(values[STAT_PROCESSOR]);
+  rt_priority.push_back(values[STAT_RT_PRIORITY]);
+  policy.push_back(values[STAT_POLICY]);
+  delayacct_blkio_ticks.push_back(values[STAT_DELAYACCT_BLKIO_TICKS]);
+  guest_time.push_back(values[STAT_GUEST_TIME]);
+  cguest_time.push_back(values[STAT_CGUEST_TIME]);
+  start_data.push_back(values[STAT_START_DATA]);
+  end_data.push_back(values[STAT_END_DATA]);
+  start_brk.push_back(values[STAT_START_BRK]);
+  arg_start.push_back(values[STAT_ARG_START]);
+  arg_end.push_back(values[STAT_ARG_END]);
+  env_start.push_back(values[STAT_ENV_START]);
+  env_end.push_back(values[STAT_ENV_END]);
+  exit_code.push_back(values[STAT_EXIT_CODE]);
+  return true;
+}
+
+bool parse_stat_fields(std::string_view stat, const stat_field *fields,
+                       size_t count, uint64_t *values) {
+  const char *const end = stat.data() + stat.size();
+  // The space which precedes field current, once the name has been skipped.
+  const char *pos = nullptr;
+  uint32_t current = STAT_PPID;
+  for (size_t i = 0U; i < count; i++) {
+    const stat_field field = fields[i];
+    if ((STAT_COMM == field) || (STAT_STATE == field) ||
+        (STAT_FIELD_COUNT <= field) ||
+        ((0U < i) && (field <= fields[i - 1U]))) {
+      return false;
+    }
+    const char *start = stat.data();
+    if (STAT_PID != field) {
+      if (nullptr == pos) {
+        const size_t name_end = stat.rfind(')');
+        if ((std::string_view::npos == name_end) ||
+            ((name_end + 3U) >= stat.size())) {
+          return false;
+        }
+        // The space which follows the state.
+        pos = stat.data() + name_end + 3U;
+      }
+      for (; current < field; current++) {
+        pos = static_cast<const char *>(memchr(pos + 1, ' ', end - pos - 1));
+        if (nullptr == pos) {
+          return false;
+        }
+      }
+      start = pos + 1;
+    }
+    std::from_chars_result res{};
+    if (is_signed_field(field)) {
+      int64_t signed_value = 0;
+      res = std::from_chars(start, end, signed_value);
+      values[i] = signed_value;
+    } else {
+      res = std::from_chars(start, end, values[i]);
+    }
+    if (res.ec != std::errc()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::optional<uint64_t> parse_stat_field(std::string_view stat,
+                                         stat_field field) {
+  uint64_t value = 0U;
+  if (!parse_stat_fields(stat, &field, 1U, &value)) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+std::optional<std::string_view> parse_status_field(std::string_view status,
+                                                   std::string_view key) {
+  size_t line = 0U;
+  while (line < status.size()) {
+    size_t line_end = status.find('\n', line);
+    if (std::string_view::npos == line_end) {
+      line_end = status.size();
+    }
+    const size_t colon = line + key.size();
+    if ((colon < line_end) && (':' == status[colon]) &&
+        (0 == status.compare(line, key.size(), key))) {
+      size_t value = colon + 1U;
+      while ((value < line_end) &&
+             (('\t' == status[value]) || (' ' == status[value]))) {
+        value++;
+      }
+      return status.substr(value, line_end - value);
+    }
+    line = line_end + 1U;
+  }
+  return std::nullopt;
+}
+
+void read_stat_snapshot(StatSnapshot &snapshot, const std::string &procfs_top,
+                        bool all_threads) {
+  const int proc_fd = open_procfs(procfs_top);
+  if (-1 == proc_fd) {
+    return;
+  }
+  stat_buf_t buf;
+  // Holds "<tid>/stat".
+  char relpath[NAME_MAX + sizeof("/stat")];
+  for_each_task(proc_fd, all_threads, [&](int dirfd, const char *name, pid_t) {
+    snprintf(relpath, sizeof(relpath), "%s/stat", name);
+    std::optional<std::string_view> stat_str =
+        read_thread_stat(relpath, buf, dirfd);
+    if (stat_str.has_value()) {
+      snapshot.add(stat_str.value());
+    }
+    return true;
+  });
+  close(proc_fd);
+}
+
+std::vector<repin_outcome> repin_threads(const std::vector<pid_t> &tids,
+                                         const std::vector<uint32_t> &cpus,
+                                         unsigned int workers) {
+  std::vector<repin_outcome> outcomes(tids.size());
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  bool valid = !cpus.empty();
+  for (const uint32_t cpu : cpus) {
+    if (CPU_SETSIZE <= cpu) {
+      valid = false;
+      break;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (!valid) {
+    for (size_t i = 0U; i < tids.size(); i++) {
+      outcomes[i] = repin_outcome{tids[i], EINVAL};
+    }
+    return outcomes;
+  }
+
+  if (0U == workers) {
+    workers = default_worker_count();
+  }
+  if (workers > tids.size()) {
+    workers = tids.size();
+  }
+  // Each worker writes only its own slice of outcomes.
+  std::vector<std::thread> pool{};
+  const size_t chunk = workers ? (tids.size() + workers - 1U) / workers : 0U;
+  for (unsigned int worker = 0U; worker < workers; worker++) {
+    const size_t first = worker * chunk;
+    const size_t last = std::min(first + chunk, tids.size());
+    pool.emplace_back([&, first, last]() {
+      for (size_t i = first; i < last; i++) {
+        outcomes[i].tid = tids[i];
+        if (-1 == sched_setaffinity(tids[i], sizeof(cpu_set), &cpu_set)) {
+          outcomes[i].error = errno;
+        }
+      }
+    });
+  }
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  return outcomes;
+}
+
+repin_summary summarize(const std::vector<repin_outcome> &outcomes) {
+  repin_summary summary{};
+  for (const repin_outcome &outcome : outcomes) {
+    if (0 == outcome.error) {
+      summary.moved++;
+    } else if (ESRCH == outcome.error) {
+      summary.vanished++;
+    } else {
+      summary.failed++;
+    }
+  }
+  return summary;
+}
+
+task_diff TaskCache::refresh(bool revalidate) {
+  task_diff diff{};
+  const int proc_fd = open_procfs(procfs_top_);
+  if (-1 == proc_fd) {
+    return diff;
+  }
+  generation_++;
+  stat_buf_t buf;
+  for_each_task(
+      proc_fd, all_threads_, [&](int dirfd, const char *name, pid_t tid) {
+        std::unordered_map<pid_t, cached_task>::iterator it = tasks_.find(tid);
+        if ((tasks_.end() != it) && !revalidate) {
+          it->second.generation = generation_;
+          return true;
+        }
+        std::optional<stat_fields> fields = read_task_stat(dirfd, name, buf);
+        if (!fields.has_value()) {
+          return true;
+        }
+        if (tasks_.end() != it) {
+          if (it->second.starttime == fields->starttime) {
+            it->second.generation = generation_;
+            return true;
+          }
+          // The tid has been reused by a new task.
+          diff.removed.push_back(it->second.data);
+          tasks_.erase(it);
+        }
+        tid_data data(tid, fields->is_settable(),
+                      std::string(fields->thread_name));
+        diff.added.push_back(data);
+        tasks_.emplace(tid,
+                       cached_task{fields->starttime, generation_, data});
+        return true;
+      });
+  close(proc_fd);
+
+  for (std::unordered_map<pid_t, cached_task>::iterator it = tasks_.begin();
+       it != tasks_.end();) {
+    if (generation_ != it->second.generation) {
+      diff.removed.push_back(it->second.data);
+      it = tasks_.erase(it);
+    } else {
+      it++;
+    }
+  }
+  return diff;
+}
+
+void TaskCache::fill(
+    std::set<struct tid_data, decltype(tid_data_compare) *> &tid_set) const {
+  for (const std::pair<const pid_t, cached_task> &task : tasks_) {
+    tid_set.insert(task.second.data);
+  }
+}
+
+std::optional<uint64_t> TaskCache::starttime(pid_t tid) const {
+  std::unordered_map<pid_t, cached_task>::const_iterator it = tasks_.find(tid);
+  if (tasks_.end() == it) {
+    return std::nullopt;
+  }
+  return it->second.starttime;
+}
+
+std::optional<output_format> parse_output_format(std::string_view name) {
+  if ("text" == name) {
+    return output_format::text;
+  }
+  if ("json" == name) {
+    return output_format::json;
+  }
+  if ("binary" == name) {
+    return output_format::binary;
+  }
+  return std::nullopt;
+}
+
+std::optional<task_record> decode_task_record(std::string_view &in) {
+  if (in.size() < TASK_RECORD_HEADER_SIZE) {
+    return std::nullopt;
+  }
+  const unsigned char *header =
+      reinterpret_cast<const unsigned char *>(in.data());
+  const uint32_t tid = header[0] | (header[1] << 8U) | (header[2] << 16U) |
+                       (static_cast<uint32_t>(header[3]) << 24U);
+  const size_t name_len = header[6] | (header[7] << 8U);
+  if (in.size() < TASK_RECORD_HEADER_SIZE + name_len) {
+    return std::nullopt;
+  }
+  task_record record{static_cast<pid_t>(tid), 0U != header[4],
+                     in.substr(TASK_RECORD_HEADER_SIZE, name_len)};
+  in.remove_prefix(TASK_RECORD_HEADER_SIZE + name_len);
+  return record;
+}
+
+void RecordWriter::write(pid_t tid, std::string_view thread_name,
+                         bool is_settable) {
+  switch (format_) {
+  case output_format::text:
+    buffer_.append(thread_name);
+    buffer_.append(is_settable ? ": pinnable.\n" : ": unpinnable\n");
+    break;
+  case output_format::json: {
+    char digits[16];
+    const std::to_chars_result res =
+        std::to_chars(digits, digits + sizeof(digits), tid);
+    buffer_.append("{\"tid\":");
+    buffer_.append(digits, res.ptr - digits);
+    buffer_.append(",\"name\":");
+    append_json_string(thread_name);
+    buffer_.append(is_settable ? ",\"pinnable\":true}\n"
+                               : ",\"pinnable\":false}\n");
+    break;
+  }
+  case output_format::binary: {
+    // Names are at most TASK_COMM_LEN in procfs, so truncation never happens
+    // in practice.
+    const size_t name_len = std::min<size_t>(thread_name.size(), UINT16_MAX);
+    const uint32_t utid = static_cast<uint32_t>(tid);
+    const char header[TASK_RECORD_HEADER_SIZE] = {
+        static_cast<char>(utid & 0xffU),
+        static_cast<char>((utid >> 8U) & 0xffU),
+        static_cast<char>((utid >> 16U) & 0xffU),
+        static_cast<char>((utid >> 24U) & 0xffU),
+        static_cast<char>(is_settable ? 1 : 0),
+        0,
+        static_cast<char>(name_len & 0xffU),
+        static_cast<char>((name_len >> 8U) & 0xffU)};
+    buffer_.append(header, sizeof(header));
+    buffer_.append(thread_name.data(), name_len);
+    break;
+  }
+  }
+  if (buffer_.size() >= capacity_) {
+    flush();
+  }
+}
+
+bool RecordWriter::flush() {
+  size_t written = 0U;
+  while (!failed_ && (written < buffer_.size())) {
+    const ssize_t res =
+        ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+    if (0 > res) {
+      if (EINTR == errno) {
+        continue;
+      }
+      std::cerr << "Output failed: " << strerror(errno) << std::endl;
+      failed_ = true;
+    } else {
+      written += res;
+    }
+  }
+  buffer_.clear();
+  return !failed_;
+}
+
+// Thread names may contain any byte except NUL, including quotes and control
+// characters.  Bytes above 0x7f are copied, so invalid UTF-8 passes through.
+void RecordWriter::append_json_string(std::string_view str) {
+  buffer_.push_back('"');
+  for (const char c : str) {
+    if (('"' == c) || ('\\' == c)) {
+      buffer_.push_back('\\');
+      buffer_.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20U) {
+      char escaped[sizeof("\\u0000")];
+      snprintf(escaped, sizeof(escaped), "\\u%04x",
+               static_cast<unsigned int>(c));
+      buffer_.append(escaped);
+    } else {
+      buffer_.push_back(c);
+    }
+  }
+  buffer_.push_back('"');
+}
+
 } // namespace process_affinity
@@ -1,4 +1,13 @@
 #include "classify_process_affinity.hh"
+#include "test_temp_dir.hh"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
 
 #include "gtest/gtest.h"
 
@@ -35,6 +44,110 @@ TEST(SimpleClassificationTest, ThreadAffinityIsSettable) {
   EXPECT_EQ(1, thread_affinity_is_settable(flagstr));
 }
 
+TEST(SimpleClassificationTest, ReadThreadStatBuffer) {
+  stat_buf_t buf;
+  std::optional<std::string_view> tstat =
+      read_thread_stat("procfs/14/stat", buf);
+  ASSERT_TRUE(tstat.has_value());
+  EXPECT_EQ("14 (ksoftirqd/0) S 2 0 0 0 -1 69238848 0 0 0 0 0 8499 0 0 20 0 1 "
+            "0 21 0 0 18446744073709551615 0 0 0 0 0 0 0 2147483647 0 1 0 0 17 "
+            "0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+            tstat.value());
+  EXPECT_FALSE(
+      read_thread_stat("procfs/11111111111111111111/stat", buf).has_value());
+  // An empty file is not a stat file.
+  EXPECT_FALSE(read_thread_stat("/dev/null", buf).has_value());
+}
+
+TEST(SimpleClassificationTest, ParseThreadStat) {
+  stat_buf_t buf;
+  std::optional<stat_fields> fields =
+      parse_thread_stat(read_thread_stat("procfs/14/stat", buf).value());
+  ASSERT_TRUE(fields.has_value());
+  EXPECT_EQ(14, fields->tid);
+  EXPECT_EQ("ksoftirqd/0", fields->thread_name);
+  EXPECT_EQ(69238848U, fields->flags);
+  EXPECT_FALSE(fields->is_settable());
+
+  // Thread name is enclosed in an extra pair of parentheses.
+  fields =
+      parse_thread_stat(read_thread_stat("procfs/10851/stat", buf).value());
+  ASSERT_TRUE(fields.has_value());
+  EXPECT_EQ("(sd-pam)", fields->thread_name);
+  EXPECT_TRUE(fields->is_settable());
+
+  // Thread name contains spaces.
+  fields =
+      parse_thread_stat(read_thread_stat("procfs/140857/stat", buf).value());
+  ASSERT_TRUE(fields.has_value());
+  EXPECT_EQ("Isolated Web Co", fields->thread_name);
+  EXPECT_EQ(4194560U, fields->flags);
+  EXPECT_EQ(117227U, fields->starttime);
+
+  // Thread names may contain ") (" because they hate us.
+  fields = parse_thread_stat("7 (foo) (bar)) R 1 7 7 0 -1 4194560 0 0");
+  ASSERT_TRUE(fields.has_value());
+  EXPECT_EQ("foo) (bar)", fields->thread_name);
+  EXPECT_EQ(4194560U, fields->flags);
+
+  // Flags are not decimal.
+  EXPECT_FALSE(
+      parse_thread_stat(read_thread_stat("procfs/1/stat", buf).value())
+          .has_value());
+  // Truncated before the flags.
+  EXPECT_FALSE(parse_thread_stat("7 (foo) R 1 7 7 0").has_value());
+  EXPECT_FALSE(parse_thread_stat("7 (foo").has_value());
+  EXPECT_FALSE(parse_thread_stat("").has_value());
+}
+
+TEST(SimpleClassificationTest, ParseStatField) {
+  const std::string_view stat =
+      "140901 (DOM Worker) S 140548 11235 11235 0 -1 4194368 3087 0 0 0 52 "
+      "13 0 0 20 0 2 0 1433915 0 0 18446744073709551615 0 0 0 0 0 0 0 "
+      "2147483647 0 1 0 0 -1 2 0 0 0 0 0 0 0 0 0 0 0 0 0\n";
+  EXPECT_EQ(140901U, parse_stat_field(stat, STAT_PID).value());
+  EXPECT_EQ(140548U, parse_stat_field(stat, STAT_PPID).value());
+  EXPECT_EQ(4194368U, parse_stat_field(stat, STAT_FLAGS).value());
+  EXPECT_EQ(52U, parse_stat_field(stat, STAT_UTIME).value());
+  EXPECT_EQ(13U, parse_stat_field(stat, STAT_STIME).value());
+  EXPECT_EQ(static_cast<uint64_t>(-1),
+            parse_stat_field(stat, STAT_TPGID).value());
+  EXPECT_EQ(2U, parse_stat_field(stat, STAT_PROCESSOR).value());
+  EXPECT_EQ(0U, parse_stat_field(stat, STAT_EXIT_CODE).value());
+  EXPECT_FALSE(parse_stat_field(stat, STAT_COMM).has_value());
+  EXPECT_FALSE(parse_stat_field(stat, STAT_STATE).has_value());
+  EXPECT_FALSE(parse_stat_field("14 (ksoftirqd/0) S 2 0", STAT_FLAGS));
+  EXPECT_FALSE(parse_stat_field("14 (ksoftirqd/0", STAT_PPID));
+
+  const stat_field fields[] = {STAT_PID, STAT_UTIME, STAT_STIME,
+                               STAT_PROCESSOR};
+  uint64_t values[4];
+  ASSERT_TRUE(parse_stat_fields(stat, fields, 4U, values));
+  EXPECT_EQ(140901U, values[0]);
+  EXPECT_EQ(52U, values[1]);
+  EXPECT_EQ(13U, values[2]);
+  EXPECT_EQ(2U, values[3]);
+  const stat_field unordered[] = {STAT_STIME, STAT_UTIME};
+  EXPECT_FALSE(parse_stat_fields(stat, unordered, 2U, values));
+}
+
+TEST(SimpleClassificationTest, ParseStatusField) {
+  const std::string_view status = "Name:\tgmain\nState:\tS (sleeping)\n"
+                                  "Cpus_allowed:\t08\n"
+                                  "Cpus_allowed_list:\t3\n"
+                                  "voluntary_ctxt_switches:\t87\n";
+  EXPECT_EQ("gmain", parse_status_field(status, "Name").value());
+  EXPECT_EQ("S (sleeping)", parse_status_field(status, "State").value());
+  // Cpus_allowed is a prefix of Cpus_allowed_list.
+  EXPECT_EQ("08", parse_status_field(status, "Cpus_allowed").value());
+  EXPECT_EQ("3", parse_status_field(status, "Cpus_allowed_list").value());
+  EXPECT_EQ("87",
+            parse_status_field(status, "voluntary_ctxt_switches").value());
+  EXPECT_FALSE(parse_status_field(status, "Cpus").has_value());
+  EXPECT_FALSE(parse_status_field(status, "Tgid").has_value());
+  EXPECT_FALSE(parse_status_field("", "Name").has_value());
+}
+
 TEST(SimpleClassificationTest, ReadProcfs) {
   // The set ctor must take the comparator as a parameter; otherwise insert()
   // and emplace() will trigger a SEGV.
@@ -65,5 +178,490 @@ TEST(SimpleClassificationTest, ReadProcfs) {
   EXPECT_EQ(tset.end(), tset.find(tid_data(14, false, "systemd")));
 }
 
+TEST(SimpleClassificationTest, ReadAllThreads) {
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  read_all_thread_data(tset, "procfs", true);
+
+  // gmain and DOM Worker are not thread-group leaders.  Processes without a
+  // task directory are classified from their own stat file.
+  std::set<struct tid_data, decltype(tid_data_compare) *> expected(
+      tid_data_compare);
+  ASSERT_TRUE(expected.emplace(10851, 1, "(sd-pam)").second);
+  ASSERT_TRUE(expected.emplace(140901, 1, "DOM Worker").second);
+  ASSERT_TRUE(expected.emplace(140857, 1, "Isolated Web Co").second);
+  ASSERT_TRUE(expected.emplace(1430, 1, "gmain").second);
+  ASSERT_TRUE(expected.emplace(14, 0, "ksoftirqd/0").second);
+  ASSERT_TRUE(expected.emplace(1422, 1, "unattended-upgr").second);
+
+  ASSERT_EQ(expected.size(), tset.size());
+  auto it1 = expected.cbegin();
+  auto it2 = tset.cbegin();
+  for (; it1 != expected.cend() && it2 != tset.cend(); it1++, it2++) {
+    EXPECT_EQ(it1->thread_name, it2->thread_name);
+    EXPECT_EQ(it1->is_settable, it2->is_settable);
+  }
+  // The tids of ksoftirqd/0 depend on directory order.
+  EXPECT_EQ(1430, tset.find(tid_data(0, true, "gmain"))->tid);
+  EXPECT_EQ(140901, tset.find(tid_data(0, true, "DOM Worker"))->tid);
+
+  std::set<struct tid_data, decltype(tid_data_compare) *> missing{
+      tid_data_compare};
+  ::testing::internal::CaptureStderr();
+  read_all_thread_data(missing, "procfs/nonexistent");
+  EXPECT_NE(std::string::npos,
+            ::testing::internal::GetCapturedStderr().find("Unable to open"));
+  EXPECT_TRUE(missing.empty());
+}
+
+TEST(StreamingOutputTest, ForEachTaskStat) {
+  std::map<pid_t, std::string> seen{};
+  EXPECT_TRUE(for_each_task_stat(
+      "procfs", true, [&](pid_t tid, const stat_fields &fields) {
+        EXPECT_EQ(tid, fields.tid);
+        seen.emplace(tid, std::string(fields.thread_name));
+        return true;
+      }));
+  // Every task is visited, including those with duplicate names.
+  EXPECT_EQ("ksoftirqd/0", seen[14]);
+  EXPECT_EQ("ksoftirqd/0", seen[15]);
+  EXPECT_EQ("gmain", seen[1430]);
+  EXPECT_EQ("DOM Worker", seen[140901]);
+
+  // Returning false stops the scan.
+  size_t visited = 0U;
+  EXPECT_TRUE(
+      for_each_task_stat("procfs", true, [&](pid_t, const stat_fields &) {
+        visited++;
+        return false;
+      }));
+  EXPECT_EQ(1U, visited);
+
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(for_each_task_stat(
+      "procfs/nonexistent", false,
+      [](pid_t, const stat_fields &) { return true; }));
+  ::testing::internal::GetCapturedStderr();
+}
+
+TEST(StreamingOutputTest, TaskFilter) {
+  std::map<pid_t, std::string> seen{};
+  task_filter unpinnable{};
+  unpinnable.settable = false;
+  EXPECT_TRUE(for_each_task_stat(
+      "procfs", true, unpinnable, [&](pid_t tid, const stat_fields &fields) {
+        EXPECT_FALSE(fields.is_settable());
+        seen.emplace(tid, std::string(fields.thread_name));
+        return true;
+      }));
+  ASSERT_EQ(2U, seen.size());
+  EXPECT_EQ("ksoftirqd/0", seen[14]);
+  EXPECT_EQ("ksoftirqd/0", seen[15]);
+
+  task_filter prefix{};
+  prefix.name_prefix = "Isolated";
+  prefix.settable = true;
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  read_thread_data(tset, "procfs", false, prefix);
+  ASSERT_EQ(1U, tset.size());
+  EXPECT_EQ(140857, tset.begin()->tid);
+
+  prefix.settable = false;
+  tset.clear();
+  read_thread_data(tset, "procfs", false, prefix);
+  EXPECT_TRUE(tset.empty());
+}
+
+// Return everything which a RecordWriter wrote to a pipe.
+std::string drain(int fd) {
+  std::string out{};
+  char buf[4096];
+  ssize_t bytes_read;
+  while (0 < (bytes_read = read(fd, buf, sizeof(buf)))) {
+    out.append(buf, bytes_read);
+  }
+  return out;
+}
+
+TEST(StreamingOutputTest, RecordWriter) {
+  EXPECT_EQ(output_format::json, parse_output_format("json").value());
+  EXPECT_EQ(output_format::binary, parse_output_format("binary").value());
+  EXPECT_EQ(output_format::text, parse_output_format("text").value());
+  EXPECT_FALSE(parse_output_format("xml").has_value());
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  {
+    RecordWriter writer(fds[1], output_format::text);
+    writer.write(tid_data(14, false, "ksoftirqd/0"));
+    writer.write(1422, "unattended-upgr", true);
+  }
+  close(fds[1]);
+  EXPECT_EQ("ksoftirqd/0: unpinnable\nunattended-upgr: pinnable.\n",
+            drain(fds[0]));
+  close(fds[0]);
+
+  ASSERT_EQ(0, pipe(fds));
+  {
+    // A buffer smaller than one record is flushed after every write.
+    RecordWriter writer(fds[1], output_format::json, 1U);
+    writer.write(10851, "\"a\\b\"\t", true);
+    writer.write(14, "ksoftirqd/0", false);
+  }
+  close(fds[1]);
+  EXPECT_EQ("{\"tid\":10851,\"name\":\"\\\"a\\\\b\\\"\\u0009\","
+            "\"pinnable\":true}\n"
+            "{\"tid\":14,\"name\":\"ksoftirqd/0\",\"pinnable\":false}\n",
+            drain(fds[0]));
+  close(fds[0]);
+
+  ASSERT_EQ(0, pipe(fds));
+  {
+    RecordWriter writer(fds[1], output_format::binary);
+    writer.write(140901, "DOM Worker", true);
+    writer.write(-1, "", false);
+  }
+  close(fds[1]);
+  const std::string binary = drain(fds[0]);
+  close(fds[0]);
+  ASSERT_EQ(2U * TASK_RECORD_HEADER_SIZE + 10U, binary.size());
+  std::string_view in(binary);
+  std::optional<task_record> record = decode_task_record(in);
+  ASSERT_TRUE(record.has_value());
+  EXPECT_EQ(140901, record->tid);
+  EXPECT_TRUE(record->is_settable);
+  EXPECT_EQ("DOM Worker", record->thread_name);
+  // A partial record is not consumed.
+  std::string_view partial = in.substr(0U, TASK_RECORD_HEADER_SIZE - 1U);
+  EXPECT_FALSE(decode_task_record(partial).has_value());
+  EXPECT_EQ(TASK_RECORD_HEADER_SIZE - 1U, partial.size());
+  record = decode_task_record(in);
+  ASSERT_TRUE(record.has_value());
+  EXPECT_EQ(-1, record->tid);
+  EXPECT_FALSE(record->is_settable);
+  EXPECT_TRUE(record->thread_name.empty());
+  EXPECT_TRUE(in.empty());
+}
+
+TEST(CgroupTest, ReadCgroupTids) {
+  std::vector<pid_t> tids{};
+  ASSERT_TRUE(read_cgroup_tids("cgroup/kubepods.slice", false, tids));
+  std::sort(tids.begin(), tids.end());
+  EXPECT_EQ(std::vector<pid_t>({1422, 99999, 140857}), tids);
+
+  tids.clear();
+  ASSERT_TRUE(read_cgroup_tids("cgroup/system.slice", true, tids));
+  EXPECT_EQ(std::vector<pid_t>({14, 15}), tids);
+
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(read_cgroup_tids("cgroup/nonexistent", false, tids));
+  EXPECT_NE(std::string::npos, ::testing::internal::GetCapturedStderr().find(
+                                   "Unable to read cgroup"));
+}
+
+TEST(CgroupTest, ReadCgroupThreadData) {
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  // The pod's cgroup and one of its containers overlap.  99999 has exited.
+  ASSERT_TRUE(read_cgroup_thread_data(
+      tset,
+      {"cgroup/kubepods.slice/pod1",
+       "cgroup/kubepods.slice/pod1/container-a"},
+      false, "procfs"));
+  ASSERT_EQ(2U, tset.size());
+  EXPECT_EQ(140857, tset.begin()->tid);
+  EXPECT_EQ("Isolated Web Co", tset.begin()->thread_name);
+  EXPECT_EQ(1422, tset.rbegin()->tid);
+  EXPECT_EQ("unattended-upgr", tset.rbegin()->thread_name);
+
+  tset.clear();
+  ASSERT_TRUE(read_cgroup_thread_data(tset, {"cgroup/system.slice"}, true,
+                                      "procfs"));
+  ASSERT_EQ(1U, tset.size());
+  EXPECT_FALSE(tset.begin()->is_settable);
+
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(read_cgroup_thread_data(tset, {"cgroup/nonexistent"}, false,
+                                       "procfs"));
+  ::testing::internal::GetCapturedStderr();
+}
+
+TEST(TaskTableTest, NamePool) {
+  NamePool pool;
+  EXPECT_FALSE(pool.find("kworker").has_value());
+  EXPECT_EQ(0U, pool.intern("kworker"));
+  EXPECT_EQ(1U, pool.intern("foo) (bar)"));
+  EXPECT_EQ(0U, pool.intern("kworker"));
+  EXPECT_EQ(2U, pool.intern(""));
+  EXPECT_EQ(3U, pool.size());
+  EXPECT_EQ("foo) (bar)", pool.name(1U));
+  EXPECT_EQ("", pool.name(2U));
+  EXPECT_EQ(1U, pool.find("foo) (bar)").value());
+  // Force several rehashes.
+  for (uint32_t i = 0U; i < 1000U; i++) {
+    EXPECT_EQ(i + 3U, pool.intern("worker-" + std::to_string(i)));
+  }
+  for (uint32_t i = 0U; i < 1000U; i++) {
+    EXPECT_EQ(i + 3U, pool.find("worker-" + std::to_string(i)).value());
+  }
+  EXPECT_EQ(0U, pool.find("kworker").value());
+}
+
+TEST(TaskTableTest, Lookup) {
+  TaskTable table;
+  table.add(30, 69238848U, "ksoftirqd/0");
+  table.add(10, 4194560U, "bash");
+  table.add(20, 69238848U, "ksoftirqd/0");
+  // Lookups work before finalize() too.
+  EXPECT_EQ(1U, table.find_tid(10).value());
+  EXPECT_EQ(2U, table.find_name("ksoftirqd/0").size());
+
+  table.finalize();
+  ASSERT_EQ(3U, table.size());
+  EXPECT_EQ(10, table.tid(0U));
+  EXPECT_EQ(20, table.tid(1U));
+  EXPECT_EQ(30, table.tid(2U));
+  EXPECT_EQ("bash", table.name(0U));
+  EXPECT_TRUE(table.is_settable(0U));
+  EXPECT_FALSE(table.is_settable(1U));
+  EXPECT_EQ(1U, table.find_tid(20).value());
+  EXPECT_FALSE(table.find_tid(25).has_value());
+  EXPECT_EQ(std::vector<size_t>({1U, 2U}), table.find_name("ksoftirqd/0"));
+  EXPECT_EQ(std::vector<size_t>({0U}), table.find_name("bash"));
+  EXPECT_TRUE(table.find_name("zsh").empty());
+  EXPECT_LT(0U, table.memory_usage());
+}
+
+TEST(TaskTableTest, ReadTaskTable) {
+  TaskTable table;
+  read_task_table(table, "procfs");
+  // Unlike the std::set, both tids named ksoftirqd/0 are kept.
+  ASSERT_EQ(5U, table.size());
+  EXPECT_EQ(std::vector<size_t>({0U, 1U}), table.find_name("ksoftirqd/0"));
+  EXPECT_EQ(15, table.tid(1U));
+  EXPECT_EQ("(sd-pam)", table.name(table.find_tid(10851).value()));
+
+  TaskTable threads;
+  read_task_table(threads, "procfs", true);
+  EXPECT_EQ(7U, threads.size());
+  EXPECT_EQ("gmain", threads.name(threads.find_tid(1430).value()));
+}
+
+TEST(StatSnapshotTest, Add) {
+  StatSnapshot snapshot;
+  stat_buf_t buf;
+  ASSERT_TRUE(
+      snapshot.add(read_thread_stat("procfs/140857/stat", buf).value()));
+  ASSERT_EQ(1U, snapshot.size());
+  EXPECT_EQ("Isolated Web Co", snapshot.name(0U));
+  EXPECT_EQ('S', snapshot.state[0]);
+  EXPECT_EQ(140857, snapshot.pid[0]);
+  EXPECT_EQ(140548, snapshot.ppid[0]);
+  EXPECT_EQ(-1, snapshot.tpgid[0]);
+  EXPECT_EQ(4194560U, snapshot.flags[0]);
+  EXPECT_EQ(61117U, snapshot.minflt[0]);
+  EXPECT_EQ(825U, snapshot.utime[0]);
+  EXPECT_EQ(201U, snapshot.stime[0]);
+  EXPECT_EQ(20, snapshot.priority[0]);
+  EXPECT_EQ(28, snapshot.num_threads[0]);
+  EXPECT_EQ(117227U, snapshot.starttime[0]);
+  EXPECT_EQ(2574401536U, snapshot.vsize[0]);
+  EXPECT_EQ(35169, snapshot.rss[0]);
+  EXPECT_EQ(18446744073709551615U, snapshot.rsslim[0]);
+  EXPECT_EQ(17, snapshot.exit_signal[0]);
+  EXPECT_EQ(6, snapshot.processor[0]);
+  EXPECT_EQ(140724686913495U, snapshot.env_end[0]);
+  EXPECT_EQ(0, snapshot.exit_code[0]);
+  EXPECT_TRUE(snapshot.is_settable(0U));
+
+  // Older kernels print fewer fields.
+  ASSERT_TRUE(snapshot.add("7 (foo) (bar)) R 1 7 7 0 -1 69238848 3"));
+  ASSERT_EQ(2U, snapshot.size());
+  EXPECT_EQ("foo) (bar)", snapshot.name(1U));
+  EXPECT_EQ('R', snapshot.state[1]);
+  EXPECT_EQ(3U, snapshot.minflt[1]);
+  EXPECT_EQ(0U, snapshot.utime[1]);
+  EXPECT_FALSE(snapshot.is_settable(1U));
+
+  // Malformed lines leave the columns unchanged.
+  EXPECT_FALSE(snapshot.add("7 (foo) R 1 7 7 0"));
+  EXPECT_FALSE(snapshot.add("7 (foo) R 1 7 7 0 -1 deadbeef"));
+  EXPECT_FALSE(snapshot.add("7 (foo"));
+  EXPECT_EQ(2U, snapshot.size());
+  EXPECT_EQ(2U, snapshot.exit_code.size());
+}
+
+TEST(StatSnapshotTest, ReadStatSnapshot) {
+  StatSnapshot snapshot;
+  read_stat_snapshot(snapshot, "procfs");
+  ASSERT_EQ(5U, snapshot.size());
+  const std::vector<size_t> unpinnable = snapshot.select(
+      [](const StatSnapshot &s, size_t row) { return !s.is_settable(row); });
+  ASSERT_EQ(2U, unpinnable.size());
+  EXPECT_EQ("ksoftirqd/0", snapshot.name(unpinnable[0]));
+
+  StatSnapshot threads;
+  read_stat_snapshot(threads, "procfs", true);
+  EXPECT_EQ(7U, threads.size());
+  const std::vector<size_t> on_cpu3 = threads.select(
+      [](const StatSnapshot &s, size_t row) { return 3 == s.processor[row]; });
+  ASSERT_EQ(1U, on_cpu3.size());
+  EXPECT_EQ("gmain", threads.name(on_cpu3[0]));
+}
+
+TEST(RepinTest, RepinThreads) {
+  cpu_set_t original;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(original), &original));
+  uint32_t cpu = 0U;
+  while (!CPU_ISSET(cpu, &original)) {
+    cpu++;
+  }
+  // No task has a tid this large, so it is as if it exited mid-run.
+  constexpr pid_t VANISHED = 0x7fffffff;
+  const pid_t self = gettid();
+  std::vector<repin_outcome> outcomes =
+      repin_threads({self, VANISHED, self}, {cpu}, 2U);
+  ASSERT_EQ(3U, outcomes.size());
+  EXPECT_EQ(self, outcomes[0].tid);
+  EXPECT_EQ(0, outcomes[0].error);
+  EXPECT_EQ(VANISHED, outcomes[1].tid);
+  EXPECT_EQ(ESRCH, outcomes[1].error);
+  EXPECT_EQ(0, outcomes[2].error);
+  cpu_set_t moved;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(moved), &moved));
+  EXPECT_EQ(1, CPU_COUNT(&moved));
+  EXPECT_TRUE(CPU_ISSET(cpu, &moved));
+
+  repin_summary summary = summarize(outcomes);
+  EXPECT_EQ(2U, summary.moved);
+  EXPECT_EQ(1U, summary.vanished);
+  EXPECT_EQ(0U, summary.failed);
+
+  // An empty list, or a CPU which cpu_set_t cannot hold.
+  outcomes = repin_threads({self}, {});
+  EXPECT_EQ(EINVAL, outcomes[0].error);
+  outcomes = repin_threads({self}, {CPU_SETSIZE});
+  EXPECT_EQ(EINVAL, outcomes[0].error);
+  EXPECT_EQ(1U, summarize(outcomes).failed);
+  EXPECT_TRUE(repin_threads({}, {cpu}).empty());
+
+  ASSERT_EQ(0, sched_setaffinity(0, sizeof(original), &original));
+}
+
+// A writable copy of the procfs fixtures.
+struct TaskCacheTest : public test_util::TempDirTest {
+  void SetUp() override {
+    TempDirTest::SetUp();
+    std::filesystem::copy("procfs", dir,
+                          std::filesystem::copy_options::recursive);
+  }
+
+  void write_stat(const std::string &tid, const std::string &name,
+                  const std::string &starttime) {
+    std::filesystem::create_directory(dir / tid);
+    std::ofstream stat(dir / tid / "stat");
+    stat << tid << " (" << name << ") S 1 0 0 0 -1 4194560 0 0 0 0 0 0 0 0 "
+         << "20 0 1 0 " << starttime << " 0 0\n";
+  }
+};
+
+TEST_F(TaskCacheTest, Refresh) {
+  TaskCache cache(dir);
+  task_diff diff = cache.refresh();
+  // tid 0 and the malformed stat file of tid 1 are ignored.
+  EXPECT_EQ(5U, diff.added.size());
+  EXPECT_TRUE(diff.removed.empty());
+  EXPECT_EQ(5U, cache.size());
+  EXPECT_EQ(1156U, cache.starttime(1422).value());
+  EXPECT_FALSE(cache.starttime(1).has_value());
+
+  // Nothing changed.
+  EXPECT_TRUE(cache.refresh().empty());
+
+  std::filesystem::remove_all(dir / "1422");
+  write_stat("2000", "new task", "5000");
+  diff = cache.refresh();
+  ASSERT_EQ(1U, diff.added.size());
+  EXPECT_EQ(2000, diff.added[0].tid);
+  EXPECT_EQ("new task", diff.added[0].thread_name);
+  ASSERT_EQ(1U, diff.removed.size());
+  EXPECT_EQ(1422, diff.removed[0].tid);
+  EXPECT_EQ("unattended-upgr", diff.removed[0].thread_name);
+
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  cache.fill(tset);
+  // tids 14 and 15 are both ksoftirqd/0.
+  EXPECT_EQ(4U, tset.size());
+  EXPECT_NE(tset.end(), tset.find(tid_data(0, true, "new task")));
+}
+
+TEST_F(TaskCacheTest, ReusedTid) {
+  TaskCache cache(dir);
+  cache.refresh();
+  write_stat("1422", "reused", "9999");
+  // Without revalidation, only the tid is compared.
+  EXPECT_TRUE(cache.refresh().empty());
+  EXPECT_EQ(1156U, cache.starttime(1422).value());
+
+  task_diff diff = cache.refresh(true);
+  ASSERT_EQ(1U, diff.added.size());
+  EXPECT_EQ("reused", diff.added[0].thread_name);
+  ASSERT_EQ(1U, diff.removed.size());
+  EXPECT_EQ("unattended-upgr", diff.removed[0].thread_name);
+  EXPECT_EQ(9999U, cache.starttime(1422).value());
+  EXPECT_EQ(5U, cache.size());
+}
+
+TEST_F(TaskCacheTest, AllThreads) {
+  TaskCache cache(dir, true);
+  EXPECT_EQ(7U, cache.refresh().added.size());
+  std::filesystem::remove_all(dir / "1422" / "task" / "1430");
+  task_diff diff = cache.refresh();
+  EXPECT_TRUE(diff.added.empty());
+  ASSERT_EQ(1U, diff.removed.size());
+  EXPECT_EQ("gmain", diff.removed[0].thread_name);
+}
+
+struct ParallelClassificationTest : public testing::TestWithParam<unsigned> {};
+
+void expect_same_tasks(
+    const std::set<struct tid_data, decltype(tid_data_compare) *> &expected,
+    const std::set<struct tid_data, decltype(tid_data_compare) *> &tset) {
+  ASSERT_EQ(expected.size(), tset.size());
+  auto it1 = expected.cbegin();
+  auto it2 = tset.cbegin();
+  for (; it1 != expected.cend() && it2 != tset.cend(); it1++, it2++) {
+    EXPECT_EQ(it1->thread_name, it2->thread_name);
+    EXPECT_EQ(it1->tid, it2->tid);
+    EXPECT_EQ(it1->is_settable, it2->is_settable);
+  }
+}
+
+TEST_P(ParallelClassificationTest, ReadProcfsParallel) {
+  std::set<struct tid_data, decltype(tid_data_compare) *> expected{
+      tid_data_compare};
+  read_thread_data(expected, "procfs");
+
+  std::set<struct tid_data, decltype(tid_data_compare) *> tset{
+      tid_data_compare};
+  read_thread_data_parallel(tset, "procfs", GetParam());
+  expect_same_tasks(expected, tset);
+
+  expected.clear();
+  read_all_thread_data(expected, "procfs");
+  tset.clear();
+  read_thread_data_parallel(tset, "procfs", GetParam(), false, true);
+  expect_same_tasks(expected, tset);
+}
+// 0 selects the online CPU count.  More workers than tids is legal.
+INSTANTIATE_TEST_SUITE_P(WorkerCounts, ParallelClassificationTest,
+                         testing::Values(0U, 1U, 2U, 3U, 16U));
+
+TEST(SimpleClassificationTest, DefaultWorkerCount) {
+  EXPECT_LE(1U, default_worker_count());
+}
+
 } // namespace local_testing
 } // namespace process_affinity
@@ -0,0 +1,90 @@
+#ifndef CPU_NOISE_H
+#define CPU_NOISE_H
+
+// A per-CPU map of the tasks which would disturb a CPU reserved for
+// latency-critical work, for deciding which CPUs to isolate with isolcpus= or
+// nohz_full=.  Each task's flags and last CPU come from /proc/<pid>/stat and
+// its affinity from Cpus_allowed_list in /proc/<pid>/status.
+
+#include "classify_process_affinity.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace process_affinity {
+
+struct noise_task {
+  pid_t tid = 0;
+  uint32_t name_id = 0U;
+  // Id of the task's Cpus_allowed_list, of which NoiseMap keeps one copy.
+  uint32_t cpus_id = 0U;
+  // Stat field STAT_PROCESSOR, the CPU on which the task last ran, or -1.
+  int32_t processor = -1;
+  bool is_settable = true;
+};
+
+// The tasks which disturb one CPU.  Tasks which may run on every CPU are not
+// listed, since they disturb none in particular.
+struct cpu_noise {
+  // Rows of unpinnable tasks allowed on this CPU but not on every CPU, mostly
+  // per-CPU kthreads like ksoftirqd/N.  Only offlining the CPU removes them.
+  std::vector<size_t> unpinnable{};
+  // Rows of pinnable tasks restricted to CPUs which include this one, as by
+  // taskset.  Repinning can move them.
+  std::vector<size_t> bound{};
+  // The number of tasks of any kind which last ran on this CPU.
+  size_t last_ran = 0U;
+};
+
+class NoiseMap {
+public:
+  // Record a task from the contents of its stat and status files.  Returns
+  // false if either is malformed.  Each distinct Cpus_allowed_list is parsed
+  // once, so that most tasks cost no allocation beyond their row.
+  bool add(std::string_view stat, std::string_view status);
+  // Attribute the tasks to CPUs once all are added.  The CPUs of the map are
+  // those which appear in any task's Cpus_allowed_list.
+  void finalize();
+
+  size_t size() const { return tasks_.size(); }
+  const noise_task &task(size_t row) const { return tasks_[row]; }
+  std::string_view name(size_t row) const {
+    return names_.name(tasks_[row].name_id);
+  }
+  const std::vector<uint32_t> &cpus() const { return cpus_; }
+  // cpu must be one of cpus().
+  const cpu_noise &noise(uint32_t cpu) const { return per_cpu_[cpu]; }
+  // Tasks which may run on every CPU.
+  size_t floating_pinnable() const { return floating_pinnable_; }
+  size_t floating_unpinnable() const { return floating_unpinnable_; }
+  // The CPUs which have no more unpinnable tasks than the least disturbed
+  // CPU, that is, only the per-CPU kthreads which every CPU has.  Once their
+  // bound tasks are moved and the floating tasks are kept off them, as
+  // isolcpus= or repinning does, nothing else runs there.
+  std::vector<uint32_t> quiet_candidates() const;
+
+private:
+  NamePool names_{};
+  NamePool cpulists_{};
+  // The parsed form of each list in cpulists_, indexed by cpus_id.
+  std::vector<std::vector<uint32_t>> allowed_{};
+  std::vector<noise_task> tasks_{};
+  std::vector<uint32_t> cpus_{};
+  // Indexed by CPU number, so that it has entries for CPUs not in cpus_.
+  std::vector<cpu_noise> per_cpu_{};
+  size_t floating_pinnable_ = 0U;
+  size_t floating_unpinnable_ = 0U;
+};
+
+// Populate map from a single pass over procfs_top, reading the stat and status
+// files of every thread, or of thread-group leaders only unless all_threads is
+// set, and finalize() it.  Returns false if procfs_top cannot be opened.
+// Tasks which exit during the scan are omitted.
+bool read_noise_map(NoiseMap &map, const std::string &procfs_top = "/proc/",
+                    bool all_threads = true);
+
+} // namespace process_affinity
+
+#endif
@@ -0,0 +1,135 @@
+#include "cpu_noise.hh"
+#include "cpulist.hh"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+
+namespace process_affinity {
+
+namespace {
+
+std::optional<std::string_view>
+read_status(int dirfd, const char *name,
+            std::array<char, STATUS_BUF_SIZE> &buf) {
+  // Holds "<tid>/status".
+  char relpath[NAME_MAX + sizeof("/status")];
+  snprintf(relpath, sizeof(relpath), "%s/status", name);
+  const int fd = openat(dirfd, relpath, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return std::nullopt;
+  }
+  const ssize_t bytes_read = read(fd, buf.data(), buf.size());
+  close(fd);
+  if (0 >= bytes_read) {
+    return std::nullopt;
+  }
+  return std::string_view(buf.data(), bytes_read);
+}
+
+} // namespace
+
+bool NoiseMap::add(std::string_view stat, std::string_view status) {
+  const std::optional<stat_fields> fields = parse_thread_stat(stat);
+  const std::optional<std::string_view> list =
+      parse_status_field(status, "Cpus_allowed_list");
+  if (!fields.has_value() || !list.has_value()) {
+    return false;
+  }
+  std::optional<uint32_t> cpus_id = cpulists_.find(list.value());
+  if (!cpus_id.has_value()) {
+    std::optional<std::vector<uint32_t>> cpus =
+        cpulist::parse_cpulist(list.value());
+    if (!cpus.has_value()) {
+      return false;
+    }
+    cpus_id = cpulists_.intern(list.value());
+    allowed_.push_back(std::move(cpus.value()));
+  }
+  noise_task task{};
+  task.tid = fields->tid;
+  task.name_id = names_.intern(fields->thread_name);
+  task.cpus_id = cpus_id.value();
+  const std::optional<uint64_t> processor =
+      parse_stat_field(stat, STAT_PROCESSOR);
+  if (processor.has_value() && (INT32_MAX >= processor.value())) {
+    task.processor = processor.value();
+  }
+  task.is_settable = fields->is_settable();
+  tasks_.push_back(task);
+  return true;
+}
+
+void NoiseMap::finalize() {
+  cpus_.clear();
+  for (const std::vector<uint32_t> &allowed : allowed_) {
+    cpus_.insert(cpus_.end(), allowed.begin(), allowed.end());
+  }
+  std::sort(cpus_.begin(), cpus_.end());
+  cpus_.erase(std::unique(cpus_.begin(), cpus_.end()), cpus_.end());
+  per_cpu_.assign(cpus_.empty() ? 0U : (cpus_.back() + 1U), cpu_noise{});
+  floating_pinnable_ = 0U;
+  floating_unpinnable_ = 0U;
+
+  for (size_t row = 0U; row < tasks_.size(); row++) {
+    const noise_task &task = tasks_[row];
+    const std::vector<uint32_t> &allowed = allowed_[task.cpus_id];
+    if ((0 <= task.processor) &&
+        (static_cast<size_t>(task.processor) < per_cpu_.size())) {
+      per_cpu_[task.processor].last_ran++;
+    }
+    if (allowed == cpus_) {
+      (task.is_settable ? floating_pinnable_ : floating_unpinnable_)++;
+      continue;
+    }
+    for (const uint32_t cpu : allowed) {
+      (task.is_settable ? per_cpu_[cpu].bound : per_cpu_[cpu].unpinnable)
+          .push_back(row);
+    }
+  }
+}
+
+std::vector<uint32_t> NoiseMap::quiet_candidates() const {
+  size_t least = SIZE_MAX;
+  for (const uint32_t cpu : cpus_) {
+    least = std::min(least, per_cpu_[cpu].unpinnable.size());
+  }
+  std::vector<uint32_t> quiet{};
+  for (const uint32_t cpu : cpus_) {
+    if (per_cpu_[cpu].unpinnable.size() == least) {
+      quiet.push_back(cpu);
+    }
+  }
+  return quiet;
+}
+
+bool read_noise_map(NoiseMap &map, const std::string &procfs_top,
+                    bool all_threads) {
+  stat_buf_t stat_buf;
+  std::array<char, STATUS_BUF_SIZE> status_buf;
+  // Holds "<tid>/stat".
+  char relpath[NAME_MAX + sizeof("/stat")];
+  const bool opened = for_each_task_dir(
+      procfs_top, all_threads, [&](int dirfd, const char *name, pid_t) {
+        snprintf(relpath, sizeof(relpath), "%s/stat", name);
+        const std::optional<std::string_view> stat =
+            read_thread_stat(relpath, stat_buf, dirfd);
+        if (!stat.has_value()) {
+          return true;
+        }
+        const std::optional<std::string_view> status =
+            read_status(dirfd, name, status_buf);
+        if (status.has_value()) {
+          map.add(stat.value(), status.value());
+        }
+        return true;
+      });
+  map.finalize();
+  return opened;
+}
+
+} // namespace process_affinity
@@ -0,0 +1,106 @@
+#include "cpu_noise.hh"
+#include "synthetic_procfs.hh"
+#include "test_temp_dir.hh"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+namespace process_affinity {
+namespace local_testing {
+
+using NoiseMapTest = test_util::TempDirTest;
+
+std::vector<pid_t> tids(const NoiseMap &map, const std::vector<size_t> &rows) {
+  std::vector<pid_t> result{};
+  for (const size_t row : rows) {
+    result.push_back(map.task(row).tid);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST_F(NoiseMapTest, Add) {
+  NoiseMap map;
+  const std::string stat = "14 (ksoftirqd/0) S 2 0 0 0 -1 69238848 0 0 0 0 0 "
+                           "8499 0 0 20 0 1 0 21 0 0 18446744073709551615 0 0 "
+                           "0 0 0 0 0 2147483647 0 1 0 0 17 0 0 0 0 0 0 0 0 "
+                           "0 0 0 0 0 0\n";
+  EXPECT_TRUE(map.add(stat, "Name:\tksoftirqd/0\nCpus_allowed:\t01\n"
+                            "Cpus_allowed_list:\t0\n"));
+  EXPECT_FALSE(map.add(stat, "Name:\tksoftirqd/0\n"));
+  EXPECT_FALSE(map.add(stat, "Cpus_allowed_list:\t1-\n"));
+  EXPECT_FALSE(map.add("14 (ksoftirqd/0", "Cpus_allowed_list:\t0\n"));
+  ASSERT_EQ(1U, map.size());
+  EXPECT_EQ(14, map.task(0U).tid);
+  EXPECT_EQ("ksoftirqd/0", map.name(0U));
+  EXPECT_EQ(0, map.task(0U).processor);
+  EXPECT_FALSE(map.task(0U).is_settable);
+}
+
+TEST_F(NoiseMapTest, ReadNoiseMap) {
+  NoiseMap map;
+  ASSERT_TRUE(read_noise_map(map, "procfs"));
+  // procfs/1 has a malformed stat file and procfs/0 is not a task.
+  EXPECT_EQ(7U, map.size());
+  ASSERT_EQ(8U, map.cpus().size());
+  EXPECT_EQ(7U, map.cpus().back());
+  EXPECT_EQ(std::vector<pid_t>({14, 15}), tids(map, map.noise(0U).unpinnable));
+  EXPECT_TRUE(map.noise(0U).bound.empty());
+  EXPECT_EQ(std::vector<pid_t>({140901}), tids(map, map.noise(2U).bound));
+  EXPECT_EQ(std::vector<pid_t>({1430}), tids(map, map.noise(3U).bound));
+  EXPECT_EQ(std::vector<pid_t>({140901}), tids(map, map.noise(6U).bound));
+  EXPECT_TRUE(map.noise(5U).bound.empty());
+  // (sd-pam), unattended-upgr and Isolated Web Co may run anywhere.
+  EXPECT_EQ(3U, map.floating_pinnable());
+  EXPECT_EQ(0U, map.floating_unpinnable());
+  EXPECT_EQ(3U, map.noise(0U).last_ran);
+  EXPECT_EQ(1U, map.noise(7U).last_ran);
+  EXPECT_EQ(0U, map.noise(1U).last_ran);
+  EXPECT_EQ(std::vector<uint32_t>({1U, 2U, 3U, 4U, 5U, 6U, 7U}),
+            map.quiet_candidates());
+
+  NoiseMap leaders;
+  ASSERT_TRUE(read_noise_map(leaders, "procfs", false));
+  EXPECT_EQ(5U, leaders.size());
+  EXPECT_TRUE(leaders.noise(3U).bound.empty());
+
+  NoiseMap missing;
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(read_noise_map(missing, "procfs/nonexistent"));
+  ::testing::internal::GetCapturedStderr();
+  EXPECT_EQ(0U, missing.size());
+  EXPECT_TRUE(missing.quiet_candidates().empty());
+}
+
+TEST_F(NoiseMapTest, Synthetic) {
+  synthetic_procfs_options options{};
+  options.tasks = 2000U;
+  options.cpus = 4U;
+  const std::optional<synthetic_procfs_summary> summary =
+      make_synthetic_procfs(dir, options);
+  ASSERT_TRUE(summary.has_value());
+  NoiseMap map;
+  ASSERT_TRUE(read_noise_map(map, dir));
+
+  ASSERT_EQ(summary->threads, map.size());
+  EXPECT_EQ(std::vector<uint32_t>({0U, 1U, 2U, 3U}), map.cpus());
+  // Per-CPU kthreads and bound user threads are each bound to one CPU.
+  size_t unpinnable = 0U;
+  size_t bound = 0U;
+  size_t last_ran = 0U;
+  for (const uint32_t cpu : map.cpus()) {
+    unpinnable += map.noise(cpu).unpinnable.size();
+    bound += map.noise(cpu).bound.size();
+    last_ran += map.noise(cpu).last_ran;
+  }
+  EXPECT_EQ(summary->unpinnable, unpinnable);
+  EXPECT_EQ(summary->bound, bound);
+  EXPECT_EQ(0U, map.floating_unpinnable());
+  EXPECT_EQ(summary->threads - unpinnable - bound, map.floating_pinnable());
+  EXPECT_EQ(summary->threads, last_ran);
+  EXPECT_FALSE(map.quiet_candidates().empty());
+}
+
+} // namespace local_testing
+} // namespace process_affinity
@@ -0,0 +1,60 @@
+#ifndef CPULIST_H
+#define CPULIST_H
+
+// Conversions for the kernel's cpulist format, as in
+// /sys/devices/system/cpu/online, "taskset -c" and isolcpus=: comma-separated
+// CPU numbers and ranges like "0-3,8,10-11".  See
+// Documentation/admin-guide/kernel-parameters.rst.
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cpulist {
+
+// Return the sorted, deduplicated CPUs in list, or std::nullopt if list is
+// malformed or names a CPU of CPU_SETSIZE or more.  A trailing newline, as in
+// sysfs files, is ignored.
+std::optional<std::vector<uint32_t>> parse_cpulist(std::string_view list);
+
+// Return cpus, which must be sorted, in the most compact cpulist form.
+std::string format_cpulist(const std::vector<uint32_t> &cpus);
+
+// Return the CPUs which are online, from the cpulist in path.  If it cannot be
+// read, as in a container without sysfs, assume that CPUs 0 through
+// sysconf(_SC_NPROCESSORS_ONLN) - 1 are.
+std::vector<uint32_t>
+online_cpus(const std::string &path = "/sys/devices/system/cpu/online");
+
+// Where a CPU sits in the machine, from its topology and cache directories
+// under /sys/devices/system/cpu/cpuN.  A group of CPUs is named by its
+// lowest-numbered member.  Whatever cannot be read is assumed unshared: the
+// CPU is its own core and last-level cache, in package 0.
+struct cpu_topology {
+  uint32_t cpu = 0U;
+  // physical_package_id, that is, the socket.
+  uint32_t package = 0U;
+  // The lowest CPU which shares the last-level cache, which on AMD is per
+  // core complex (CCX) rather than per package.
+  uint32_t llc = 0U;
+  // The lowest SMT sibling.
+  uint32_t core = 0U;
+};
+
+cpu_topology read_topology(uint32_t cpu, const std::string &sysfs =
+                                               "/sys/devices/system/cpu");
+
+// How far apart two CPUs are, nearest first.
+enum class cpu_distance { same_cpu, smt, llc, package, remote };
+
+const char *cpu_distance_name(cpu_distance distance);
+cpu_distance distance(const cpu_topology &a, const cpu_topology &b);
+// Sort by package, then last-level cache, then core, so that the CPUs of each
+// group are adjacent.
+void sort_by_topology(std::vector<cpu_topology> &cpus);
+
+} // namespace cpulist
+
+#endif
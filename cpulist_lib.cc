@@ -0,0 +1,189 @@
+#include "cpulist.hh"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <tuple>
+
+namespace cpulist {
+
+std::optional<std::vector<uint32_t>> parse_cpulist(std::string_view list) {
+  while (!list.empty() && ('\n' == list.back())) {
+    list.remove_suffix(1U);
+  }
+  std::vector<uint32_t> cpus{};
+  if (list.empty()) {
+    return std::nullopt;
+  }
+  const char *pos = list.data();
+  const char *const end = list.data() + list.size();
+  while (pos < end) {
+    uint32_t first = 0U;
+    std::from_chars_result res = std::from_chars(pos, end, first);
+    if (res.ec != std::errc()) {
+      return std::nullopt;
+    }
+    uint32_t last = first;
+    if ((res.ptr < end) && ('-' == *res.ptr)) {
+      res = std::from_chars(res.ptr + 1, end, last);
+      if ((res.ec != std::errc()) || (last < first)) {
+        return std::nullopt;
+      }
+    }
+    // Reject CPUs which no cpu_set_t can hold before expanding the range.
+    if (last >= CPU_SETSIZE) {
+      return std::nullopt;
+    }
+    for (uint32_t cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    pos = res.ptr;
+    if (pos < end) {
+      // A separator must be followed by another CPU.
+      if ((',' != *pos) || (pos + 1 == end)) {
+        return std::nullopt;
+      }
+      pos++;
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::string format_cpulist(const std::vector<uint32_t> &cpus) {
+  std::string list{};
+  for (size_t i = 0U; i < cpus.size();) {
+    size_t j = i;
+    while (((j + 1U) < cpus.size()) && (cpus[j + 1U] == cpus[j] + 1U)) {
+      j++;
+    }
+    if (!list.empty()) {
+      list += ',';
+    }
+    list += std::to_string(cpus[i]);
+    if (j > i) {
+      list += '-' + std::to_string(cpus[j]);
+    }
+    i = j + 1U;
+  }
+  return list;
+}
+
+std::vector<uint32_t> online_cpus(const std::string &path) {
+  std::ifstream online(path);
+  std::string list{};
+  if (std::getline(online, list)) {
+    std::optional<std::vector<uint32_t>> cpus = parse_cpulist(list);
+    if (cpus.has_value()) {
+      return cpus.value();
+    }
+  }
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  std::vector<uint32_t> cpus{};
+  for (long cpu = 0; cpu < std::max(count, 1L); cpu++) {
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+namespace {
+
+std::optional<uint32_t> read_number(const std::string &path) {
+  std::ifstream file(path);
+  uint32_t number;
+  if (file >> number) {
+    return number;
+  }
+  return std::nullopt;
+}
+
+// The lowest CPU in the cpulist in path.
+std::optional<uint32_t> read_first_cpu(const std::string &path) {
+  std::ifstream file(path);
+  std::string list{};
+  if (!std::getline(file, list)) {
+    return std::nullopt;
+  }
+  const std::optional<std::vector<uint32_t>> cpus = parse_cpulist(list);
+  if (!cpus.has_value()) {
+    return std::nullopt;
+  }
+  return cpus.value().front();
+}
+
+} // namespace
+
+cpu_topology read_topology(uint32_t cpu, const std::string &sysfs) {
+  const std::string dir = sysfs + "/cpu" + std::to_string(cpu);
+  cpu_topology topology{cpu, 0U, cpu, cpu};
+  topology.package =
+      read_number(dir + "/topology/physical_package_id").value_or(0U);
+  topology.core =
+      read_first_cpu(dir + "/topology/thread_siblings_list").value_or(cpu);
+  // The last-level cache is the highest-level one which holds data, and the
+  // index directories are numbered consecutively from 0.
+  uint32_t llc_level = 0U;
+  for (uint32_t index = 0U;; index++) {
+    const std::string cache = dir + "/cache/index" + std::to_string(index);
+    const std::optional<uint32_t> level = read_number(cache + "/level");
+    if (!level.has_value()) {
+      break;
+    }
+    std::ifstream type_file(cache + "/type");
+    std::string type{};
+    std::getline(type_file, type);
+    if (("Instruction" == type) || (level.value() <= llc_level)) {
+      continue;
+    }
+    const std::optional<uint32_t> first =
+        read_first_cpu(cache + "/shared_cpu_list");
+    if (first.has_value()) {
+      llc_level = level.value();
+      topology.llc = first.value();
+    }
+  }
+  return topology;
+}
+
+const char *cpu_distance_name(cpu_distance distance) {
+  switch (distance) {
+  case cpu_distance::same_cpu:
+    return "same CPU";
+  case cpu_distance::smt:
+    return "SMT siblings";
+  case cpu_distance::llc:
+    return "shared LLC";
+  case cpu_distance::package:
+    return "same package";
+  case cpu_distance::remote:
+    return "cross package";
+  }
+  return "unknown";
+}
+
+cpu_distance distance(const cpu_topology &a, const cpu_topology &b) {
+  if (a.cpu == b.cpu) {
+    return cpu_distance::same_cpu;
+  }
+  if (a.package != b.package) {
+    return cpu_distance::remote;
+  }
+  if (a.llc != b.llc) {
+    return cpu_distance::package;
+  }
+  return (a.core == b.core) ? cpu_distance::smt : cpu_distance::llc;
+}
+
+void sort_by_topology(std::vector<cpu_topology> &cpus) {
+  std::sort(cpus.begin(), cpus.end(),
+            [](const cpu_topology &a, const cpu_topology &b) {
+              return std::tie(a.package, a.llc, a.core, a.cpu) <
+                     std::tie(b.package, b.llc, b.core, b.cpu);
+            });
+}
+
+} // namespace cpulist
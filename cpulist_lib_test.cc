@@ -0,0 +1,137 @@
+#include "cpulist.hh"
+#include "test_temp_dir.hh"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace cpulist {
+namespace local_testing {
+
+using CpulistTest = test_util::TempDirTest;
+
+TEST_F(CpulistTest, Parse) {
+  EXPECT_EQ(std::vector<uint32_t>({0U}), parse_cpulist("0").value());
+  EXPECT_EQ(std::vector<uint32_t>({0U, 1U, 2U, 3U}),
+            parse_cpulist("0-3\n").value());
+  EXPECT_EQ(std::vector<uint32_t>({1U, 3U, 4U, 5U, 8U}),
+            parse_cpulist("8,3-5,1").value());
+  // Overlapping ranges are merged.
+  EXPECT_EQ(std::vector<uint32_t>({2U, 3U, 4U}),
+            parse_cpulist("2-3,3-4,4").value());
+  EXPECT_EQ(std::vector<uint32_t>({127U}), parse_cpulist("127-127").value());
+}
+
+TEST_F(CpulistTest, ParseMalformed) {
+  EXPECT_FALSE(parse_cpulist("").has_value());
+  EXPECT_FALSE(parse_cpulist("\n").has_value());
+  EXPECT_FALSE(parse_cpulist("3-1").has_value());
+  EXPECT_FALSE(parse_cpulist("1,").has_value());
+  EXPECT_FALSE(parse_cpulist(",1").has_value());
+  EXPECT_FALSE(parse_cpulist("1-").has_value());
+  EXPECT_FALSE(parse_cpulist("a").has_value());
+  EXPECT_FALSE(parse_cpulist("-1").has_value());
+  EXPECT_FALSE(parse_cpulist("1 2").has_value());
+  // CPUs beyond what sched_setaffinity() accepts, including a range which
+  // would otherwise expand to billions of entries.
+  EXPECT_FALSE(parse_cpulist(std::to_string(CPU_SETSIZE)).has_value());
+  EXPECT_FALSE(parse_cpulist("0-4000000000").has_value());
+  EXPECT_FALSE(parse_cpulist("0-4294967295").has_value());
+  const std::string all = "0-" + std::to_string(CPU_SETSIZE - 1);
+  EXPECT_EQ(static_cast<size_t>(CPU_SETSIZE),
+            parse_cpulist(all).value().size());
+}
+
+TEST_F(CpulistTest, Format) {
+  EXPECT_EQ("", format_cpulist({}));
+  EXPECT_EQ("5", format_cpulist({5U}));
+  EXPECT_EQ("0-3", format_cpulist({0U, 1U, 2U, 3U}));
+  EXPECT_EQ("1,3-5,8", format_cpulist({1U, 3U, 4U, 5U, 8U}));
+  EXPECT_EQ("0,2", format_cpulist({0U, 2U}));
+  EXPECT_EQ("1,3-5,8", format_cpulist(parse_cpulist("8,3-5,1").value()));
+}
+
+TEST_F(CpulistTest, OnlineCpus) {
+  const std::vector<uint32_t> online = online_cpus();
+  ASSERT_FALSE(online.empty());
+  EXPECT_TRUE(std::is_sorted(online.begin(), online.end()));
+
+  const std::string online_path = (dir / "online").string();
+  std::ofstream(online_path) << "0,4-5" << std::endl;
+  EXPECT_EQ(std::vector<uint32_t>({0U, 4U, 5U}), online_cpus(online_path));
+
+  // Without the file, the CPUs are counted.
+  EXPECT_EQ(static_cast<size_t>(sysconf(_SC_NPROCESSORS_ONLN)),
+            online_cpus("/nonexistent").size());
+}
+
+void write_file(const std::filesystem::path &path, const std::string &text) {
+  std::filesystem::create_directories(path.parent_path());
+  std::ofstream(path) << text << std::endl;
+}
+
+TEST_F(CpulistTest, Topology) {
+  const std::filesystem::path &sysfs = dir;
+  // Two packages of two SMT cores, where each package shares an L3 and each
+  // core an L2.
+  for (uint32_t cpu = 0U; cpu < 8U; cpu++) {
+    const std::filesystem::path cpu_dir =
+        sysfs / ("cpu" + std::to_string(cpu));
+    const uint32_t core = cpu & ~1U;
+    const uint32_t package = cpu / 4U;
+    const std::string core_list = format_cpulist({core, core + 1U});
+    const std::string package_list =
+        std::to_string(package * 4U) + "-" + std::to_string(package * 4U + 3U);
+    write_file(cpu_dir / "topology/physical_package_id",
+               std::to_string(package));
+    write_file(cpu_dir / "topology/thread_siblings_list", core_list);
+    const struct {
+      const char *level;
+      const char *type;
+      std::string shared;
+    } caches[] = {{"1", "Data", core_list},
+                  {"1", "Instruction", core_list},
+                  {"2", "Unified", core_list},
+                  {"3", "Unified", package_list}};
+    for (size_t index = 0U; index < std::size(caches); index++) {
+      const std::filesystem::path cache =
+          cpu_dir / ("cache/index" + std::to_string(index));
+      write_file(cache / "level", caches[index].level);
+      write_file(cache / "type", caches[index].type);
+      write_file(cache / "shared_cpu_list", caches[index].shared);
+    }
+  }
+
+  const cpu_topology five = read_topology(5U, sysfs);
+  EXPECT_EQ(5U, five.cpu);
+  EXPECT_EQ(1U, five.package);
+  EXPECT_EQ(4U, five.llc);
+  EXPECT_EQ(4U, five.core);
+  const cpu_topology four = read_topology(4U, sysfs);
+  const cpu_topology six = read_topology(6U, sysfs);
+  EXPECT_EQ(cpu_distance::same_cpu, distance(five, five));
+  EXPECT_EQ(cpu_distance::smt, distance(five, four));
+  EXPECT_EQ(cpu_distance::llc, distance(five, six));
+  EXPECT_EQ(cpu_distance::remote, distance(five, read_topology(0U, sysfs)));
+  // Without sysfs, a CPU shares nothing but the package.
+  const cpu_topology missing = read_topology(9U, sysfs);
+  EXPECT_EQ(9U, missing.llc);
+  EXPECT_EQ(9U, missing.core);
+  EXPECT_EQ(cpu_distance::package, distance(missing, read_topology(1U, sysfs)));
+
+  std::vector<cpu_topology> cpus{six, five, read_topology(0U, sysfs), four};
+  sort_by_topology(cpus);
+  std::vector<uint32_t> order{};
+  for (const cpu_topology &cpu : cpus) {
+    order.push_back(cpu.cpu);
+  }
+  EXPECT_EQ(std::vector<uint32_t>({0U, 4U, 5U, 6U}), order);
+}
+
+} // namespace local_testing
+} // namespace cpulist
@@ -0,0 +1,215 @@
+#ifndef IPC_TRANSPORT_H
+#define IPC_TRANSPORT_H
+
+// The channels over which timerlat_pipe_load and FifoTimer measure one-way
+// latency between two threads.  A real-time stack may choose any of the
+// mechanisms below, and each has its own cost for the copy, the wakeup and the
+// scheduler.  Every transport carries 64-bit timestamps and is measured by the
+// same measure_transport(), so that their latencies are comparable.
+
+#include "latency_histogram.hh"
+#include "latency_trace.hh"
+#include "spsc_ring.hh"
+#include "timerlat_load.hh"
+#include "timestamp.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace timerlat_load {
+
+enum class transport_kind {
+  // A named FIFO, as FifoTimer uses by default.
+  fifo,
+  // pipe2().
+  pipe,
+  // An eventfd whose counter is the timestamp.
+  eventfd,
+  // A futex wakeup of a waiter on a shared sequence number.
+  futex,
+  // socketpair(AF_UNIX, SOCK_DGRAM).
+  unix_dgram,
+  // socketpair(AF_UNIX, SOCK_STREAM).
+  unix_stream,
+  // A POSIX message queue.
+  mqueue,
+  // An SpscRing whose receiver polls.
+  shm_spin,
+  // An SpscRing whose receiver polls briefly and then sleeps on a futex.
+  shm_spin_futex,
+  // An SpscRing whose receiver sleeps on a futex.
+  shm_block,
+};
+
+std::optional<transport_kind> parse_transport_kind(std::string_view name);
+const char *transport_kind_name(transport_kind kind);
+// Every transport_kind, in the order above.
+const std::vector<transport_kind> &all_transport_kinds();
+
+// One direction of a channel between two threads of this process.  The
+// constructor opens both ends.
+class Transport {
+public:
+  virtual ~Transport() = default;
+  // False if setup failed, after printing why.
+  virtual bool valid() const = 0;
+  // Called only by the sending thread.  The channel must have room, which it
+  // does if the receiver has consumed every earlier value.  value must not be
+  // 0 or UINT64_MAX.
+  virtual bool send(uint64_t value) = 0;
+  // Called only by the receiving thread.  Blocks until a value arrives, and
+  // returns std::nullopt if receiving fails or the sender has closed.
+  virtual std::optional<uint64_t> receive() = 0;
+  // Called only by the sending thread, to make a blocked receive() return.
+  virtual void close_sender() = 0;
+  // True if values sent before the receiver consumes earlier ones wait their
+  // turn, rather than overwriting or adding to them, so that the sender need
+  // not wait for the receiver.
+  virtual bool queues() const { return true; }
+};
+
+std::unique_ptr<Transport> make_transport(transport_kind kind);
+// Just one end of the named FIFO at path, which must exist, for a sender and
+// receiver which open their own ends, as FifoTimer's do.  Opening either end
+// blocks until the other is open.
+std::unique_ptr<Transport> open_fifo_end(const std::string &path, bool sender);
+// A transport over ring, which must outlive it, for a sender and receiver
+// which are each handed the ring.
+std::unique_ptr<Transport> ring_transport(SpscRing &ring);
+
+struct transport_options {
+  size_t samples = 1000U;
+  uint32_t sender_cpu = 0U;
+  uint32_t receiver_cpu = 0U;
+  // The SCHED_FIFO priority of both threads, or 0 to leave their scheduling
+  // alone.
+  int prio = 0;
+  // How long the sender waits after the receiver has consumed a value before
+  // sending the next, so that the receiver is blocked again, as it would be
+  // in a real-time loop.
+  std::chrono::nanoseconds interval = std::chrono::microseconds(10);
+  // If not 0, ignore interval and send this many values per second without
+  // waiting for the receiver, which only a transport which queues() allows.
+  uint64_t rate = 0U;
+};
+
+// When a paced sender actually sent each value, so that the receiver can
+// measure from the send as well as from when the value was due.  The sender
+// records each time before it sends the value, so the receiver sees the time
+// once the value arrives.
+class SendTimes {
+public:
+  explicit SendTimes(size_t samples) : times_(samples) {}
+  // Sender only.  Samples past those passed to the constructor are ignored.
+  void record(size_t sample, uint64_t sent) {
+    if (sample < times_.size()) {
+      times_[sample].store(sent, std::memory_order_release);
+    }
+  }
+  // Receiver only.  When sample was sent, or intended if that is unknown.
+  uint64_t sent(size_t sample, uint64_t intended) const {
+    const uint64_t sent = (sample < times_.size())
+                              ? times_[sample].load(std::memory_order_acquire)
+                              : 0U;
+    return (0U != sent) ? sent : intended;
+  }
+
+private:
+  std::vector<std::atomic<uint64_t>> times_;
+};
+
+// What measure_transport() records besides the delays since each value was
+// due.  Each is optional.
+struct transport_recorders {
+  // The delays since each value was actually sent, which are shorter than
+  // those since it was due only if options.rate made the sender fall behind.
+  LatencyHistogram *service = nullptr;
+  // Every sample, with options.receiver_cpu as its CPU.
+  TraceWriter *trace = nullptr;
+  // Where the sender recorded when it sent each value.  Without it, each value
+  // is taken to have been sent when it was due.
+  const SendTimes *send_times = nullptr;
+  // Called by the receiver before it waits for each value, as a timerlat user
+  // thread reads its timerlat file descriptor.  Returns what the trace records
+  // as the sample's timerlat.
+  std::function<int32_t()> before_receive{};
+};
+
+// Send options.samples timestamps from timestamper over transport from a
+// thread pinned to sender_cpu to one pinned to receiver_cpu, and record in
+// histogram the nanoseconds which each took to arrive.  By default only one
+// value is in flight at a time, so that the delays are not queueing.  With
+// options.rate, each value is instead the time at which it was due to be sent,
+// so that a sender which falls behind, perhaps because the transport is full,
+// adds its lateness to the delays rather than hiding it.  Returns false if
+// pinning, setting the priority or the transport failed.
+bool measure_transport(
+    Transport &transport, const transport_options &options,
+    LatencyHistogram &histogram,
+    const Timestamper &timestamper = default_timestamper(),
+    const transport_recorders &recorders = transport_recorders{});
+
+// The two halves of measure_transport(), for a sender and a receiver which
+// each run on a thread of their own.
+//
+// Send options.samples timestamps over transport as measure_transport() does.
+// Before each, wait until received, unless it is nullptr, counts every earlier
+// value, and then options.interval; without received, just wait
+// options.interval after the last.  The wait for received polls, or, if
+// options.sender_cpu and receiver_cpu are the same, sleeps between polls.  Unless send_times is nullptr, record in
+// it when each value was sent.  Returns false, after closing the sender, if a
+// send fails or stop, unless it is nullptr, is set.  The caller closes the
+// sender after a successful run, if the receiver waits for that.
+bool send_timestamps(Transport &transport, const transport_options &options,
+                     const Timestamper &timestamper,
+                     SendTimes *send_times = nullptr,
+                     const std::atomic<size_t> *received = nullptr,
+                     const std::atomic<bool> *stop = nullptr);
+// Receive values over transport until options.samples have arrived or the
+// sender closes, recording them as measure_transport() does, and count them in
+// received unless it is nullptr.  Returns the number received.
+size_t receive_timestamps(Transport &transport,
+                          const transport_options &options,
+                          LatencyHistogram &histogram,
+                          const Timestamper &timestamper,
+                          const transport_recorders &recorders,
+                          std::atomic<size_t> *received = nullptr);
+
+// Send options.samples timestamps over ping from a thread pinned to
+// sender_cpu to one pinned to receiver_cpu, which sends each back over pong,
+// and record in histogram half of the nanoseconds which each round trip took.
+// Both timestamps of a round trip come from the sender's CPU, so that, unlike
+// measure_transport()'s, the delays do not depend on how closely the CPUs'
+// clocks agree.  options.rate is ignored.  Returns false if pinning, setting
+// the priority or either transport failed.
+bool measure_round_trip(
+    Transport &ping, Transport &pong, const transport_options &options,
+    LatencyHistogram &histogram,
+    const Timestamper &timestamper = default_timestamper());
+
+// The median and 99th percentile of one pair's delays, in nanoseconds.
+struct pair_latency {
+  uint64_t p50 = 0U;
+  uint64_t p99 = 0U;
+};
+// matrix[i][j] is between a sender on cpus[i] and a receiver on cpus[j].
+using latency_matrix = std::vector<std::vector<pair_latency>>;
+
+// Run measure_round_trip() over two new transports of kind for every ordered
+// pair of distinct entries in cpus in turn, ignoring options' own CPUs.  The
+// diagonal is left 0.  Returns std::nullopt if any measurement fails.
+std::optional<latency_matrix>
+measure_matrix(transport_kind kind, const std::vector<uint32_t> &cpus,
+               const transport_options &options,
+               const Timestamper &timestamper = default_timestamper());
+
+} // namespace timerlat_load
+
+#endif
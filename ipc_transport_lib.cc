@@ -0,0 +1,667 @@
+#include "ipc_transport.hh"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mqueue.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <iterator>
+#include <string>
+#include <thread>
+
+namespace timerlat_load {
+
+namespace {
+
+constexpr const char *KIND_NAMES[] = {
+    "fifo",        "pipe",   "eventfd",  "futex",          "unix_dgram",
+    "unix_stream", "mqueue", "shm_spin", "shm_spin_futex", "shm_block"};
+
+void report_failure(const char *what) {
+  std::cerr << "Unable to " << what << ": " << strerror(errno) << std::endl;
+}
+
+// Any transport whose ends are file descriptors which carry the value as
+// bytes.  It owns both descriptors.
+class FdTransport : public Transport {
+public:
+  ~FdTransport() override {
+    if (-1 != read_fd_) {
+      close(read_fd_);
+    }
+    close_sender();
+  }
+  bool valid() const override { return (-1 != read_fd_) && (-1 != write_fd_); }
+  bool send(uint64_t value) override {
+    ssize_t written;
+    do {
+      written = write(write_fd_, &value, sizeof(value));
+    } while ((-1 == written) && (EINTR == errno));
+    if (sizeof(value) != written) {
+      report_failure("send");
+      return false;
+    }
+    return true;
+  }
+  std::optional<uint64_t> receive() override {
+    uint64_t value;
+    // Stream sockets may deliver the bytes of a value piecemeal.
+    size_t received = 0U;
+    while (received < sizeof(value)) {
+      const ssize_t bytes_read =
+          read(read_fd_, reinterpret_cast<char *>(&value) + received,
+               sizeof(value) - received);
+      if (-1 == bytes_read) {
+        if (EINTR == errno) {
+          continue;
+        }
+        report_failure("receive");
+        return std::nullopt;
+      }
+      if (0 == bytes_read) {
+        return std::nullopt;
+      }
+      received += bytes_read;
+    }
+    return value;
+  }
+  // Closing the write end makes the reader see EOF.
+  void close_sender() override {
+    if (-1 != write_fd_) {
+      close(write_fd_);
+    }
+    write_fd_ = -1;
+  }
+
+protected:
+  int read_fd_ = -1;
+  int write_fd_ = -1;
+};
+
+class FifoTransport : public FdTransport {
+public:
+  FifoTransport() {
+    char dir_template[] = "/tmp/timerlat_pipe_load.XXXXXX";
+    if (nullptr == mkdtemp(dir_template)) {
+      report_failure("create a FIFO directory");
+      return;
+    }
+    dir_ = dir_template;
+    path_ = dir_ + "/myfifo";
+    if (-1 == mkfifo(path_.c_str(), 0600)) {
+      report_failure("create a FIFO");
+      return;
+    }
+    // Opening the read end without O_NONBLOCK would wait for a writer.
+    read_fd_ = open(path_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (-1 == read_fd_) {
+      report_failure("open the FIFO for reading");
+      return;
+    }
+    fcntl(read_fd_, F_SETFL, fcntl(read_fd_, F_GETFL) & ~O_NONBLOCK);
+    write_fd_ = open(path_.c_str(), O_WRONLY | O_CLOEXEC);
+    if (-1 == write_fd_) {
+      report_failure("open the FIFO for writing");
+    }
+  }
+  ~FifoTransport() override {
+    if (!path_.empty()) {
+      unlink(path_.c_str());
+    }
+    if (!dir_.empty()) {
+      rmdir(dir_.c_str());
+    }
+  }
+
+private:
+  std::string dir_{};
+  std::string path_{};
+};
+
+// One end of a FIFO which another thread opens the other end of.
+class FifoEndTransport : public FdTransport {
+public:
+  FifoEndTransport(const std::string &path, bool sender) : sender_(sender) {
+    const int fd =
+        open(path.c_str(), (sender ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+    if (-1 == fd) {
+      std::cerr << "Unable to open FIFO " << path << ": " << strerror(errno)
+                << std::endl;
+      return;
+    }
+    (sender ? write_fd_ : read_fd_) = fd;
+  }
+  bool valid() const override {
+    return -1 != (sender_ ? write_fd_ : read_fd_);
+  }
+
+private:
+  bool sender_;
+};
+
+class PipeTransport : public FdTransport {
+public:
+  PipeTransport() {
+    int fds[2];
+    if (-1 == pipe2(fds, O_CLOEXEC)) {
+      report_failure("create a pipe");
+      return;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+  }
+};
+
+class SocketTransport : public FdTransport {
+public:
+  explicit SocketTransport(int type) : type_(type) {
+    int fds[2];
+    if (-1 == socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds)) {
+      report_failure("create a socket pair");
+      return;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+  }
+  // Closing one end of a datagram socket pair does not wake the other, but an
+  // empty datagram does.
+  void close_sender() override {
+    if ((SOCK_DGRAM == type_) && (-1 != write_fd_)) {
+      write(write_fd_, "", 0U);
+    }
+    FdTransport::close_sender();
+  }
+
+private:
+  int type_;
+};
+
+// The value is added to the eventfd's counter, which is 0 whenever the
+// receiver has consumed every earlier value, and reading returns it.
+class EventfdTransport : public Transport {
+public:
+  EventfdTransport() : fd_(eventfd(0U, EFD_CLOEXEC)) {
+    if (-1 == fd_) {
+      report_failure("create an eventfd");
+    }
+  }
+  ~EventfdTransport() override {
+    if (-1 != fd_) {
+      close(fd_);
+    }
+  }
+  bool valid() const override { return -1 != fd_; }
+  bool send(uint64_t value) override {
+    ssize_t written;
+    do {
+      written = write(fd_, &value, sizeof(value));
+    } while ((-1 == written) && (EINTR == errno));
+    if (sizeof(value) != written) {
+      report_failure("send");
+      return false;
+    }
+    return true;
+  }
+  std::optional<uint64_t> receive() override {
+    uint64_t value;
+    ssize_t bytes_read;
+    do {
+      bytes_read = read(fd_, &value, sizeof(value));
+    } while ((-1 == bytes_read) && (EINTR == errno));
+    if (sizeof(value) != bytes_read) {
+      report_failure("receive");
+      return std::nullopt;
+    }
+    if (closed_.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+  void close_sender() override {
+    closed_.store(true, std::memory_order_release);
+    const uint64_t wake = 1U;
+    write(fd_, &wake, sizeof(wake));
+  }
+  bool queues() const override { return false; }
+
+private:
+  int fd_;
+  std::atomic<bool> closed_{false};
+};
+
+long futex(std::atomic<uint32_t> *uaddr, int op, uint32_t val) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(uaddr), op, val,
+                 nullptr, nullptr, 0);
+}
+
+// The sender stores the value and increments a sequence number, and the
+// receiver sleeps in FUTEX_WAIT until the sequence number changes.
+class FutexTransport : public Transport {
+public:
+  bool valid() const override { return true; }
+  bool send(uint64_t value) override {
+    value_ = value;
+    seq_.fetch_add(1U, std::memory_order_release);
+    if (-1 == futex(&seq_, FUTEX_WAKE_PRIVATE, 1U)) {
+      report_failure("send");
+      return false;
+    }
+    return true;
+  }
+  std::optional<uint64_t> receive() override {
+    uint32_t seq;
+    while (seen_ == (seq = seq_.load(std::memory_order_acquire))) {
+      // EAGAIN means that the sequence number has already changed.
+      if ((-1 == futex(&seq_, FUTEX_WAIT_PRIVATE, seen_)) &&
+          (EAGAIN != errno) && (EINTR != errno)) {
+        report_failure("receive");
+        return std::nullopt;
+      }
+    }
+    seen_ = seq;
+    if (closed_.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    return value_;
+  }
+  void close_sender() override {
+    closed_.store(true, std::memory_order_release);
+    seq_.fetch_add(1U, std::memory_order_release);
+    futex(&seq_, FUTEX_WAKE_PRIVATE, 1U);
+  }
+  bool queues() const override { return false; }
+
+private:
+  alignas(64) std::atomic<uint32_t> seq_{0U};
+  uint64_t value_ = 0U;
+  std::atomic<bool> closed_{false};
+  // Only the receiver's.
+  alignas(64) uint32_t seen_ = 0U;
+};
+
+class MqueueTransport : public Transport {
+public:
+  MqueueTransport() {
+    static std::atomic<uint32_t> instances{0U};
+    const std::string name = "/timerlat_pipe_load." + std::to_string(getpid()) +
+                             "." + std::to_string(instances++);
+    // The default limit of /proc/sys/fs/mqueue/msg_max, which leaves room for
+    // close_sender()'s empty message after a value, and for an open-loop
+    // sender to run ahead.
+    struct mq_attr attr {};
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = sizeof(uint64_t);
+    mqd_ = mq_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600,
+                   &attr);
+    if (invalid() == mqd_) {
+      report_failure("create a message queue");
+      return;
+    }
+    // The descriptor keeps the queue until it is closed.
+    mq_unlink(name.c_str());
+  }
+  ~MqueueTransport() override {
+    if (valid()) {
+      mq_close(mqd_);
+    }
+  }
+  bool valid() const override { return invalid() != mqd_; }
+  bool send(uint64_t value) override {
+    int ret;
+    do {
+      ret = mq_send(mqd_, reinterpret_cast<const char *>(&value),
+                    sizeof(value), 0U);
+    } while ((-1 == ret) && (EINTR == errno));
+    if (-1 == ret) {
+      report_failure("send");
+      return false;
+    }
+    return true;
+  }
+  std::optional<uint64_t> receive() override {
+    uint64_t value;
+    ssize_t received;
+    do {
+      received = mq_receive(mqd_, reinterpret_cast<char *>(&value),
+                            sizeof(value), nullptr);
+    } while ((-1 == received) && (EINTR == errno));
+    if (-1 == received) {
+      report_failure("receive");
+      return std::nullopt;
+    }
+    if (sizeof(value) != received) {
+      return std::nullopt;
+    }
+    return value;
+  }
+  void close_sender() override { mq_send(mqd_, "", 0U, 0U); }
+
+private:
+  static mqd_t invalid() { return static_cast<mqd_t>(-1); }
+
+  mqd_t mqd_;
+};
+
+// An SpscRing which it owns, or one which the caller does.
+class ShmRingTransport : public Transport {
+public:
+  explicit ShmRingTransport(ring_wait wait)
+      : owned_(std::make_unique<SpscRing>(wait)), ring_(*owned_) {}
+  explicit ShmRingTransport(SpscRing &ring) : ring_(ring) {}
+  bool valid() const override { return true; }
+  bool send(uint64_t value) override {
+    ring_.push(value);
+    return true;
+  }
+  std::optional<uint64_t> receive() override { return ring_.pop(); }
+  void close_sender() override { ring_.close(); }
+
+private:
+  std::unique_ptr<SpscRing> owned_{};
+  SpscRing &ring_;
+};
+
+// Pin the calling thread and set its priority, as run_workers() does.
+bool prepare_thread(uint32_t cpu, int prio) {
+  const pid_t tid = gettid();
+  return !set_affinity(tid, cpu) && (!prio || !set_prio(tid, prio));
+}
+
+} // namespace
+
+std::optional<transport_kind> parse_transport_kind(std::string_view name) {
+  for (size_t kind = 0U; kind < std::size(KIND_NAMES); kind++) {
+    if (name == KIND_NAMES[kind]) {
+      return static_cast<transport_kind>(kind);
+    }
+  }
+  return std::nullopt;
+}
+
+const char *transport_kind_name(transport_kind kind) {
+  return KIND_NAMES[static_cast<size_t>(kind)];
+}
+
+const std::vector<transport_kind> &all_transport_kinds() {
+  static const std::vector<transport_kind> kinds = [] {
+    std::vector<transport_kind> all{};
+    for (size_t kind = 0U; kind < std::size(KIND_NAMES); kind++) {
+      all.push_back(static_cast<transport_kind>(kind));
+    }
+    return all;
+  }();
+  return kinds;
+}
+
+std::unique_ptr<Transport> make_transport(transport_kind kind) {
+  switch (kind) {
+  case transport_kind::fifo:
+    return std::make_unique<FifoTransport>();
+  case transport_kind::pipe:
+    return std::make_unique<PipeTransport>();
+  case transport_kind::eventfd:
+    return std::make_unique<EventfdTransport>();
+  case transport_kind::futex:
+    return std::make_unique<FutexTransport>();
+  case transport_kind::unix_dgram:
+    return std::make_unique<SocketTransport>(SOCK_DGRAM);
+  case transport_kind::unix_stream:
+    return std::make_unique<SocketTransport>(SOCK_STREAM);
+  case transport_kind::mqueue:
+    return std::make_unique<MqueueTransport>();
+  case transport_kind::shm_spin:
+    return std::make_unique<ShmRingTransport>(ring_wait::spin);
+  case transport_kind::shm_spin_futex:
+    return std::make_unique<ShmRingTransport>(ring_wait::spin_futex);
+  case transport_kind::shm_block:
+    return std::make_unique<ShmRingTransport>(ring_wait::block);
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Transport> open_fifo_end(const std::string &path, bool sender) {
+  return std::make_unique<FifoEndTransport>(path, sender);
+}
+
+std::unique_ptr<Transport> ring_transport(SpscRing &ring) {
+  return std::make_unique<ShmRingTransport>(ring);
+}
+
+bool send_timestamps(Transport &transport, const transport_options &options,
+                     const Timestamper &timestamper, SendTimes *send_times,
+                     const std::atomic<size_t> *received,
+                     const std::atomic<bool> *stop) {
+  const auto stopped = [&]() {
+    if ((nullptr == stop) || !stop->load(std::memory_order_relaxed)) {
+      return false;
+    }
+    transport.close_sender();
+    return true;
+  };
+  const auto send = [&](uint64_t value) {
+    if (transport.send(value)) {
+      return true;
+    }
+    transport.close_sender();
+    return false;
+  };
+  if (0U != options.rate) {
+    const Pacer pacer(timestamper, options.rate);
+    for (size_t sent = 0U; sent < options.samples; sent++) {
+      if (stopped()) {
+        return false;
+      }
+      const uint64_t intended = pacer.wait(sent);
+      if (nullptr != send_times) {
+        send_times->record(sent, timestamper.now());
+      }
+      if (!send(intended)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // A sender which polled on the receiver's CPU would keep it from running
+  // until preempted, so there the sender sleeps between polls.
+  const bool share_cpu = options.sender_cpu == options.receiver_cpu;
+  uint32_t spins = 0U;
+  for (size_t sent = 0U; sent < options.samples; sent++) {
+    while ((nullptr != received) &&
+           (received->load(std::memory_order_acquire) < sent)) {
+      if (stopped()) {
+        return false;
+      }
+      if (share_cpu) {
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+      } else {
+        cpu_relax(spins);
+      }
+    }
+    if (stopped()) {
+      return false;
+    }
+    std::this_thread::sleep_for(options.interval);
+    if (!send(timestamper.now())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t receive_timestamps(Transport &transport,
+                          const transport_options &options,
+                          LatencyHistogram &histogram,
+                          const Timestamper &timestamper,
+                          const transport_recorders &recorders,
+                          std::atomic<size_t> *received) {
+  size_t count = 0U;
+  for (; count < options.samples; count++) {
+    const int32_t timerlat =
+        recorders.before_receive ? recorders.before_receive() : 0;
+    const std::optional<uint64_t> then = transport.receive();
+    const uint64_t now = timestamper.now();
+    if (!then.has_value()) {
+      break;
+    }
+    const uint64_t sent =
+        (nullptr != recorders.send_times)
+            ? recorders.send_times->sent(count, then.value())
+            : then.value();
+    histogram.record(timestamper.elapsed_ns(then.value(), now));
+    if (nullptr != recorders.service) {
+      recorders.service->record(timestamper.elapsed_ns(sent, now));
+    }
+    if (nullptr != recorders.trace) {
+      recorders.trace->append({count, then.value(), sent, now,
+                               options.receiver_cpu, timerlat});
+    }
+    if (nullptr != received) {
+      received->store(count + 1U, std::memory_order_release);
+    }
+  }
+  return count;
+}
+
+bool measure_transport(Transport &transport, const transport_options &options,
+                       LatencyHistogram &histogram,
+                       const Timestamper &timestamper,
+                       const transport_recorders &recorders) {
+  if (!transport.valid()) {
+    return false;
+  }
+  if ((0U != options.rate) && !transport.queues()) {
+    std::cerr << "The transport does not queue, so it cannot be sent to "
+                 "at a fixed rate."
+              << std::endl;
+    return false;
+  }
+  WorkerGate gate(2U);
+  // The number of values which the receiver has consumed, so that the sender
+  // sends only into an empty channel.
+  std::atomic<size_t> received{0U};
+  std::atomic<bool> stop{false};
+  bool sender_ok = false;
+  bool receiver_ok = false;
+  // Only a paced sender can send a value later than it was due.
+  std::unique_ptr<SendTimes> send_times{};
+  transport_recorders receiver_recorders = recorders;
+  if ((0U != options.rate) && (nullptr == recorders.send_times) &&
+      ((nullptr != recorders.service) || (nullptr != recorders.trace))) {
+    send_times = std::make_unique<SendTimes>(options.samples);
+    receiver_recorders.send_times = send_times.get();
+  }
+
+  std::thread sender([&]() {
+    if (!gate.wait(prepare_thread(options.sender_cpu, options.prio))) {
+      return;
+    }
+    sender_ok = send_timestamps(transport, options, timestamper,
+                                send_times.get(),
+                                (0U == options.rate) ? &received : nullptr,
+                                &stop);
+    if (!sender_ok) {
+      stop = true;
+    }
+  });
+  std::thread receiver([&]() {
+    if (!gate.wait(prepare_thread(options.receiver_cpu, options.prio))) {
+      return;
+    }
+    receiver_ok =
+        (options.samples == receive_timestamps(transport, options, histogram,
+                                               timestamper, receiver_recorders,
+                                               &received));
+    if (!receiver_ok) {
+      stop = true;
+    }
+  });
+  sender.join();
+  receiver.join();
+  return sender_ok && receiver_ok;
+}
+
+bool measure_round_trip(Transport &ping, Transport &pong,
+                        const transport_options &options,
+                        LatencyHistogram &histogram,
+                        const Timestamper &timestamper) {
+  if (!ping.valid() || !pong.valid()) {
+    return false;
+  }
+  WorkerGate gate(2U);
+  bool initiator_ok = false;
+  bool responder_ok = false;
+
+  std::thread initiator([&]() {
+    if (!gate.wait(prepare_thread(options.sender_cpu, options.prio))) {
+      return;
+    }
+    for (size_t count = 0U; count < options.samples; count++) {
+      std::this_thread::sleep_for(options.interval);
+      const uint64_t then = timestamper.now();
+      if (!ping.send(then)) {
+        ping.close_sender();
+        return;
+      }
+      const std::optional<uint64_t> echo = pong.receive();
+      const uint64_t now = timestamper.now();
+      if (!echo.has_value()) {
+        ping.close_sender();
+        return;
+      }
+      histogram.record(timestamper.elapsed_ns(then, now) / 2U);
+    }
+    initiator_ok = true;
+  });
+  std::thread responder([&]() {
+    if (!gate.wait(prepare_thread(options.receiver_cpu, options.prio))) {
+      return;
+    }
+    for (size_t count = 0U; count < options.samples; count++) {
+      const std::optional<uint64_t> value = ping.receive();
+      if (!value.has_value() || !pong.send(value.value())) {
+        pong.close_sender();
+        return;
+      }
+    }
+    responder_ok = true;
+  });
+  initiator.join();
+  responder.join();
+  return initiator_ok && responder_ok;
+}
+
+std::optional<latency_matrix>
+measure_matrix(transport_kind kind, const std::vector<uint32_t> &cpus,
+               const transport_options &options,
+               const Timestamper &timestamper) {
+  latency_matrix matrix(cpus.size(), std::vector<pair_latency>(cpus.size()));
+  auto histogram = make_latency_histogram();
+  transport_options pair_options = options;
+  for (size_t from = 0U; from < cpus.size(); from++) {
+    for (size_t to = 0U; to < cpus.size(); to++) {
+      if (from == to) {
+        continue;
+      }
+      pair_options.sender_cpu = cpus[from];
+      pair_options.receiver_cpu = cpus[to];
+      histogram->reset();
+      const std::unique_ptr<Transport> ping = make_transport(kind);
+      const std::unique_ptr<Transport> pong = make_transport(kind);
+      if (!measure_round_trip(*ping, *pong, pair_options, *histogram,
+                              timestamper)) {
+        std::cerr << "Measuring from CPU " << cpus[from] << " to CPU "
+                  << cpus[to] << " failed." << std::endl;
+        return std::nullopt;
+      }
+      matrix[from][to] = {histogram->percentile(50.0),
+                          histogram->percentile(99.0)};
+    }
+  }
+  return matrix;
+}
+
+} // namespace timerlat_load
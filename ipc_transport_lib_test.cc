@@ -0,0 +1,134 @@
+#include "cpulist.hh"
+#include "ipc_transport.hh"
+#include "test_temp_dir.hh"
+
+#include <filesystem>
+#include <memory>
+
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+using IpcTransportTest = test_util::TempDirTest;
+
+TEST_F(IpcTransportTest, KindNames) {
+  EXPECT_EQ(10U, all_transport_kinds().size());
+  for (const transport_kind kind : all_transport_kinds()) {
+    EXPECT_EQ(kind, parse_transport_kind(transport_kind_name(kind)));
+  }
+  EXPECT_FALSE(parse_transport_kind("carrier_pigeon").has_value());
+}
+
+struct TransportTest : public testing::TestWithParam<transport_kind> {};
+
+// One thread can send and then receive, since every transport has room for a
+// value.
+TEST_P(TransportTest, SendReceive) {
+  const std::unique_ptr<Transport> transport = make_transport(GetParam());
+  ASSERT_TRUE(transport->valid());
+  for (const uint64_t value : {uint64_t{1}, uint64_t{0x123456789abcdef0}}) {
+    ASSERT_TRUE(transport->send(value));
+    EXPECT_EQ(value, transport->receive());
+  }
+  transport->close_sender();
+  EXPECT_FALSE(transport->receive().has_value());
+}
+
+TEST_P(TransportTest, Measure) {
+  const std::unique_ptr<Transport> transport = make_transport(GetParam());
+  auto histogram = make_latency_histogram();
+  transport_options options{};
+  options.samples = 50U;
+  options.interval = std::chrono::microseconds(1);
+  ASSERT_TRUE(measure_transport(*transport, options, *histogram));
+  EXPECT_EQ(50U, histogram->count());
+  EXPECT_LT(0U, histogram->max());
+}
+
+TEST_P(TransportTest, MeasureOpenLoop) {
+  const std::unique_ptr<Transport> transport = make_transport(GetParam());
+  auto histogram = make_latency_histogram();
+  transport_options options{};
+  options.samples = 200U;
+  options.rate = 20000U;
+  if (!transport->queues()) {
+    EXPECT_FALSE(measure_transport(*transport, options, *histogram));
+    EXPECT_EQ(0U, histogram->count());
+    return;
+  }
+  ASSERT_TRUE(measure_transport(*transport, options, *histogram));
+  EXPECT_EQ(200U, histogram->count());
+}
+
+TEST_P(TransportTest, MeasureRoundTrip) {
+  const std::unique_ptr<Transport> ping = make_transport(GetParam());
+  const std::unique_ptr<Transport> pong = make_transport(GetParam());
+  auto histogram = make_latency_histogram();
+  transport_options options{};
+  options.samples = 50U;
+  options.interval = std::chrono::microseconds(1);
+  ASSERT_TRUE(measure_round_trip(*ping, *pong, options, *histogram));
+  EXPECT_EQ(50U, histogram->count());
+  EXPECT_LT(0U, histogram->max());
+}
+
+TEST_F(IpcTransportTest, Trace) {
+  const std::string trace_path = (dir / "trace").string();
+  const std::unique_ptr<Transport> transport =
+      make_transport(transport_kind::pipe);
+  auto histogram = make_latency_histogram();
+  transport_options options{};
+  options.samples = 30U;
+  options.interval = std::chrono::microseconds(1);
+  TraceWriter trace;
+  ASSERT_TRUE(trace.open(trace_path, options.samples, default_timestamper()));
+  transport_recorders recorders{};
+  recorders.trace = &trace;
+  ASSERT_TRUE(measure_transport(*transport, options, *histogram,
+                                default_timestamper(), recorders));
+  trace.close();
+
+  LatencyTrace recorded;
+  ASSERT_TRUE(recorded.open(trace_path));
+  ASSERT_EQ(30U, recorded.size());
+  for (size_t i = 0U; i < recorded.size(); i++) {
+    EXPECT_EQ(i, recorded[i].sequence);
+    EXPECT_EQ(options.receiver_cpu, recorded[i].cpu);
+    EXPECT_EQ(recorded[i].intended, recorded[i].sent);
+    // Both threads are on one CPU, whose clock cannot go backwards.
+    EXPECT_LE(recorded[i].sent, recorded[i].received);
+  }
+}
+
+TEST(MatrixTest, Measure) {
+  // Two entries for the same CPU, so that the test runs on one.
+  const uint32_t cpu = cpulist::online_cpus().front();
+  transport_options options{};
+  options.samples = 20U;
+  options.interval = std::chrono::microseconds(1);
+  const std::optional<latency_matrix> matrix =
+      measure_matrix(transport_kind::pipe, {cpu, cpu}, options);
+  ASSERT_TRUE(matrix.has_value());
+  ASSERT_EQ(2U, matrix->size());
+  EXPECT_EQ(0U, (*matrix)[0][0].p50);
+  EXPECT_EQ(0U, (*matrix)[1][1].p99);
+  for (const pair_latency &pair : {(*matrix)[0][1], (*matrix)[1][0]}) {
+    EXPECT_LT(0U, pair.p50);
+    EXPECT_LE(pair.p50, pair.p99);
+  }
+  // An offline CPU cannot be pinned to.
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(measure_matrix(transport_kind::pipe, {cpu, 100000U}, options)
+                   .has_value());
+  ::testing::internal::GetCapturedStderr();
+}
+
+std::string kind_name(const testing::TestParamInfo<transport_kind> &info) {
+  return transport_kind_name(info.param);
+}
+INSTANTIATE_TEST_SUITE_P(AllTransports, TransportTest,
+                         testing::ValuesIn(all_transport_kinds()), kind_name);
+
+} // namespace local_testing
+} // namespace timerlat_load
@@ -0,0 +1,79 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+// A log-linear histogram of latencies in the style of HdrHistogram
+// (http://hdrhistogram.org/).  Values below 2^SUB_BUCKET_BITS are counted
+// exactly, and each power of two above is split into 2^(SUB_BUCKET_BITS - 1)
+// equal buckets, so that every recorded value is known to within 1/128 of
+// itself.  The buckets cover all of uint64_t in a fixed array, so recording
+// never allocates or does I/O, and millions of samples cost no more memory
+// than one.  Finding a bucket costs one comparison, to tell the exact range
+// from the rest, and a count of leading zeros.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+namespace timerlat_load {
+
+class LatencyHistogram {
+public:
+  static constexpr unsigned SUB_BUCKET_BITS = 8U;
+  static constexpr size_t HALF_SUB_BUCKETS = size_t{1}
+                                             << (SUB_BUCKET_BITS - 1U);
+  static constexpr size_t BUCKETS = (66U - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+  void record(uint64_t value) {
+    counts_[bucket_index(value)]++;
+    count_++;
+    if (value < min_) {
+      min_ = value;
+    }
+    if (value > max_) {
+      max_ = value;
+    }
+  }
+  void reset();
+
+  uint64_t count() const { return count_; }
+  // Both are 0 if nothing has been recorded.
+  uint64_t min() const { return count_ ? min_ : 0U; }
+  uint64_t max() const { return max_; }
+  // The smallest value which is at least percent of the recorded ones, to the
+  // precision of the buckets, or 0 if nothing has been recorded.
+  uint64_t percentile(double percent) const;
+
+  // Print the count, min, p50, p99, p99.9, p99.99 and max of the values, in
+  // unit, followed by the range and count of every nonempty bucket.
+  void print(std::ostream &out, const char *unit = "ns") const;
+
+  static size_t bucket_index(uint64_t value) {
+    if (value < (uint64_t{1} << SUB_BUCKET_BITS)) {
+      return value;
+    }
+    // The number of low bits which this value's bucket ignores.
+    const unsigned shift = 64U - SUB_BUCKET_BITS - __builtin_clzll(value);
+    return shift * HALF_SUB_BUCKETS + (value >> shift);
+  }
+  // The smallest and largest values counted by the bucket at index.
+  static uint64_t bucket_lowest(size_t index);
+  static uint64_t bucket_highest(size_t index);
+
+private:
+  std::array<uint64_t, BUCKETS> counts_{};
+  uint64_t count_ = 0U;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0U;
+};
+
+// The counts take about 60 kB, too much to want on the stack, so a histogram
+// which is not a member of something on the heap should come from here.
+inline std::unique_ptr<LatencyHistogram> make_latency_histogram() {
+  return std::make_unique<LatencyHistogram>();
+}
+
+} // namespace timerlat_load
+
+#endif
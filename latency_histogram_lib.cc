@@ -0,0 +1,61 @@
+#include "latency_histogram.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace timerlat_load {
+
+void LatencyHistogram::reset() {
+  counts_.fill(0U);
+  count_ = 0U;
+  min_ = UINT64_MAX;
+  max_ = 0U;
+}
+
+uint64_t LatencyHistogram::bucket_lowest(size_t index) {
+  if (index < (size_t{1} << SUB_BUCKET_BITS)) {
+    return index;
+  }
+  const size_t shift = index / HALF_SUB_BUCKETS - 1U;
+  return uint64_t{index - shift * HALF_SUB_BUCKETS} << shift;
+}
+
+uint64_t LatencyHistogram::bucket_highest(size_t index) {
+  if (index + 1U == BUCKETS) {
+    return UINT64_MAX;
+  }
+  return bucket_lowest(index + 1U) - 1U;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const {
+  if (0U == count_) {
+    return 0U;
+  }
+  // The rank of the sought value among the recorded ones, counting from 1.
+  const uint64_t rank = std::clamp<uint64_t>(
+      static_cast<uint64_t>(std::ceil(percent / 100.0 * count_)), 1U, count_);
+  uint64_t seen = 0U;
+  for (size_t index = 0U; index < BUCKETS; index++) {
+    seen += counts_[index];
+    if (seen >= rank) {
+      // The bucket's bound may lie outside what was actually recorded.
+      return std::clamp(bucket_highest(index), min_, max_);
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::print(std::ostream &out, const char *unit) const {
+  out << count_ << " samples (" << unit << "): min " << min() << " p50 "
+      << percentile(50.0) << " p99 " << percentile(99.0) << " p99.9 "
+      << percentile(99.9) << " p99.99 " << percentile(99.99) << " max "
+      << max_ << std::endl;
+  for (size_t index = 0U; index < BUCKETS; index++) {
+    if (0U != counts_[index]) {
+      out << "  [" << bucket_lowest(index) << ", " << bucket_highest(index)
+          << "] " << counts_[index] << std::endl;
+    }
+  }
+}
+
+} // namespace timerlat_load
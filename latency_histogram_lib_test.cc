@@ -0,0 +1,82 @@
+#include "latency_histogram.hh"
+
+#include <memory>
+#include <sstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+TEST(LatencyHistogramTest, Buckets) {
+  // The buckets are contiguous and cover every value.
+  EXPECT_EQ(0U, LatencyHistogram::bucket_lowest(0U));
+  for (size_t index = 1U; index < LatencyHistogram::BUCKETS; index++) {
+    ASSERT_EQ(LatencyHistogram::bucket_highest(index - 1U) + 1U,
+              LatencyHistogram::bucket_lowest(index))
+        << index;
+  }
+  EXPECT_EQ(UINT64_MAX,
+            LatencyHistogram::bucket_highest(LatencyHistogram::BUCKETS - 1U));
+  // Every value lands in the bucket which covers it.
+  for (const uint64_t value :
+       {uint64_t{0}, uint64_t{1}, uint64_t{255}, uint64_t{256}, uint64_t{257},
+        uint64_t{511}, uint64_t{512}, uint64_t{1000000}, uint64_t{1} << 40,
+        (uint64_t{1} << 40) - 1U, UINT64_MAX}) {
+    const size_t index = LatencyHistogram::bucket_index(value);
+    ASSERT_GT(LatencyHistogram::BUCKETS, index) << value;
+    EXPECT_LE(LatencyHistogram::bucket_lowest(index), value);
+    EXPECT_GE(LatencyHistogram::bucket_highest(index), value);
+  }
+  // Small values are exact, and large ones are within 1/128.
+  EXPECT_EQ(200U, LatencyHistogram::bucket_lowest(
+                      LatencyHistogram::bucket_index(200U)));
+  EXPECT_EQ(200U, LatencyHistogram::bucket_highest(
+                      LatencyHistogram::bucket_index(200U)));
+  const size_t index = LatencyHistogram::bucket_index(1000000U);
+  EXPECT_GE(LatencyHistogram::bucket_lowest(index) / 128U,
+            LatencyHistogram::bucket_highest(index) -
+                LatencyHistogram::bucket_lowest(index));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  auto histogram = make_latency_histogram();
+  EXPECT_EQ(0U, histogram->count());
+  EXPECT_EQ(0U, histogram->min());
+  EXPECT_EQ(0U, histogram->percentile(50.0));
+
+  for (uint64_t value = 1U; value <= 10000U; value++) {
+    histogram->record(value * 1000U);
+  }
+  EXPECT_EQ(10000U, histogram->count());
+  EXPECT_EQ(1000U, histogram->min());
+  EXPECT_EQ(10000000U, histogram->max());
+  EXPECT_NEAR(5000000.0, histogram->percentile(50.0), 5000000.0 / 128);
+  EXPECT_NEAR(9900000.0, histogram->percentile(99.0), 9900000.0 / 128);
+  EXPECT_NEAR(9990000.0, histogram->percentile(99.9), 9990000.0 / 128);
+  EXPECT_EQ(10000000U, histogram->percentile(100.0));
+  // Percentiles are the highest value of their bucket.
+  EXPECT_NEAR(1000.0, histogram->percentile(0.0), 1000.0 / 128);
+
+  histogram->reset();
+  EXPECT_EQ(0U, histogram->count());
+  EXPECT_EQ(0U, histogram->max());
+}
+
+TEST(LatencyHistogramTest, Print) {
+  auto histogram = make_latency_histogram();
+  histogram->record(3U);
+  histogram->record(3U);
+  histogram->record(1000U);
+  std::ostringstream out;
+  histogram->print(out);
+  EXPECT_THAT(out.str(),
+              ::testing::StartsWith("3 samples (ns): min 3 p50 3 p99 1000 "
+                                    "p99.9 1000 p99.99 1000 max 1000\n"));
+  EXPECT_THAT(out.str(), ::testing::HasSubstr("  [3, 3] 2\n"));
+  EXPECT_THAT(out.str(), ::testing::HasSubstr("  [1000, 1003] 1\n"));
+}
+
+} // namespace local_testing
+} // namespace timerlat_load
@@ -0,0 +1,45 @@
+// Summarize a trace which a latency run recorded, or export it as CSV.
+
+#include "latency_trace.hh"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace timerlat_load;
+
+void usage(const char *prog) {
+  std::cerr << prog << " [-c] TRACE" << std::endl;
+  std::cerr << "Print the statistics of the samples in TRACE." << std::endl;
+  std::cerr << "  -c  instead print every sample as CSV" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "c"))) {
+    switch (opt) {
+    case 'c':
+      csv = true;
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  LatencyTrace trace;
+  if (!trace.open(argv[optind])) {
+    exit(EXIT_FAILURE);
+  }
+  if (csv) {
+    write_trace_csv(trace, std::cout);
+  } else {
+    print_trace_summary(trace, std::cout);
+  }
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,139 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+// A binary file of every sample of a latency run, for analysing the tail and
+// the order of events afterwards.  Formatting or writing each sample during
+// the run would perturb what it measures, so the writer preallocates and maps
+// the whole file up front and appends each record with a plain store.  A
+// TraceWriter belongs to the one thread which appends to it, so it needs no
+// locks; threads which each record samples each open their own file.
+//
+// The layout, in the byte order of the recording host:
+//   trace_header
+//   trace_record[count]
+
+#include "latency_histogram.hh"
+#include "timestamp.hh"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace timerlat_load {
+
+constexpr char TRACE_MAGIC[8] = {'L', 'A', 'T', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t TRACE_VERSION = 1U;
+
+struct trace_header {
+  char magic[8];
+  uint32_t version;
+  // The clock_source of the timestamps.
+  uint32_t clock;
+  // Timestamp ticks per second.
+  uint64_t frequency;
+  uint64_t capacity;
+  // Updated after every record, so that a run which dies leaves a readable
+  // trace.
+  uint64_t count;
+};
+
+// One sample.  The timestamps are in ticks of the recording Timestamper.
+struct trace_record {
+  // The order in which the receiver took the sample, from 0.
+  uint64_t sequence;
+  // When the sample was due to be sent, which is sent unless the sender was
+  // paced.
+  uint64_t intended;
+  uint64_t sent;
+  uint64_t received;
+  // The receiver's CPU.
+  uint32_t cpu;
+  // What the receiver's read of the timerlat file descriptor before the
+  // sample returned: the bytes read, -1 if it failed, or 0 if there was none.
+  int32_t timerlat;
+};
+
+class TraceWriter {
+public:
+  TraceWriter() = default;
+  ~TraceWriter() { close(); }
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  // Create trace_path, replacing any file there, with room for capacity
+  // records of timestamper's timestamps, and map it, storing to every page
+  // now so that appending does not fault.  Once writeback has cleaned a page
+  // which has yet to be appended to, though, the kernel write-protects it
+  // again, so a run which outlasts the writeback interval, about 30 seconds
+  // by default, takes one minor fault per page of records after that.
+  // Returns false, after printing why, if the file cannot be created.
+  bool open(const std::string &trace_path, uint64_t capacity,
+            const Timestamper &timestamper);
+  bool is_open() const { return nullptr != header_; }
+  // Makes no system calls.  Returns false, dropping record, if the trace is
+  // full.
+  bool append(const trace_record &record) {
+    if (count_ == capacity_) {
+      return false;
+    }
+    records_[count_++] = record;
+    header_->count = count_;
+    return true;
+  }
+  uint64_t size() const { return count_; }
+  // Unmap the trace and truncate it to the records appended.
+  void close();
+
+private:
+  int fd_ = -1;
+  trace_header *header_ = nullptr;
+  trace_record *records_ = nullptr;
+  uint64_t capacity_ = 0U;
+  uint64_t count_ = 0U;
+};
+
+// A read-only mapping of a trace.  References which it returns are valid as
+// long as it is.
+class LatencyTrace {
+public:
+  LatencyTrace() = default;
+  ~LatencyTrace() { unmap(); }
+  LatencyTrace(const LatencyTrace &) = delete;
+  LatencyTrace &operator=(const LatencyTrace &) = delete;
+
+  // Map trace_path and check that every record lies within it.  Returns
+  // false, after printing why, if it is not a valid trace.
+  bool open(const std::string &trace_path);
+  const trace_header &header() const { return *header_; }
+  size_t size() const { return header_->count; }
+  const trace_record &operator[](size_t i) const { return records_[i]; }
+  // Convert ticks of the recording clock to nanoseconds.
+  uint64_t to_ns(uint64_t ticks) const {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(ticks) *
+                                 1000000000U / header_->frequency);
+  }
+  // The nanoseconds from start to end, or 0 if end precedes start.
+  uint64_t elapsed_ns(uint64_t start, uint64_t end) const {
+    return (end > start) ? to_ns(end - start) : 0U;
+  }
+
+private:
+  void unmap();
+
+  const char *base_ = nullptr;
+  size_t length_ = 0U;
+  const trace_header *header_ = nullptr;
+  const trace_record *records_ = nullptr;
+};
+
+// Print the clock, the number of samples and the span of the run, the samples
+// on each CPU, failed timerlat reads, and histograms of the delays since each
+// sample was due and, if any sample was late, since it was sent.
+void print_trace_summary(const LatencyTrace &trace, std::ostream &out);
+// Write one CSV line per record, after a header line, with the timestamps in
+// nanoseconds since the first sample was due.
+void write_trace_csv(const LatencyTrace &trace, std::ostream &out);
+
+} // namespace timerlat_load
+
+#endif
@@ -0,0 +1,194 @@
+#include "latency_trace.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+
+namespace timerlat_load {
+
+bool TraceWriter::open(const std::string &trace_path, uint64_t capacity,
+                       const Timestamper &timestamper) {
+  close();
+  const size_t length = sizeof(trace_header) + capacity * sizeof(trace_record);
+  fd_ = ::open(trace_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+               0644);
+  if (-1 == fd_) {
+    std::cerr << "Unable to create " << trace_path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  // Allocate the blocks now, so that a full disk fails here rather than with
+  // SIGBUS during the run.  posix_fallocate() returns the error.
+  const int err = posix_fallocate(fd_, 0, length);
+  if (0 != err) {
+    std::cerr << "Unable to allocate " << length << " bytes for "
+              << trace_path << ": " << strerror(err) << std::endl;
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  void *base =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (MAP_FAILED == base) {
+    std::cerr << "Unable to map " << trace_path << ": " << strerror(errno)
+              << std::endl;
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  // MAP_POPULATE would map the pages read-only, so that the first store to
+  // each would still fault.  Storing to every page maps it writable.
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  for (size_t offset = 0U; offset < length; offset += page_size) {
+    static_cast<volatile char *>(base)[offset] = '\0';
+  }
+  header_ = static_cast<trace_header *>(base);
+  memcpy(header_->magic, TRACE_MAGIC, sizeof(header_->magic));
+  header_->version = TRACE_VERSION;
+  header_->clock = static_cast<uint32_t>(timestamper.source());
+  header_->frequency = timestamper.frequency();
+  header_->capacity = capacity;
+  header_->count = 0U;
+  records_ = reinterpret_cast<trace_record *>(header_ + 1);
+  capacity_ = capacity;
+  count_ = 0U;
+  return true;
+}
+
+void TraceWriter::close() {
+  if (nullptr == header_) {
+    return;
+  }
+  munmap(header_, sizeof(trace_header) + capacity_ * sizeof(trace_record));
+  const size_t length = sizeof(trace_header) + count_ * sizeof(trace_record);
+  if (0 != ftruncate(fd_, length)) {
+    std::cerr << "Unable to truncate trace: " << strerror(errno) << std::endl;
+  }
+  ::close(fd_);
+  fd_ = -1;
+  header_ = nullptr;
+  records_ = nullptr;
+  capacity_ = 0U;
+  count_ = 0U;
+}
+
+void LatencyTrace::unmap() {
+  if (nullptr != base_) {
+    munmap(const_cast<char *>(base_), length_);
+  }
+  base_ = nullptr;
+  length_ = 0U;
+  header_ = nullptr;
+  records_ = nullptr;
+}
+
+bool LatencyTrace::open(const std::string &trace_path) {
+  unmap();
+  const int fd = ::open(trace_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    std::cerr << "Unable to open " << trace_path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct stat sb;
+  if ((0 != fstat(fd, &sb)) ||
+      (static_cast<size_t>(sb.st_size) < sizeof(trace_header))) {
+    std::cerr << trace_path << " is too short to be a trace." << std::endl;
+    close(fd);
+    return false;
+  }
+  void *base = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == base) {
+    std::cerr << "Unable to map " << trace_path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  base_ = static_cast<const char *>(base);
+  length_ = sb.st_size;
+
+  header_ = reinterpret_cast<const trace_header *>(base_);
+  if ((0 != memcmp(header_->magic, TRACE_MAGIC, sizeof(header_->magic))) ||
+      (TRACE_VERSION != header_->version) || (0U == header_->frequency) ||
+      (header_->count >
+       (length_ - sizeof(trace_header)) / sizeof(trace_record))) {
+    std::cerr << trace_path << " is not a version " << TRACE_VERSION
+              << " trace." << std::endl;
+    unmap();
+    return false;
+  }
+  records_ =
+      reinterpret_cast<const trace_record *>(base_ + sizeof(trace_header));
+  return true;
+}
+
+void print_trace_summary(const LatencyTrace &trace, std::ostream &out) {
+  const trace_header &header = trace.header();
+  out << trace.size() << " of " << header.capacity
+      << " samples, timestamped by "
+      << clock_source_name(static_cast<clock_source>(header.clock)) << " at "
+      << header.frequency << " Hz" << std::endl;
+  if (0U == trace.size()) {
+    return;
+  }
+  out << "Run lasted "
+      << trace.elapsed_ns(trace[0].intended, trace[trace.size() - 1U].received)
+      << " ns" << std::endl;
+
+  auto due = make_latency_histogram();
+  auto service = make_latency_histogram();
+  std::map<uint32_t, uint64_t> per_cpu{};
+  uint64_t timerlat_failures = 0U;
+  bool late = false;
+  for (size_t i = 0U; i < trace.size(); i++) {
+    const trace_record &record = trace[i];
+    due->record(trace.elapsed_ns(record.intended, record.received));
+    service->record(trace.elapsed_ns(record.sent, record.received));
+    late = late || (record.intended != record.sent);
+    per_cpu[record.cpu]++;
+    if (-1 == record.timerlat) {
+      timerlat_failures++;
+    }
+  }
+  out << "Samples per receiving CPU:";
+  for (const auto &[cpu, count] : per_cpu) {
+    out << " " << cpu << ":" << count;
+  }
+  out << std::endl;
+  if (0U != timerlat_failures) {
+    out << timerlat_failures << " timerlat reads failed." << std::endl;
+  }
+  out << "Delays since each sample was due:" << std::endl;
+  due->print(out);
+  if (late) {
+    out << "Delays since each sample was sent:" << std::endl;
+    service->print(out);
+  }
+}
+
+void write_trace_csv(const LatencyTrace &trace, std::ostream &out) {
+  out << "sequence,intended_ns,sent_ns,received_ns,delay_ns,cpu,timerlat"
+      << std::endl;
+  if (0U == trace.size()) {
+    return;
+  }
+  const uint64_t start = trace[0].intended;
+  for (size_t i = 0U; i < trace.size(); i++) {
+    const trace_record &record = trace[i];
+    out << record.sequence << "," << trace.elapsed_ns(start, record.intended)
+        << "," << trace.elapsed_ns(start, record.sent) << ","
+        << trace.elapsed_ns(start, record.received) << ","
+        << trace.elapsed_ns(record.intended, record.received) << ","
+        << record.cpu << "," << record.timerlat << "\n";
+  }
+  out.flush();
+}
+
+} // namespace timerlat_load
@@ -0,0 +1,100 @@
+#include "latency_trace.hh"
+#include "test_temp_dir.hh"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "gmock/gmock-matchers.h"
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+class LatencyTraceTest : public test_util::TempDirTest {
+protected:
+  void SetUp() override {
+    TempDirTest::SetUp();
+    trace_path = (dir / "trace").string();
+  }
+
+  // Ticks are nanoseconds, so that the expected output is exact.
+  const Timestamper timestamper{clock_source::monotonic_raw};
+  std::string trace_path;
+};
+
+TEST_F(LatencyTraceTest, WriteRead) {
+  TraceWriter writer;
+  ASSERT_TRUE(writer.open(trace_path, 3U, timestamper));
+  EXPECT_TRUE(writer.append({0U, 1000U, 1000U, 1500U, 2U, 1}));
+  EXPECT_TRUE(writer.append({1U, 2000U, 2700U, 3000U, 3U, -1}));
+  // The header is current while the writer still has the file.
+  {
+    LatencyTrace trace;
+    ASSERT_TRUE(trace.open(trace_path));
+    EXPECT_EQ(3U, trace.header().capacity);
+    EXPECT_EQ(2U, trace.size());
+  }
+  EXPECT_TRUE(writer.append({2U, 3000U, 3000U, 2990U, 2U, 0}));
+  EXPECT_FALSE(writer.append({3U, 4000U, 4000U, 4100U, 2U, 0}));
+  EXPECT_EQ(3U, writer.size());
+  writer.close();
+  EXPECT_EQ(sizeof(trace_header) + 3U * sizeof(trace_record),
+            std::filesystem::file_size(trace_path));
+
+  LatencyTrace trace;
+  ASSERT_TRUE(trace.open(trace_path));
+  EXPECT_EQ(static_cast<uint32_t>(clock_source::monotonic_raw),
+            trace.header().clock);
+  EXPECT_EQ(1000000000U, trace.header().frequency);
+  ASSERT_EQ(3U, trace.size());
+  EXPECT_EQ(2700U, trace[1].sent);
+  EXPECT_EQ(-1, trace[1].timerlat);
+  // A receive timestamp a little before the send, as from another CPU, is no
+  // delay rather than a huge one.
+  EXPECT_EQ(0U, trace.elapsed_ns(trace[2].sent, trace[2].received));
+
+  std::ostringstream csv;
+  write_trace_csv(trace, csv);
+  EXPECT_EQ("sequence,intended_ns,sent_ns,received_ns,delay_ns,cpu,timerlat\n"
+            "0,0,0,500,500,2,1\n"
+            "1,1000,1700,2000,1000,3,-1\n"
+            "2,2000,2000,1990,0,2,0\n",
+            csv.str());
+
+  std::ostringstream summary;
+  print_trace_summary(trace, summary);
+  EXPECT_THAT(summary.str(),
+              ::testing::HasSubstr("3 of 3 samples, timestamped by "));
+  EXPECT_THAT(summary.str(), ::testing::HasSubstr("Run lasted 1990 ns"));
+  EXPECT_THAT(summary.str(),
+              ::testing::HasSubstr("Samples per receiving CPU: 2:2 3:1\n"));
+  EXPECT_THAT(summary.str(),
+              ::testing::HasSubstr("1 timerlat reads failed."));
+  EXPECT_THAT(summary.str(),
+              ::testing::HasSubstr("since each sample was sent"));
+}
+
+TEST_F(LatencyTraceTest, Invalid) {
+  LatencyTrace trace;
+  testing::internal::CaptureStderr();
+  EXPECT_FALSE(trace.open(trace_path));
+  std::ofstream(trace_path) << "LATTRACE";
+  EXPECT_FALSE(trace.open(trace_path));
+  std::ofstream(trace_path) << std::string(sizeof(trace_header), 'x');
+  EXPECT_FALSE(trace.open(trace_path));
+  const std::string errors = testing::internal::GetCapturedStderr();
+  EXPECT_THAT(errors, ::testing::HasSubstr("Unable to open"));
+  EXPECT_THAT(errors, ::testing::HasSubstr("too short"));
+  EXPECT_THAT(errors, ::testing::HasSubstr("is not a version 1 trace"));
+
+  TraceWriter writer;
+  testing::internal::CaptureStderr();
+  EXPECT_FALSE(writer.open((dir / "missing" / "trace").string(), 1U,
+                           timestamper));
+  testing::internal::GetCapturedStderr();
+  EXPECT_FALSE(writer.is_open());
+}
+
+} // namespace local_testing
+} // namespace timerlat_load
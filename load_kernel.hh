@@ -0,0 +1,85 @@
+#ifndef LOAD_KERNEL_H
+#define LOAD_KERNEL_H
+
+// Selectable loads for timerlat_load to run between reads of the timerlat file
+// descriptor.  Reading /dev/full is one kind of stress, but latency also
+// suffers from saturated memory bandwidth, a thrashed last-level cache, the
+// frequency drop of wide SIMD and storms of system calls.  Each kernel counts
+// the work it does, so that latency can be correlated with a quantified load.
+
+#include "timerlat_load.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace timerlat_load {
+
+enum class load_kind {
+  // Read /dev/full into a prefaulted buffer, as timerlat_load.py does.
+  devfull,
+  // The STREAM triad a[i] = b[i] + q * c[i] over arrays larger than the LLC.
+  triad,
+  // A random pointer chase over a ring of cache lines larger than the LLC,
+  // so that nearly every load misses.
+  chase,
+  // Independent multiply-adds on the widest vectors which the CPU supports.
+  fma,
+  // getppid() in a tight loop.
+  syscall,
+};
+
+std::optional<load_kind> parse_load_kind(std::string_view name);
+const char *load_kind_name(load_kind kind);
+// The unit of the work which a kernel of this kind reports.
+const char *load_kind_unit(load_kind kind);
+
+struct load_options {
+  load_kind kind = load_kind::devfull;
+  // The bytes which devfull reads per run, or which the triad's three arrays
+  // or the chase's ring span.  0 selects BYTES for devfull and twice the LLC
+  // for the others.
+  size_t bytes = 0U;
+  // The dependent loads, vector loop iterations or system calls of one run of
+  // chase, fma or syscall.  0 selects a count which takes about a
+  // millisecond, the default timerlat period.
+  uint64_t ops = 0U;
+};
+
+// One kind of load.  Construct it on the CPU which it will load, so that its
+// memory is local to that CPU.
+class LoadKernel {
+public:
+  virtual ~LoadKernel() = default;
+  // False if setup failed, after printing why.
+  virtual bool valid() const { return true; }
+  // Do one run's worth of work and return its amount in units of
+  // load_kind_unit().
+  virtual uint64_t run() = 0;
+};
+
+std::unique_ptr<LoadKernel> make_load_kernel(const load_options &options);
+
+// The size of the last-level cache, or 32 MiB if it is unknown.
+size_t llc_bytes();
+
+struct load_stats {
+  uint64_t iterations = 0U;
+  // In the kernel's load_kind_unit().
+  uint64_t work = 0U;
+  // Time spent in the kernel, excluding the waits for the timer.
+  double seconds = 0.0;
+  double rate() const { return (0.0 < seconds) ? (work / seconds) : 0.0; }
+};
+
+// Alternately read a byte from the timerlat file descriptor tlfd, which blocks
+// until the next timer period, and run kernel once, until stop is set.
+// Returns std::nullopt if reading tlfd fails other than by interruption.
+std::optional<load_stats> run_load(int tlfd, LoadKernel &kernel,
+                                   const std::atomic<bool> &stop);
+
+} // namespace timerlat_load
+
+#endif
@@ -0,0 +1,265 @@
+#include "load_kernel.hh"
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace timerlat_load {
+
+namespace {
+
+constexpr size_t CACHE_LINE = 64U;
+// About a millisecond of work on a current x86 server.
+constexpr uint64_t DEFAULT_CHASE_OPS = 10000U;
+constexpr uint64_t DEFAULT_FMA_OPS = 1U << 19;
+constexpr uint64_t DEFAULT_SYSCALL_OPS = 5000U;
+
+constexpr const char *KIND_NAMES[] = {"devfull", "triad", "chase", "fma",
+                                      "syscall"};
+constexpr const char *KIND_UNITS[] = {"bytes", "bytes", "loads", "flops",
+                                      "syscalls"};
+
+class DevFullKernel : public LoadKernel {
+public:
+  explicit DevFullKernel(size_t bytes)
+      : buf_(bytes), fd_(open(DEVPATH, O_RDONLY | O_CLOEXEC)) {
+    if (-1 == fd_) {
+      std::cerr << "Unable to open file " << DEVPATH << ": "
+                << strerror(errno) << std::endl;
+    }
+  }
+  ~DevFullKernel() override {
+    if (-1 != fd_) {
+      close(fd_);
+    }
+  }
+  bool valid() const override { return buf_.valid() && (-1 != fd_); }
+  uint64_t run() override {
+    const ssize_t bytes_read = read(fd_, buf_.data(), buf_.size());
+    return (0 < bytes_read) ? bytes_read : 0U;
+  }
+
+private:
+  LoadBuffer buf_;
+  int fd_;
+};
+
+class TriadKernel : public LoadKernel {
+public:
+  explicit TriadKernel(size_t bytes)
+      : buf_(bytes), n_(bytes / (3U * sizeof(double))) {
+    if (!buf_.valid()) {
+      return;
+    }
+    a_ = reinterpret_cast<double *>(buf_.data());
+    b_ = a_ + n_;
+    c_ = b_ + n_;
+    for (size_t i = 0U; i < n_; i++) {
+      b_[i] = 1.0;
+      c_[i] = 2.0;
+    }
+  }
+  bool valid() const override { return buf_.valid() && (0U < n_); }
+  uint64_t run() override {
+    const double q = 3.0;
+    for (size_t i = 0U; i < n_; i++) {
+      a_[i] = b_[i] + q * c_[i];
+    }
+    // STREAM counts two loads and a store per element.
+    return 3U * sizeof(double) * n_;
+  }
+
+private:
+  LoadBuffer buf_;
+  size_t n_;
+  double *a_ = nullptr;
+  double *b_ = nullptr;
+  double *c_ = nullptr;
+};
+
+class ChaseKernel : public LoadKernel {
+public:
+  ChaseKernel(size_t bytes, uint64_t ops)
+      : buf_(bytes), nodes_(bytes / CACHE_LINE), ops_(ops) {
+    if (!valid()) {
+      return;
+    }
+    // Sattolo's algorithm makes a permutation which is a single cycle, so
+    // that the chase visits every line before repeating.  The fixed seed
+    // makes runs comparable.
+    std::vector<uint64_t> order(nodes_);
+    for (uint64_t i = 0U; i < nodes_; i++) {
+      order[i] = i;
+    }
+    std::mt19937_64 rng(1U);
+    for (uint64_t i = nodes_ - 1U; i > 0U; i--) {
+      std::uniform_int_distribution<uint64_t> pick(0U, i - 1U);
+      std::swap(order[i], order[pick(rng)]);
+    }
+    for (uint64_t i = 0U; i < nodes_; i++) {
+      next(order[i]) = order[(i + 1U) % nodes_];
+    }
+  }
+  bool valid() const override { return buf_.valid() && (1U < nodes_); }
+  uint64_t run() override {
+    uint64_t pos = pos_;
+    for (uint64_t op = 0U; op < ops_; op++) {
+      pos = next(pos);
+    }
+    // Resume where this run stopped, which also keeps the loads live.
+    pos_ = pos;
+    return ops_;
+  }
+
+private:
+  // Each node is the first word of its own cache line.
+  uint64_t &next(uint64_t node) {
+    return *reinterpret_cast<uint64_t *>(buf_.data() + node * CACHE_LINE);
+  }
+
+  LoadBuffer buf_;
+  uint64_t nodes_;
+  uint64_t ops_;
+  uint64_t pos_ = 0U;
+};
+
+// Eight doubles, which is one AVX-512 register, or two AVX or four SSE
+// registers where the wider ones are missing.
+typedef double vec8d __attribute__((vector_size(64)));
+constexpr size_t FMA_LANES = sizeof(vec8d) / sizeof(double);
+// Enough independent accumulators to cover the latency of an FMA.
+constexpr size_t FMA_CHAINS = 8U;
+
+// Compile a version for each vector width, chosen when the program loads.
+#if defined(__x86_64__)
+__attribute__((target_clones("arch=skylake-avx512", "arch=haswell",
+                             "default")))
+#endif
+double fma_loop(uint64_t iterations) {
+  vec8d acc[FMA_CHAINS];
+  for (size_t chain = 0U; chain < FMA_CHAINS; chain++) {
+    acc[chain] = vec8d{} + (1.0 + chain);
+  }
+  // Multiplying by slightly less than 1 and adding a little keeps the values
+  // finite and normal, however long the loop runs.
+  const vec8d mul = vec8d{} + 0.999999;
+  const vec8d add = vec8d{} + 0.000001;
+  for (uint64_t i = 0U; i < iterations; i++) {
+    // Unrolled, so that the accumulators stay in registers.
+#pragma GCC unroll 8
+    for (size_t chain = 0U; chain < FMA_CHAINS; chain++) {
+      acc[chain] = acc[chain] * mul + add;
+    }
+  }
+  double sum = 0.0;
+  for (size_t chain = 0U; chain < FMA_CHAINS; chain++) {
+    for (size_t lane = 0U; lane < FMA_LANES; lane++) {
+      sum += acc[chain][lane];
+    }
+  }
+  return sum;
+}
+
+class FmaKernel : public LoadKernel {
+public:
+  explicit FmaKernel(uint64_t ops) : ops_(ops) {}
+  uint64_t run() override {
+    sum_ += fma_loop(ops_);
+    // A multiply and an add per lane.
+    return 2U * FMA_LANES * FMA_CHAINS * ops_;
+  }
+
+private:
+  uint64_t ops_;
+  // Keeps the loop's result live.
+  volatile double sum_ = 0.0;
+};
+
+class SyscallKernel : public LoadKernel {
+public:
+  explicit SyscallKernel(uint64_t ops) : ops_(ops) {}
+  uint64_t run() override {
+    for (uint64_t op = 0U; op < ops_; op++) {
+      // Not glibc's getppid(), in case a version caches it.
+      syscall(SYS_getppid);
+    }
+    return ops_;
+  }
+
+private:
+  uint64_t ops_;
+};
+
+} // namespace
+
+std::optional<load_kind> parse_load_kind(std::string_view name) {
+  for (size_t kind = 0U; kind < std::size(KIND_NAMES); kind++) {
+    if (name == KIND_NAMES[kind]) {
+      return static_cast<load_kind>(kind);
+    }
+  }
+  return std::nullopt;
+}
+
+const char *load_kind_name(load_kind kind) {
+  return KIND_NAMES[static_cast<size_t>(kind)];
+}
+
+const char *load_kind_unit(load_kind kind) {
+  return KIND_UNITS[static_cast<size_t>(kind)];
+}
+
+size_t llc_bytes() {
+  const long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  return (0 < size) ? size : (32U << 20);
+}
+
+std::unique_ptr<LoadKernel> make_load_kernel(const load_options &options) {
+  const size_t bytes = options.bytes ? options.bytes : (2U * llc_bytes());
+  switch (options.kind) {
+  case load_kind::devfull:
+    return std::make_unique<DevFullKernel>(options.bytes ? options.bytes
+                                                         : BYTES);
+  case load_kind::triad:
+    return std::make_unique<TriadKernel>(bytes);
+  case load_kind::chase:
+    return std::make_unique<ChaseKernel>(
+        bytes, options.ops ? options.ops : DEFAULT_CHASE_OPS);
+  case load_kind::fma:
+    return std::make_unique<FmaKernel>(options.ops ? options.ops
+                                                   : DEFAULT_FMA_OPS);
+  case load_kind::syscall:
+    return std::make_unique<SyscallKernel>(
+        options.ops ? options.ops : DEFAULT_SYSCALL_OPS);
+  }
+  return nullptr;
+}
+
+std::optional<load_stats> run_load(int tlfd, LoadKernel &kernel,
+                                   const std::atomic<bool> &stop) {
+  load_stats stats{};
+  char byte;
+  while (!stop.load(std::memory_order_relaxed)) {
+    if (-1 == read(tlfd, &byte, 1U)) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return std::nullopt;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    stats.work += kernel.run();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stats.seconds += elapsed.count();
+    stats.iterations++;
+  }
+  return stats;
+}
+
+} // namespace timerlat_load
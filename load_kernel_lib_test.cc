@@ -0,0 +1,118 @@
+#include "load_kernel.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+constexpr load_kind ALL_KINDS[] = {load_kind::devfull, load_kind::triad,
+                                   load_kind::chase, load_kind::fma,
+                                   load_kind::syscall};
+
+TEST(LoadKernelTest, KindNames) {
+  for (const load_kind kind : ALL_KINDS) {
+    EXPECT_EQ(kind, parse_load_kind(load_kind_name(kind)));
+  }
+  EXPECT_FALSE(parse_load_kind("stream").has_value());
+  EXPECT_FALSE(parse_load_kind("").has_value());
+}
+
+TEST(LoadKernelTest, LlcBytes) { EXPECT_LT(0U, llc_bytes()); }
+
+// Small sizes and counts, so that the test is quick.
+TEST(LoadKernelTest, Run) {
+  const struct {
+    load_kind kind;
+    uint64_t work;
+    const char *unit;
+  } cases[] = {
+      {load_kind::devfull, 4096U, "bytes"},
+      // Three arrays of 1024 doubles.
+      {load_kind::triad, 3U * 1024U * sizeof(double), "bytes"},
+      {load_kind::chase, 100U, "loads"},
+      // Eight chains of eight-lane multiply-adds.
+      {load_kind::fma, 2U * 8U * 8U * 100U, "flops"},
+      {load_kind::syscall, 100U, "syscalls"},
+  };
+  for (const auto &test_case : cases) {
+    load_options options;
+    options.kind = test_case.kind;
+    options.bytes = (load_kind::triad == test_case.kind)
+                        ? 3U * 1024U * sizeof(double)
+                        : 4096U;
+    options.ops = 100U;
+    const std::unique_ptr<LoadKernel> kernel = make_load_kernel(options);
+    ASSERT_NE(nullptr, kernel);
+    ASSERT_TRUE(kernel->valid()) << load_kind_name(test_case.kind);
+    EXPECT_STREQ(test_case.unit, load_kind_unit(test_case.kind));
+    EXPECT_EQ(test_case.work, kernel->run()) << load_kind_name(test_case.kind);
+    // The chase resumes where it stopped.
+    EXPECT_EQ(test_case.work, kernel->run()) << load_kind_name(test_case.kind);
+  }
+}
+
+TEST(LoadKernelTest, ChaseTooSmall) {
+  load_options options;
+  options.kind = load_kind::chase;
+  options.bytes = 64U;
+  EXPECT_FALSE(make_load_kernel(options)->valid());
+}
+
+// /dev/zero stands in for the timerlat file descriptor, so the kernel runs
+// back to back until stop is set.
+TEST(LoadKernelTest, RunLoad) {
+  const int tlfd = open("/dev/zero", O_RDONLY | O_CLOEXEC);
+  ASSERT_NE(-1, tlfd);
+  load_options options;
+  options.kind = load_kind::syscall;
+  options.ops = 10U;
+  const std::unique_ptr<LoadKernel> kernel = make_load_kernel(options);
+  std::atomic<bool> stop{false};
+  std::thread stopper([&stop]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stop = true;
+  });
+  const std::optional<load_stats> stats = run_load(tlfd, *kernel, stop);
+  stopper.join();
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_LT(0U, stats->iterations);
+  EXPECT_EQ(10U * stats->iterations, stats->work);
+  EXPECT_LT(0.0, stats->seconds);
+  EXPECT_LT(0.0, stats->rate());
+
+  // A closed descriptor fails.
+  close(tlfd);
+  EXPECT_FALSE(run_load(tlfd, *kernel, std::atomic<bool>{false}).has_value());
+}
+
+// Each iteration reads a byte of the timerlat file descriptor and fills the
+// prefaulted buffer from /dev/full, which never ends, so only stop ends the
+// load.
+TEST(LoadKernelTest, RunDevFull) {
+  const int tlfd = open("/dev/zero", O_RDONLY | O_CLOEXEC);
+  ASSERT_NE(-1, tlfd);
+  load_options options;
+  options.bytes = 4096U;
+  const std::unique_ptr<LoadKernel> kernel = make_load_kernel(options);
+  ASSERT_TRUE(kernel->valid());
+  std::atomic<bool> stop{false};
+  std::thread stopper([&stop]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stop = true;
+  });
+  const std::optional<load_stats> stats = run_load(tlfd, *kernel, stop);
+  stopper.join();
+  close(tlfd);
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_LT(0U, stats->iterations);
+  EXPECT_EQ(4096U * stats->iterations, stats->work);
+}
+
+} // namespace local_testing
+} // namespace timerlat_load
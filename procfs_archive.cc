@@ -0,0 +1,89 @@
+// Capture a procfs snapshot into an archive, or classify the tasks in one.
+
+#include "procfs_archive.hh"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace process_affinity;
+
+void usage(const char *prog) {
+  std::cerr << prog << " capture [-t] [-d PROCFS] ARCHIVE" << std::endl;
+  std::cerr << prog << " replay [-t] [-f FORMAT] ARCHIVE" << std::endl;
+  std::cerr << "  -t  capture or replay every thread, not only thread-group "
+               "leaders"
+            << std::endl;
+  std::cerr << "  -d  capture PROCFS rather than /proc/" << std::endl;
+  std::cerr << "  -f  print text (the default), json lines or binary records"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (2 > argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const bool capture = (0 == strcmp("capture", argv[1]));
+  if (!capture && (0 != strcmp("replay", argv[1]))) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  bool all_threads = false;
+  std::string procfs_top = "/proc/";
+  output_format format = output_format::text;
+  int opt;
+  // Parse the options after the subcommand.
+  while (-1 != (opt = getopt(argc - 1, argv + 1, "td:f:"))) {
+    switch (opt) {
+    case 't':
+      all_threads = true;
+      break;
+    case 'd':
+      procfs_top = optarg;
+      break;
+    case 'f': {
+      const std::optional<output_format> parsed = parse_output_format(optarg);
+      if (!parsed.has_value()) {
+        std::cerr << "Illegal format " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      format = parsed.value();
+      break;
+    }
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind + 2 != argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const std::string archive_path = argv[optind + 1];
+
+  if (capture) {
+    const std::optional<size_t> captured =
+        capture_procfs(procfs_top, all_threads, archive_path);
+    if (!captured.has_value()) {
+      exit(EXIT_FAILURE);
+    }
+    std::cout << "Captured " << captured.value() << " tasks." << std::endl;
+    exit(EXIT_SUCCESS);
+  }
+  ProcfsArchive archive;
+  if (!archive.open(archive_path)) {
+    exit(EXIT_FAILURE);
+  }
+  RecordWriter writer(STDOUT_FILENO, format);
+  for_each_archived_task_stat(archive, all_threads, task_filter{},
+                              [&](pid_t tid, const stat_fields &fields) {
+                                writer.write(tid, fields.thread_name,
+                                             fields.is_settable());
+                                return true;
+                              });
+  exit(writer.flush() ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,98 @@
+#ifndef PROCFS_ARCHIVE_H
+#define PROCFS_ARCHIVE_H
+
+// Capture of the stat and status files of every task on a host into a single
+// file, and replay of the classifier from that file.  Parser performance on a
+// workstation says little about a host with 60k tasks, and a live /proc
+// changes from run to run, so an archive captured on a production host lets
+// benchmarks and tests replay the same task population deterministically.
+// Replay maps the archive and parses the files in place, making no system
+// calls per task.
+//
+// The layout, in the byte order of the capturing host:
+//   archive_header
+//   archive_entry[entry_count]
+//   the contents of the files, which entries locate by offset from the start
+//   of the archive.
+
+#include "classify_process_affinity.hh"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace process_affinity {
+
+constexpr char ARCHIVE_MAGIC[8] = {'P', 'R', 'O', 'C', 'A', 'R', 'C', 'H'};
+constexpr uint32_t ARCHIVE_VERSION = 1U;
+
+struct archive_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_count;
+};
+
+// One task.  A status_size of 0 means that the status file was not captured.
+struct archive_entry {
+  int32_t tid;
+  // The thread-group leader, from the Tgid line of the status file, or tid if
+  // there is none.
+  int32_t tgid;
+  uint64_t stat_offset;
+  uint64_t status_offset;
+  uint32_t stat_size;
+  uint32_t status_size;
+};
+
+// Write the stat and status files of every thread in procfs_top, or of every
+// thread-group leader unless all_threads is set, to archive_path.  Tasks which
+// exit during the capture are omitted.  Returns the number of tasks captured,
+// or std::nullopt if procfs_top cannot be read or archive_path written.
+std::optional<size_t> capture_procfs(const std::string &procfs_top,
+                                     bool all_threads,
+                                     const std::string &archive_path);
+
+// A read-only mapping of an archive.  Views which it returns are valid as long
+// as it is.
+class ProcfsArchive {
+public:
+  ProcfsArchive() = default;
+  ~ProcfsArchive();
+  ProcfsArchive(const ProcfsArchive &) = delete;
+  ProcfsArchive &operator=(const ProcfsArchive &) = delete;
+
+  // Map archive_path and check that every entry lies within it.  Returns
+  // false, after printing why, if it is not a valid archive.
+  bool open(const std::string &archive_path);
+  size_t size() const { return entry_count_; }
+  pid_t tid(size_t i) const { return entries_[i].tid; }
+  pid_t tgid(size_t i) const { return entries_[i].tgid; }
+  std::string_view stat(size_t i) const {
+    return std::string_view(base_ + entries_[i].stat_offset,
+                            entries_[i].stat_size);
+  }
+  std::optional<std::string_view> status(size_t i) const;
+
+private:
+  void unmap();
+
+  const char *base_ = nullptr;
+  size_t length_ = 0U;
+  const archive_entry *entries_ = nullptr;
+  size_t entry_count_ = 0U;
+};
+
+// Like for_each_task_stat(), but replay the tasks of archive, in the order in
+// which they were captured.  Unless all_threads is set, only thread-group
+// leaders are visited.
+void for_each_archived_task_stat(
+    const ProcfsArchive &archive, bool all_threads, const task_filter &filter,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor);
+
+} // namespace process_affinity
+
+#endif
@@ -0,0 +1,221 @@
+#include "procfs_archive.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace process_affinity {
+
+namespace {
+
+// Append the whole of the file at pathname relative to dirfd to out.  A
+// status file is usually about 1.4 kB, but its CPU masks grow with the number
+// of CPUs, so read until EOF rather than into a fixed buffer.  On failure out
+// is left as it was.
+bool append_file_at(int dirfd, const char *pathname, std::string &out) {
+  const int fd = openat(dirfd, pathname, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return false;
+  }
+  const size_t start = out.size();
+  size_t end = start;
+  ssize_t bytes_read = 0;
+  do {
+    out.resize(end + STATUS_BUF_SIZE);
+    bytes_read = read(fd, &out[end], STATUS_BUF_SIZE);
+    if (0 < bytes_read) {
+      end += bytes_read;
+    }
+  } while (0 < bytes_read);
+  close(fd);
+  const bool complete = (0 == bytes_read) && (end > start);
+  out.resize(complete ? end : start);
+  return complete;
+}
+
+std::optional<pid_t> parse_tgid(std::string_view status) {
+  const std::optional<std::string_view> value =
+      parse_status_field(status, "Tgid");
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  pid_t tgid = 0;
+  const std::from_chars_result res =
+      std::from_chars(value->data(), value->data() + value->size(), tgid);
+  if (res.ec != std::errc()) {
+    return std::nullopt;
+  }
+  return tgid;
+}
+
+} // namespace
+
+std::optional<size_t> capture_procfs(const std::string &procfs_top,
+                                     bool all_threads,
+                                     const std::string &archive_path) {
+  std::vector<archive_entry> entries{};
+  std::string contents{};
+  stat_buf_t stat_buf;
+  // Holds "<tid>/status".
+  char relpath[NAME_MAX + sizeof("/status")];
+  if (!for_each_task_dir(
+          procfs_top, all_threads, [&](int dirfd, const char *name, pid_t tid) {
+            snprintf(relpath, sizeof(relpath), "%s/stat", name);
+            const std::optional<std::string_view> stat =
+                read_thread_stat(relpath, stat_buf, dirfd);
+            if (!stat.has_value()) {
+              return true;
+            }
+            archive_entry entry{};
+            entry.tid = tid;
+            entry.tgid = tid;
+            // Offsets are relative to the contents until they are complete.
+            entry.stat_offset = contents.size();
+            entry.stat_size = stat->size();
+            contents.append(stat.value());
+            snprintf(relpath, sizeof(relpath), "%s/status", name);
+            const size_t status_offset = contents.size();
+            if (append_file_at(dirfd, relpath, contents)) {
+              const std::string_view status =
+                  std::string_view(contents).substr(status_offset);
+              entry.tgid = parse_tgid(status).value_or(tid);
+              entry.status_offset = status_offset;
+              entry.status_size = status.size();
+            }
+            entries.push_back(entry);
+            return true;
+          })) {
+    return std::nullopt;
+  }
+
+  const uint64_t contents_offset =
+      sizeof(archive_header) + entries.size() * sizeof(archive_entry);
+  for (archive_entry &entry : entries) {
+    entry.stat_offset += contents_offset;
+    entry.status_offset += contents_offset;
+  }
+  archive_header header{};
+  memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+  header.version = ARCHIVE_VERSION;
+  header.entry_count = entries.size();
+  std::ofstream out(archive_path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(entries.data()),
+            entries.size() * sizeof(archive_entry));
+  out.write(contents.data(), contents.size());
+  out.close();
+  if (!out) {
+    std::cerr << "Unable to write " << archive_path << std::endl;
+    return std::nullopt;
+  }
+  return entries.size();
+}
+
+ProcfsArchive::~ProcfsArchive() { unmap(); }
+
+void ProcfsArchive::unmap() {
+  if (nullptr != base_) {
+    munmap(const_cast<char *>(base_), length_);
+  }
+  base_ = nullptr;
+  length_ = 0U;
+  entries_ = nullptr;
+  entry_count_ = 0U;
+}
+
+bool ProcfsArchive::open(const std::string &archive_path) {
+  unmap();
+  const int fd = ::open(archive_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    std::cerr << "Unable to open " << archive_path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct stat sb;
+  if ((0 != fstat(fd, &sb)) ||
+      (static_cast<size_t>(sb.st_size) < sizeof(archive_header))) {
+    std::cerr << archive_path << " is too short to be an archive."
+              << std::endl;
+    close(fd);
+    return false;
+  }
+  void *base = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == base) {
+    std::cerr << "Unable to map " << archive_path << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  base_ = static_cast<const char *>(base);
+  length_ = sb.st_size;
+
+  const archive_header *header =
+      reinterpret_cast<const archive_header *>(base_);
+  if ((0 != memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic))) ||
+      (ARCHIVE_VERSION != header->version) ||
+      (header->entry_count >
+       (length_ - sizeof(archive_header)) / sizeof(archive_entry))) {
+    std::cerr << archive_path << " is not a version " << ARCHIVE_VERSION
+              << " archive." << std::endl;
+    unmap();
+    return false;
+  }
+  entries_ =
+      reinterpret_cast<const archive_entry *>(base_ + sizeof(archive_header));
+  entry_count_ = header->entry_count;
+  // Check every entry once, so that the accessors need not.
+  for (size_t i = 0U; i < entry_count_; i++) {
+    const archive_entry &entry = entries_[i];
+    if ((entry.stat_offset > length_) ||
+        (entry.stat_size > length_ - entry.stat_offset) ||
+        (entry.status_offset > length_) ||
+        (entry.status_size > length_ - entry.status_offset)) {
+      std::cerr << "Entry " << i << " of " << archive_path
+                << " lies outside it." << std::endl;
+      unmap();
+      return false;
+    }
+  }
+  return true;
+}
+
+std::optional<std::string_view> ProcfsArchive::status(size_t i) const {
+  if (0U == entries_[i].status_size) {
+    return std::nullopt;
+  }
+  return std::string_view(base_ + entries_[i].status_offset,
+                          entries_[i].status_size);
+}
+
+void for_each_archived_task_stat(
+    const ProcfsArchive &archive, bool all_threads, const task_filter &filter,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor) {
+  for (size_t i = 0U; i < archive.size(); i++) {
+    if (!all_threads && (archive.tid(i) != archive.tgid(i))) {
+      continue;
+    }
+    const std::optional<stat_fields> fields =
+        parse_thread_stat(archive.stat(i));
+    if (!fields.has_value()) {
+      std::cerr << "Malformed stat file for thread " << archive.tid(i)
+                << std::endl;
+      continue;
+    }
+    if (filter.matches(fields.value()) &&
+        !visitor(archive.tid(i), fields.value())) {
+      return;
+    }
+  }
+}
+
+} // namespace process_affinity
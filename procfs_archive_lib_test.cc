@@ -0,0 +1,148 @@
+#include "procfs_archive.hh"
+#include "test_temp_dir.hh"
+
+#include <filesystem>
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace process_affinity {
+namespace local_testing {
+
+using tid_set_t = std::set<struct tid_data, decltype(tid_data_compare) *>;
+
+class ProcfsArchiveTest : public test_util::TempDirTest {
+protected:
+  void SetUp() override {
+    TempDirTest::SetUp();
+    archive_path = (dir / "archive").string();
+  }
+
+  // Replay archive into a set, as read_thread_data() would fill it.
+  tid_set_t replay(const ProcfsArchive &archive, bool all_threads) {
+    tid_set_t tset{tid_data_compare};
+    for_each_archived_task_stat(archive, all_threads, task_filter{},
+                                [&](pid_t tid, const stat_fields &fields) {
+                                  tset.emplace(tid, fields.is_settable(),
+                                               std::string(fields.thread_name));
+                                  return true;
+                                });
+    return tset;
+  }
+
+  std::string archive_path;
+};
+
+void expect_same(const tid_set_t &expected, const tid_set_t &actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  auto it1 = expected.cbegin();
+  auto it2 = actual.cbegin();
+  for (; it1 != expected.cend() && it2 != actual.cend(); it1++, it2++) {
+    EXPECT_EQ(it1->thread_name, it2->thread_name);
+    EXPECT_EQ(it1->tid, it2->tid);
+    EXPECT_EQ(it1->is_settable, it2->is_settable);
+  }
+}
+
+TEST_F(ProcfsArchiveTest, Replay) {
+  // The leaders 1, 14, 15 and 10851, and two threads each of 1422 and 140857.
+  ASSERT_EQ(8U, capture_procfs("procfs", true, archive_path).value());
+  ProcfsArchive archive;
+  ASSERT_TRUE(archive.open(archive_path));
+  ASSERT_EQ(8U, archive.size());
+  for (size_t i = 0U; i < archive.size(); i++) {
+    if (1430 == archive.tid(i)) {
+      EXPECT_EQ(1422, archive.tgid(i));
+      EXPECT_EQ("gmain",
+                parse_thread_stat(archive.stat(i)).value().thread_name);
+      EXPECT_EQ("3", parse_status_field(archive.status(i).value(),
+                                        "Cpus_allowed_list")
+                         .value());
+    }
+    if (1 == archive.tid(i)) {
+      EXPECT_FALSE(archive.status(i).has_value());
+    }
+  }
+
+  // /proc/1/stat is malformed.
+  tid_set_t expected{tid_data_compare};
+  testing::internal::CaptureStderr();
+  read_all_thread_data(expected, "procfs");
+  const tid_set_t all = replay(archive, true);
+  testing::internal::GetCapturedStderr();
+  expect_same(expected, all);
+
+  expected.clear();
+  testing::internal::CaptureStderr();
+  read_thread_data(expected, "procfs");
+  const tid_set_t leaders = replay(archive, false);
+  testing::internal::GetCapturedStderr();
+  expect_same(expected, leaders);
+
+  task_filter unpinnable{};
+  unpinnable.settable = false;
+  size_t visited = 0U;
+  testing::internal::CaptureStderr();
+  for_each_archived_task_stat(archive, true, unpinnable,
+                              [&](pid_t, const stat_fields &fields) {
+                                EXPECT_EQ("ksoftirqd/0", fields.thread_name);
+                                visited++;
+                                return true;
+                              });
+  testing::internal::GetCapturedStderr();
+  EXPECT_EQ(2U, visited);
+}
+
+TEST_F(ProcfsArchiveTest, Invalid) {
+  ProcfsArchive archive;
+  testing::internal::CaptureStderr();
+  EXPECT_FALSE(archive.open(archive_path));
+  EXPECT_FALSE(capture_procfs("procfs/nonexistent", false, archive_path));
+  std::ofstream(archive_path) << "PROCARCH";
+  EXPECT_FALSE(archive.open(archive_path));
+  testing::internal::GetCapturedStderr();
+
+  ASSERT_EQ(6U, capture_procfs("procfs", false, archive_path).value());
+  ASSERT_TRUE(archive.open(archive_path));
+  EXPECT_EQ(6U, archive.size());
+  // Truncating the archive leaves the last entry's files outside it.
+  std::filesystem::resize_file(archive_path,
+                               std::filesystem::file_size(archive_path) - 1U);
+  testing::internal::CaptureStderr();
+  EXPECT_FALSE(archive.open(archive_path));
+  EXPECT_NE(std::string::npos,
+            testing::internal::GetCapturedStderr().find("lies outside"));
+  EXPECT_EQ(0U, archive.size());
+}
+
+// On a machine with thousands of CPUs, a status file is far larger than
+// STATUS_BUF_SIZE.
+TEST_F(ProcfsArchiveTest, LargeStatus) {
+  std::string cpu_list{};
+  for (uint32_t cpu = 0U; cpu < 8192U; cpu += 2U) {
+    cpu_list += (cpu_list.empty() ? "" : ",") + std::to_string(cpu);
+  }
+  const std::string status = "Name:\tworker\nTgid:\t41\nPid:\t42\n"
+                             "Cpus_allowed_list:\t" +
+                             cpu_list + "\nnonvoluntary_ctxt_switches:\t7\n";
+  ASSERT_LT(2U * STATUS_BUF_SIZE, status.size());
+  const std::filesystem::path procfs = dir / "procfs";
+  std::filesystem::create_directories(procfs / "42");
+  std::ofstream(procfs / "42/stat")
+      << "42 (worker) S 1 41 41 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 1 0 100 "
+         "0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 17 3 0 0 0 0 0\n";
+  std::ofstream(procfs / "42/status") << status;
+
+  ASSERT_EQ(1U, capture_procfs(procfs.string(), false, archive_path).value());
+  ProcfsArchive archive;
+  ASSERT_TRUE(archive.open(archive_path));
+  ASSERT_EQ(1U, archive.size());
+  EXPECT_EQ(41, archive.tgid(0U));
+  EXPECT_EQ(status, archive.status(0U).value());
+  EXPECT_EQ("7", parse_status_field(archive.status(0U).value(),
+                                    "nonvoluntary_ctxt_switches")
+                     .value());
+}
+
+} // namespace local_testing
+} // namespace process_affinity
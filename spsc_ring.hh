@@ -0,0 +1,86 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+// A lock-free ring of 64-bit values from one producer thread to one consumer
+// thread, for measuring a handoff through memory alone against the kernel's
+// pipes and sockets.  The producer's and consumer's indices live on separate
+// cache lines, each next to that side's cached copy of the other's index, so
+// that in the common case each side reads and writes only its own line and the
+// slot.  How the consumer waits for an empty ring to fill is selectable:
+// spinning has the lowest latency but owns a CPU, a futex frees the CPU but
+// pays for a wakeup, and spinning briefly before sleeping is in between.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace timerlat_load {
+
+enum class ring_wait {
+  // Poll until a value arrives.
+  spin,
+  // Poll spin_limit times, then sleep in FUTEX_WAIT.
+  spin_futex,
+  // Sleep in FUTEX_WAIT as soon as the ring is empty.
+  block,
+};
+
+const char *ring_wait_name(ring_wait wait);
+
+// Pause briefly in a polling loop, and every 1024 calls yield, so that a
+// thread of the same priority on this CPU, perhaps the one being waited for,
+// can run.
+void cpu_relax(uint32_t &spins);
+
+class SpscRing {
+public:
+  // A power of two, so that indices map to slots with a mask.
+  static constexpr size_t SLOTS = 64U;
+  static constexpr uint32_t DEFAULT_SPIN_LIMIT = 10000U;
+
+  explicit SpscRing(ring_wait wait = ring_wait::spin_futex,
+                    uint32_t spin_limit = DEFAULT_SPIN_LIMIT)
+      : wait_(wait), spin_limit_(spin_limit) {}
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // Producer only.  Returns false if the ring is full.
+  bool try_push(uint64_t value);
+  // Producer only.  Waits for room if the ring is full.
+  void push(uint64_t value);
+  // Producer only.  Once the consumer has drained the ring, pop() returns
+  // std::nullopt.
+  void close();
+
+  // Consumer only.  Waits as wait() specifies for a value, and returns
+  // std::nullopt if the ring is empty and closed.
+  std::optional<uint64_t> pop();
+
+  ring_wait wait() const { return wait_; }
+
+private:
+  void wake_consumer();
+  // Sleep until the head moves past tail or the ring is closed.
+  void sleep_until_filled(uint64_t tail);
+
+  const ring_wait wait_;
+  const uint32_t spin_limit_;
+
+  // Written by the producer.
+  alignas(64) std::atomic<uint64_t> head_{0U};
+  uint64_t cached_tail_ = 0U;
+  // Written by the consumer.
+  alignas(64) std::atomic<uint64_t> tail_{0U};
+  uint64_t cached_head_ = 0U;
+  // The futex word, which the producer increments to wake the consumer, and
+  // whether the consumer may be asleep on it.
+  alignas(64) std::atomic<uint32_t> wake_seq_{0U};
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> closed_{false};
+  alignas(64) uint64_t slots_[SLOTS];
+};
+
+} // namespace timerlat_load
+
+#endif
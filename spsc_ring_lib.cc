@@ -0,0 +1,116 @@
+#include "spsc_ring.hh"
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace timerlat_load {
+
+namespace {
+
+constexpr const char *WAIT_NAMES[] = {"spin", "spin_futex", "block"};
+constexpr uint64_t SLOT_MASK = SpscRing::SLOTS - 1U;
+static_assert(0U == (SpscRing::SLOTS & SLOT_MASK),
+              "SLOTS must be a power of two.");
+
+long futex(std::atomic<uint32_t> *uaddr, int op, uint32_t val) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(uaddr), op, val,
+                 nullptr, nullptr, 0);
+}
+
+} // namespace
+
+const char *ring_wait_name(ring_wait wait) {
+  return WAIT_NAMES[static_cast<size_t>(wait)];
+}
+
+void cpu_relax(uint32_t &spins) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+  if (0U == (++spins % 1024U)) {
+    sched_yield();
+  }
+}
+
+bool SpscRing::try_push(uint64_t value) {
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (SLOTS == head - cached_tail_) {
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    if (SLOTS == head - cached_tail_) {
+      return false;
+    }
+  }
+  slots_[head & SLOT_MASK] = value;
+  if (ring_wait::spin == wait_) {
+    head_.store(head + 1U, std::memory_order_release);
+    return true;
+  }
+  // Sequentially consistent, so that either this thread sees that the
+  // consumer is going to sleep or the consumer sees the new head.
+  head_.store(head + 1U, std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_seq_cst)) {
+    wake_consumer();
+  }
+  return true;
+}
+
+void SpscRing::push(uint64_t value) {
+  uint32_t spins = 0U;
+  while (!try_push(value)) {
+    cpu_relax(spins);
+  }
+}
+
+void SpscRing::close() {
+  closed_.store(true, std::memory_order_seq_cst);
+  wake_consumer();
+}
+
+void SpscRing::wake_consumer() {
+  wake_seq_.fetch_add(1U, std::memory_order_release);
+  futex(&wake_seq_, FUTEX_WAKE_PRIVATE, 1U);
+}
+
+void SpscRing::sleep_until_filled(uint64_t tail) {
+  const uint32_t seq = wake_seq_.load(std::memory_order_acquire);
+  sleeping_.store(true, std::memory_order_seq_cst);
+  // If the producer pushes or closes after these checks, it sees sleeping_
+  // and changes wake_seq_, so FUTEX_WAIT returns at once.
+  if ((tail == head_.load(std::memory_order_seq_cst)) &&
+      !closed_.load(std::memory_order_seq_cst)) {
+    futex(&wake_seq_, FUTEX_WAIT_PRIVATE, seq);
+  }
+  sleeping_.store(false, std::memory_order_relaxed);
+}
+
+std::optional<uint64_t> SpscRing::pop() {
+  const uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (cached_head_ == tail) {
+    cached_head_ = head_.load(std::memory_order_acquire);
+    uint32_t spins = 0U;
+    while (cached_head_ == tail) {
+      if (closed_.load(std::memory_order_acquire)) {
+        // Values pushed before close() are still delivered.
+        cached_head_ = head_.load(std::memory_order_acquire);
+        if (cached_head_ == tail) {
+          return std::nullopt;
+        }
+        break;
+      }
+      if ((ring_wait::spin == wait_) ||
+          ((ring_wait::spin_futex == wait_) && (spins < spin_limit_))) {
+        cpu_relax(spins);
+      } else {
+        sleep_until_filled(tail);
+      }
+      cached_head_ = head_.load(std::memory_order_acquire);
+    }
+  }
+  const uint64_t value = slots_[tail & SLOT_MASK];
+  tail_.store(tail + 1U, std::memory_order_release);
+  return value;
+}
+
+} // namespace timerlat_load
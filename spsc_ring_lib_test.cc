@@ -0,0 +1,66 @@
+#include "spsc_ring.hh"
+
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+struct SpscRingTest : public testing::TestWithParam<ring_wait> {};
+
+TEST_P(SpscRingTest, FillAndDrain) {
+  SpscRing ring(GetParam());
+  EXPECT_EQ(GetParam(), ring.wait());
+  for (uint64_t value = 0U; value < SpscRing::SLOTS; value++) {
+    ASSERT_TRUE(ring.try_push(value));
+  }
+  EXPECT_FALSE(ring.try_push(SpscRing::SLOTS));
+  EXPECT_EQ(0U, ring.pop());
+  // Popping one makes room for one.
+  EXPECT_TRUE(ring.try_push(SpscRing::SLOTS));
+  EXPECT_FALSE(ring.try_push(SpscRing::SLOTS + 1U));
+  ring.close();
+  // Values pushed before closing are still delivered.
+  for (uint64_t value = 1U; value <= SpscRing::SLOTS; value++) {
+    ASSERT_EQ(value, ring.pop());
+  }
+  EXPECT_FALSE(ring.pop().has_value());
+}
+
+// Enough values to wrap the ring many times and to catch the consumer both
+// polling and asleep.
+TEST_P(SpscRingTest, Threads) {
+  constexpr uint64_t COUNT = 100000U;
+  auto ring = std::make_unique<SpscRing>(GetParam(), 100U);
+  std::thread producer([&ring]() {
+    for (uint64_t value = 0U; value < COUNT; value++) {
+      ring->push(value);
+      if (0U == (value % 10000U)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    ring->close();
+  });
+  uint64_t expected = 0U;
+  for (std::optional<uint64_t> value = ring->pop(); value.has_value();
+       value = ring->pop()) {
+    ASSERT_EQ(expected, value.value());
+    expected++;
+  }
+  producer.join();
+  EXPECT_EQ(COUNT, expected);
+}
+
+std::string wait_name(const testing::TestParamInfo<ring_wait> &info) {
+  return ring_wait_name(info.param);
+}
+INSTANTIATE_TEST_SUITE_P(AllWaits, SpscRingTest,
+                         testing::Values(ring_wait::spin,
+                                         ring_wait::spin_futex,
+                                         ring_wait::block),
+                         wait_name);
+
+} // namespace local_testing
+} // namespace timerlat_load
@@ -0,0 +1,86 @@
+#ifndef STAT_URING_H
+#define STAT_URING_H
+
+// Batched reads of procfs stat files with io_uring, for the classifier in
+// classify_process_affinity.hh.  Reading a stat file synchronously costs an
+// openat(), a read() and a close() per task.  StatUring instead queues a
+// linked openat, read and close for each of many files and submits and reaps
+// them with a single io_uring_enter() per batch.  liburing is not required: the
+// ring is set up with the raw system calls.
+
+#include "classify_process_affinity.hh"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace process_affinity {
+
+class StatUring {
+public:
+  // Keep up to depth files in flight, each with its own stat_buf_t.  If
+  // io_uring is unavailable, because the kernel is older than 5.17, or
+  // because /proc/sys/kernel/io_uring_disabled or a seccomp filter forbids it,
+  // available() is false and read_files() falls back to synchronous reads.
+  explicit StatUring(unsigned int depth = 64U);
+  ~StatUring();
+  StatUring(const StatUring &) = delete;
+  StatUring &operator=(const StatUring &) = delete;
+
+  bool available() const { return -1 != ring_fd_; }
+  // Read count files, whose paths relative to dirfd path(i) returns, calling
+  // done(i, contents) as each read completes, in no particular order.
+  // contents is std::nullopt for a file which could not be opened or read, as
+  // when a task has exited, and is valid only during the call.  If done()
+  // returns false, no further files are read.
+  void read_files(
+      int dirfd, size_t count, const std::function<const char *(size_t)> &path,
+      const std::function<bool(size_t, std::optional<std::string_view>)>
+          &done);
+  // The number of io_uring_enter() calls which read_files() has made.
+  uint64_t enter_calls() const { return enter_calls_; }
+
+private:
+  bool setup(unsigned int entries);
+  void teardown();
+  io_uring_sqe *next_sqe();
+  bool enter(unsigned int to_submit);
+
+  int ring_fd_ = -1;
+  unsigned int depth_;
+  void *sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0U;
+  void *cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0U;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0U;
+  unsigned int *sq_tail_ = nullptr;
+  unsigned int *sq_mask_ = nullptr;
+  unsigned int *sq_array_ = nullptr;
+  // Entries are filled in past the shared tail, which enter() then advances.
+  unsigned int sq_local_tail_ = 0U;
+  unsigned int *cq_head_ = nullptr;
+  unsigned int *cq_tail_ = nullptr;
+  unsigned int *cq_mask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  // One buffer and one registered file slot per file in flight.
+  std::vector<stat_buf_t> bufs_{};
+  uint64_t enter_calls_ = 0U;
+};
+
+// Like for_each_task_stat(), but list every task first and then read the stat
+// files in batches with ring.  Tasks are visited in completion order rather
+// than directory order.
+bool for_each_task_stat_uring(
+    const std::string &procfs_top, bool all_threads, StatUring &ring,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor);
+
+} // namespace process_affinity
+
+#endif
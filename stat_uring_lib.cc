@@ -0,0 +1,277 @@
+#include "stat_uring.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace process_affinity {
+
+namespace {
+
+// The operation of a completion is stored in the low bits of its user_data
+// and the file slot in the rest.
+enum uring_op : uint64_t { OP_OPEN = 0U, OP_READ = 1U, OP_CLOSE = 2U };
+constexpr uint64_t OP_BITS = 2U;
+constexpr uint64_t OP_MASK = (1U << OP_BITS) - 1U;
+// Each file needs a linked openat, read and close.
+constexpr unsigned int SQES_PER_FILE = 3U;
+
+uint64_t user_data(unsigned int slot, uring_op op) {
+  return (static_cast<uint64_t>(slot) << OP_BITS) | op;
+}
+
+template <typename T> T *ring_field(void *ring, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+} // namespace
+
+StatUring::StatUring(unsigned int depth) : depth_(depth ? depth : 1U) {
+  if (!setup(SQES_PER_FILE * depth_)) {
+    teardown();
+  }
+}
+
+StatUring::~StatUring() { teardown(); }
+
+bool StatUring::setup(unsigned int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+  if (-1 == ring_fd_) {
+    return false;
+  }
+  // Opening into a registered file slot arrived in 5.15 and cannot be probed
+  // for, so require a feature from the slightly later 5.17 instead.
+  if (!(params.features & IORING_FEAT_CQE_SKIP)) {
+    return false;
+  }
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (MAP_FAILED == sq_ring_) {
+    sq_ring_ = nullptr;
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (MAP_FAILED == cq_ring_) {
+      cq_ring_ = nullptr;
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (MAP_FAILED == sqes) {
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+  sq_tail_ = ring_field<unsigned int>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = ring_field<unsigned int>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = ring_field<unsigned int>(sq_ring_, params.sq_off.array);
+  cq_head_ = ring_field<unsigned int>(cq_ring_, params.cq_off.head);
+  cq_tail_ = ring_field<unsigned int>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = ring_field<unsigned int>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = ring_field<struct io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+  sq_local_tail_ = *sq_tail_;
+
+  // A sparse table of file slots which openat fills and close empties, so
+  // that the read can be linked to an open whose descriptor is not yet known.
+  std::vector<int> slots(depth_, -1);
+  if (0 > syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES,
+                  slots.data(), depth_)) {
+    return false;
+  }
+  bufs_.resize(depth_);
+  return true;
+}
+
+void StatUring::teardown() {
+  if (nullptr != sqes_) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if ((nullptr != cq_ring_) && (cq_ring_ != sq_ring_)) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = nullptr;
+  if (nullptr != sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+  }
+  if (-1 != ring_fd_) {
+    close(ring_fd_);
+    ring_fd_ = -1;
+  }
+  bufs_.clear();
+}
+
+// The caller ensures that the ring has room, since at most SQES_PER_FILE *
+// depth_ entries are queued between submissions.
+io_uring_sqe *StatUring::next_sqe() {
+  const unsigned int index = sq_local_tail_++ & *sq_mask_;
+  struct io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  return sqe;
+}
+
+// Submit to_submit entries and wait for at least one completion.
+bool StatUring::enter(unsigned int to_submit) {
+  // The kernel reads the new entries only after the tail moves past them.
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  while (true) {
+    enter_calls_++;
+    const long submitted = syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                                   1U, IORING_ENTER_GETEVENTS, nullptr, 0U);
+    if (0 > submitted) {
+      if (EINTR == errno) {
+        continue;
+      }
+      std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+    if (static_cast<unsigned long>(submitted) >= to_submit) {
+      return true;
+    }
+    to_submit -= submitted;
+  }
+}
+
+void StatUring::read_files(
+    int dirfd, size_t count, const std::function<const char *(size_t)> &path,
+    const std::function<bool(size_t, std::optional<std::string_view>)>
+        &done) {
+  if (!available()) {
+    stat_buf_t buf;
+    for (size_t i = 0U; i < count; i++) {
+      if (!done(i, read_thread_stat(path(i), buf, dirfd))) {
+        return;
+      }
+    }
+    return;
+  }
+
+  // The file each slot is reading, and how many of its completions have yet
+  // to arrive.  Every operation posts one, even if it is cancelled because the
+  // open failed.  Skipping the completion of a successful open would save
+  // little, and a failed open then suppresses the other two completions, so
+  // the count would not be fixed.
+  std::vector<size_t> slot_file(depth_);
+  std::vector<unsigned int> slot_pending(depth_);
+  std::vector<unsigned int> free_slots{};
+  for (unsigned int slot = depth_; slot > 0U; slot--) {
+    free_slots.push_back(slot - 1U);
+  }
+  size_t next = 0U;
+  bool stopped = false;
+  while ((!stopped && (next < count)) || (free_slots.size() < depth_)) {
+    unsigned int to_submit = 0U;
+    while (!stopped && (next < count) && !free_slots.empty()) {
+      const unsigned int slot = free_slots.back();
+      free_slots.pop_back();
+      slot_file[slot] = next;
+      slot_pending[slot] = SQES_PER_FILE;
+
+      // O_CLOEXEC is not allowed for registered files.
+      struct io_uring_sqe *sqe = next_sqe();
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = dirfd;
+      sqe->addr = reinterpret_cast<uintptr_t>(path(next));
+      sqe->open_flags = O_RDONLY;
+      sqe->file_index = slot + 1U;
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = user_data(slot, OP_OPEN);
+
+      // A hard link, because the read of a stat file is always short, which
+      // would otherwise cancel the close.
+      sqe = next_sqe();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = slot;
+      sqe->addr = reinterpret_cast<uintptr_t>(bufs_[slot].data());
+      sqe->len = bufs_[slot].size();
+      sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+      sqe->user_data = user_data(slot, OP_READ);
+
+      sqe = next_sqe();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->file_index = slot + 1U;
+      sqe->user_data = user_data(slot, OP_CLOSE);
+
+      to_submit += SQES_PER_FILE;
+      next++;
+    }
+    if (!enter(to_submit)) {
+      // Completions may still arrive, so keep the buffers until teardown.
+      return;
+    }
+
+    unsigned int head = *cq_head_;
+    const unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+      const unsigned int slot = cqe.user_data >> OP_BITS;
+      // If the open failed, the read was cancelled.
+      if ((OP_READ == (cqe.user_data & OP_MASK)) && !stopped) {
+        std::optional<std::string_view> contents{};
+        if (0 < cqe.res) {
+          contents = std::string_view(bufs_[slot].data(), cqe.res);
+        }
+        stopped = !done(slot_file[slot], contents);
+      }
+      // The slot may be reused only once the read is delivered and the
+      // registered file is closed.
+      if (0U == --slot_pending[slot]) {
+        free_slots.push_back(slot);
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+}
+
+bool for_each_task_stat_uring(
+    const std::string &procfs_top, bool all_threads, StatUring &ring,
+    const std::function<bool(pid_t, const stat_fields &)> &visitor) {
+  TaskPaths paths;
+  if (!list_task_stat_paths(procfs_top, all_threads, paths)) {
+    return false;
+  }
+  const int proc_fd =
+      open(procfs_top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == proc_fd) {
+    std::cerr << "Unable to open " << procfs_top << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  ring.read_files(
+      proc_fd, paths.size(), [&](size_t i) { return paths.path(i); },
+      [&](size_t i, std::optional<std::string_view> contents) {
+        if (!contents.has_value()) {
+          return true;
+        }
+        const std::optional<stat_fields> fields =
+            parse_thread_stat(contents.value());
+        return !fields.has_value() || visitor(paths.tid(i), fields.value());
+      });
+  close(proc_fd);
+  return true;
+}
+
+} // namespace process_affinity
@@ -0,0 +1,84 @@
+#include "stat_uring.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <map>
+
+#include "gtest/gtest.h"
+
+namespace process_affinity {
+namespace local_testing {
+
+// The depth is the number of files in flight, so that 1 forces every slot to
+// be reused.
+class StatUringTest : public ::testing::TestWithParam<unsigned int> {};
+
+TEST_P(StatUringTest, ReadFiles) {
+  StatUring ring(GetParam());
+  const int proc_fd = open("procfs", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  ASSERT_NE(-1, proc_fd);
+  const std::vector<const char *> paths = {"14/stat", "nonexistent/stat",
+                                           "1422/task/1430/stat", "15/stat"};
+  std::map<size_t, std::string> contents{};
+  std::vector<size_t> missing{};
+  ring.read_files(
+      proc_fd, paths.size(), [&](size_t i) { return paths[i]; },
+      [&](size_t i, std::optional<std::string_view> stat) {
+        if (stat.has_value()) {
+          EXPECT_TRUE(contents.emplace(i, std::string(stat.value())).second);
+        } else {
+          missing.push_back(i);
+        }
+        return true;
+      });
+  ASSERT_EQ(3U, contents.size());
+  EXPECT_EQ(0U, contents[0].find("14 (ksoftirqd/0) S 2"));
+  EXPECT_EQ(0U, contents[2].find("1430 (gmain) S"));
+  EXPECT_EQ(0U, contents[3].find("15 (ksoftirqd/0) S 2"));
+  ASSERT_EQ(1U, missing.size());
+  EXPECT_EQ(1U, missing[0]);
+  if (ring.available()) {
+    EXPECT_LE(1U, ring.enter_calls());
+  }
+
+  // Returning false stops the reads, though files already in flight finish.
+  size_t delivered = 0U;
+  ring.read_files(
+      proc_fd, paths.size(), [&](size_t i) { return paths[i]; },
+      [&](size_t, std::optional<std::string_view>) {
+        delivered++;
+        return false;
+      });
+  EXPECT_EQ(1U, delivered);
+  close(proc_fd);
+}
+
+TEST_P(StatUringTest, ForEachTaskStatUring) {
+  StatUring ring(GetParam());
+  std::map<pid_t, std::string> expected{};
+  ASSERT_TRUE(for_each_task_stat(
+      "procfs", true, [&](pid_t tid, const stat_fields &fields) {
+        expected.emplace(tid, std::string(fields.thread_name));
+        return true;
+      }));
+  std::map<pid_t, std::string> seen{};
+  ASSERT_TRUE(for_each_task_stat_uring(
+      "procfs", true, ring, [&](pid_t tid, const stat_fields &fields) {
+        EXPECT_TRUE(seen.emplace(tid, std::string(fields.thread_name)).second);
+        return true;
+      }));
+  EXPECT_EQ(expected, seen);
+
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(for_each_task_stat_uring(
+      "procfs/nonexistent", false, ring,
+      [](pid_t, const stat_fields &) { return true; }));
+  ::testing::internal::GetCapturedStderr();
+}
+
+INSTANTIATE_TEST_SUITE_P(Depths, StatUringTest,
+                         ::testing::Values(1U, 2U, 64U));
+
+} // namespace local_testing
+} // namespace process_affinity
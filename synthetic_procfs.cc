@@ -0,0 +1,51 @@
+// Write a synthetic procfs tree for benchmarking classify_process_affinity.
+
+#include "synthetic_procfs.hh"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace process_affinity;
+namespace fs = std::filesystem;
+
+void usage(const char *prog) {
+  cerr << prog << " DIRECTORY TASKS [CPUS] [SEED]" << endl;
+  cerr << "DIRECTORY must not exist." << endl;
+}
+
+int main(int argc, char **argv) {
+  if ((3 > argc) || (5 < argc)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  const fs::path top{argv[1]};
+  synthetic_procfs_options options{};
+  options.tasks = strtoul(argv[2], nullptr, 10);
+  if (3 < argc) {
+    options.cpus = strtoul(argv[3], nullptr, 10);
+  }
+  if (4 < argc) {
+    options.seed = strtoul(argv[4], nullptr, 10);
+  }
+  if ((0U == options.tasks) || (0U == options.cpus)) {
+    cerr << "TASKS and CPUS must be positive." << endl;
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  error_code ec;
+  if (!fs::create_directory(top, ec)) {
+    cerr << "Unable to create " << top.string() << endl;
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  optional<synthetic_procfs_summary> summary =
+      make_synthetic_procfs(top, options);
+  if (!summary.has_value()) {
+    exit(EXIT_FAILURE);
+  }
+  cout << summary->processes << " processes, " << summary->threads
+       << " threads, " << summary->kthreads << " kthreads, "
+       << summary->unpinnable << " unpinnable" << endl;
+  exit(EXIT_SUCCESS);
+}
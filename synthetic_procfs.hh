@@ -0,0 +1,73 @@
+#ifndef SYNTHETIC_PROCFS_H
+#define SYNTHETIC_PROCFS_H
+
+// Generate procfs-like directory trees of arbitrary size for benchmarking and
+// testing the classifier in classify_process_affinity.hh.  The seven files in
+// procfs/ are too few to measure anything.
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace process_affinity {
+
+struct synthetic_procfs_options {
+  // Total number of threads, including thread-group leaders and kthreads.
+  size_t tasks = 1000U;
+  // Per-CPU kthreads are named for and run on one of this many CPUs.
+  uint32_t cpus = 8U;
+  // Fraction of tasks which are kernel threads.  About half of those are
+  // per-CPU threads whose affinity is not settable.
+  double kthread_fraction = 0.2;
+  // User processes have between 1 and this many threads.
+  uint32_t max_threads_per_process = 16U;
+  // Fraction of user threads which get a name containing ')', '(' or spaces.
+  double nasty_name_fraction = 0.05;
+  // Fraction of user threads whose affinity is limited to a single CPU, as if
+  // by taskset.
+  double bound_fraction = 0.05;
+  uint32_t seed = 1U;
+};
+
+// What make_synthetic_procfs() created, so that callers can check results.
+struct synthetic_procfs_summary {
+  // Directories in the top level, one per thread-group leader.
+  size_t processes = 0U;
+  // All threads, each of which has a task/<tid>/stat file.
+  size_t threads = 0U;
+  size_t kthreads = 0U;
+  // Threads with PF_NO_SETAFFINITY set.
+  size_t unpinnable = 0U;
+  // Unpinnable thread-group leaders.
+  size_t unpinnable_processes = 0U;
+  // Pinnable threads whose Cpus_allowed_list is a single CPU.
+  size_t bound = 0U;
+};
+
+// Format a stat line like fs/proc/array.c does.
+std::string synthetic_stat_line(pid_t pid, const std::string &name, char state,
+                                pid_t ppid, uint32_t flags, int32_t num_threads,
+                                uint64_t starttime, int32_t processor);
+
+// Format a status file like fs/proc/array.c does, with the fields which the
+// tools in this directory read.  cpus must be sorted.
+std::string synthetic_status_file(pid_t tgid, pid_t tid,
+                                  const std::string &name, char state,
+                                  pid_t ppid, int32_t num_threads,
+                                  const std::vector<uint32_t> &cpus,
+                                  uint64_t nvcsw, uint64_t nivcsw);
+
+// Populate the existing directory top with <pid>/stat and <pid>/status for
+// every thread-group leader and <pid>/task/<tid>/stat and status for every
+// thread, like /proc.  Returns std::nullopt if a file cannot be written.
+std::optional<synthetic_procfs_summary>
+make_synthetic_procfs(const std::filesystem::path &top,
+                      const synthetic_procfs_options &options);
+
+} // namespace process_affinity
+
+#endif
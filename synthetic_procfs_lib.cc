@@ -0,0 +1,238 @@
+#include "synthetic_procfs.hh"
+#include "cpulist.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace process_affinity {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Flags copied from real tasks.  Per-CPU kthreads like ksoftirqd/0 have
+// PF_NO_SETAFFINITY, PF_KTHREAD and PF_NOFREEZE.  Unbound kthreads like
+// irq/93-aerdrv lack PF_NO_SETAFFINITY.  User tasks have PF_RANDOMIZE and
+// PF_FORKNOEXEC.
+constexpr uint32_t PERCPU_KTHREAD_FLAGS = 0x04208040U;
+constexpr uint32_t UNBOUND_KTHREAD_FLAGS = 0x00208040U;
+constexpr uint32_t USER_FLAGS = 0x00400100U;
+// TASK_COMM_LEN - 1.  Kthread names may be longer.
+constexpr size_t MAX_USER_NAME = 15U;
+
+const std::vector<std::string> PROCESS_NAMES = {
+    "bash", "sshd", "systemd-journal", "php-fpm", "java", "chrome", "postgres"};
+const std::vector<std::string> THREAD_NAMES = {"gmain", "gdbus", "DOM Worker",
+                                               "java-gc", "worker"};
+// Names which have broken parsers, because they hate us.
+const std::vector<std::string> NASTY_NAMES = {
+    "foo) (bar)", "(sd-pam)",  "a) b", "))", "Isolated Web Co",
+    ") (",        "x (y) z"};
+
+bool write_file(const fs::path &path, const std::string &contents) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (-1 == fd) {
+    std::cerr << "Unable to create " << path.string() << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  const ssize_t written = write(fd, contents.data(), contents.size());
+  close(fd);
+  return static_cast<ssize_t>(contents.size()) == written;
+}
+
+template <typename T>
+const T &pick(const std::vector<T> &v, std::mt19937 &rng) {
+  return v[rng() % v.size()];
+}
+
+// Cpus_allowed is a hexadecimal mask in comma-separated 32-bit words, most
+// significant first.
+std::string cpu_mask(const std::vector<uint32_t> &cpus) {
+  const uint32_t words = cpus.empty() ? 1U : (cpus.back() / 32U) + 1U;
+  std::vector<uint32_t> mask(words, 0U);
+  for (const uint32_t cpu : cpus) {
+    mask[cpu / 32U] |= 1U << (cpu % 32U);
+  }
+  std::ostringstream out;
+  out << std::hex;
+  for (uint32_t word = words; word > 0U; word--) {
+    if (word < words) {
+      out << ',' << std::setw(8) << std::setfill('0');
+    }
+    out << mask[word - 1U];
+  }
+  return out.str();
+}
+
+} // namespace
+
+std::string synthetic_status_file(pid_t tgid, pid_t tid,
+                                  const std::string &name, char state,
+                                  pid_t ppid, int32_t num_threads,
+                                  const std::vector<uint32_t> &cpus,
+                                  uint64_t nvcsw, uint64_t nivcsw) {
+  std::ostringstream status;
+  status << "Name:\t" << name << "\nUmask:\t0022\nState:\t" << state
+         << (('R' == state) ? " (running)" : " (sleeping)") << "\nTgid:\t"
+         << tgid << "\nNgid:\t0\nPid:\t" << tid << "\nPPid:\t" << ppid
+         << "\nTracerPid:\t0\nUid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\n"
+         << "FDSize:\t64\nGroups:\t\nThreads:\t" << num_threads
+         << "\nSigQ:\t0/63429\nSigPnd:\t0000000000000000\n"
+         << "ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\n"
+         << "SigIgn:\t0000000000000000\nSigCgt:\t0000000000000000\n"
+         << "CapInh:\t0000000000000000\nCapPrm:\t000001ffffffffff\n"
+         << "CapEff:\t000001ffffffffff\nCapBnd:\t000001ffffffffff\n"
+         << "CapAmb:\t0000000000000000\nNoNewPrivs:\t0\nSeccomp:\t0\n"
+         << "Seccomp_filters:\t0\nSpeculation_Store_Bypass:\tthread "
+            "vulnerable\nCpus_allowed:\t"
+         << cpu_mask(cpus)
+         << "\nCpus_allowed_list:\t" << cpulist::format_cpulist(cpus)
+         << "\nMems_allowed:\t00000001\nMems_allowed_list:\t0\n"
+         << "voluntary_ctxt_switches:\t" << nvcsw
+         << "\nnonvoluntary_ctxt_switches:\t" << nivcsw << "\n";
+  return status.str();
+}
+
+std::string synthetic_stat_line(pid_t pid, const std::string &name, char state,
+                                pid_t ppid, uint32_t flags, int32_t num_threads,
+                                uint64_t starttime, int32_t processor) {
+  std::ostringstream line;
+  line << pid << " (" << name << ") " << state << " " << ppid << " " << pid
+       << " " << pid << " 0 -1 " << flags << " 0 0 0 0 0 0 0 0 20 0 "
+       << num_threads << " 0 " << starttime
+       << " 0 0 18446744073709551615 0 0 0 0 0 0 0 2147483647 0 0 0 0 17 "
+       << processor << " 0 0 0 0 0 0 0 0 0 0 0 0 0\n";
+  return line.str();
+}
+
+std::optional<synthetic_procfs_summary>
+make_synthetic_procfs(const fs::path &top,
+                      const synthetic_procfs_options &options) {
+  synthetic_procfs_summary summary{};
+  std::mt19937 rng(options.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const uint32_t cpus = options.cpus ? options.cpus : 1U;
+  const uint32_t max_threads =
+      options.max_threads_per_process ? options.max_threads_per_process : 1U;
+  pid_t next_pid = 1;
+  uint64_t starttime = 1U;
+  // Status files draw from their own generator so that the stat files are the
+  // same as before status files existed.
+  std::mt19937 status_rng(options.seed + 1U);
+  std::vector<uint32_t> all_cpus(cpus);
+  for (uint32_t cpu = 0U; cpu < cpus; cpu++) {
+    all_cpus[cpu] = cpu;
+  }
+
+  while (summary.threads < options.tasks) {
+    const pid_t pid = next_pid;
+    const fs::path pid_dir = top / std::to_string(pid);
+    std::error_code ec;
+    fs::create_directories(pid_dir / "task", ec);
+    if (ec) {
+      std::cerr << "Unable to create " << pid_dir.string() << ": "
+                << ec.message() << std::endl;
+      return std::nullopt;
+    }
+
+    if (uniform(rng) < options.kthread_fraction) {
+      const bool per_cpu = (0U == (rng() % 2U));
+      const uint32_t cpu = rng() % cpus;
+      std::string name{};
+      if (per_cpu) {
+        switch (rng() % 4U) {
+        case 0U:
+          name = "ksoftirqd/" + std::to_string(cpu);
+          break;
+        case 1U:
+          name = "migration/" + std::to_string(cpu);
+          break;
+        case 2U:
+          name = "cpuhp/" + std::to_string(cpu);
+          break;
+        default:
+          name = "kworker/" + std::to_string(cpu) + ":" +
+                 std::to_string(rng() % 8U) + "H-kblockd";
+        }
+      } else if (rng() % 2U) {
+        name = "kworker/u" + std::to_string(2U * cpus) + ":" +
+               std::to_string(rng() % 64U) + "-events_unbound";
+      } else {
+        name = "irq/" + std::to_string(rng() % 200U) + "-nvme0q" +
+               std::to_string(cpu);
+      }
+      const std::string line = synthetic_stat_line(
+          pid, name, 'S', 2,
+          per_cpu ? PERCPU_KTHREAD_FLAGS : UNBOUND_KTHREAD_FLAGS, 1,
+          starttime++, cpu);
+      const std::string status = synthetic_status_file(
+          pid, pid, name, 'S', 2, 1,
+          per_cpu ? std::vector<uint32_t>{cpu} : all_cpus,
+          status_rng() % 100000U, status_rng() % 100U);
+      const fs::path task_dir = pid_dir / "task" / std::to_string(pid);
+      fs::create_directory(task_dir, ec);
+      if (ec || !write_file(pid_dir / "stat", line) ||
+          !write_file(task_dir / "stat", line) ||
+          !write_file(pid_dir / "status", status) ||
+          !write_file(task_dir / "status", status)) {
+        return std::nullopt;
+      }
+      summary.processes++;
+      summary.threads++;
+      summary.kthreads++;
+      if (per_cpu) {
+        summary.unpinnable++;
+        summary.unpinnable_processes++;
+      }
+      next_pid++;
+      continue;
+    }
+
+    const int32_t threads = std::min<size_t>(1U + (rng() % max_threads),
+                                             options.tasks - summary.threads);
+    for (int32_t i = 0; i < threads; i++) {
+      const pid_t tid = pid + i;
+      std::string name = (0 == i) ? pick(PROCESS_NAMES, rng)
+                                  : pick(THREAD_NAMES, rng) + "-" +
+                                        std::to_string(rng() % 100U);
+      if (uniform(rng) < options.nasty_name_fraction) {
+        name = pick(NASTY_NAMES, rng);
+      }
+      name.resize(std::min(name.size(), MAX_USER_NAME));
+      const char state = (rng() % 8U) ? 'S' : 'R';
+      const uint32_t processor = rng() % cpus;
+      const std::string line = synthetic_stat_line(
+          tid, name, state, 1, USER_FLAGS, threads, starttime++, processor);
+      // A bound thread last ran on its only allowed CPU.
+      const bool bound = (uniform(status_rng) < options.bound_fraction);
+      const std::string status = synthetic_status_file(
+          pid, tid, name, state, 1, threads,
+          bound ? std::vector<uint32_t>{processor} : all_cpus,
+          status_rng() % 100000U, status_rng() % 1000U);
+      summary.bound += bound;
+      const fs::path task_dir = pid_dir / "task" / std::to_string(tid);
+      fs::create_directory(task_dir, ec);
+      if (ec || !write_file(task_dir / "stat", line) ||
+          !write_file(task_dir / "status", status) ||
+          ((0 == i) && (!write_file(pid_dir / "stat", line) ||
+                        !write_file(pid_dir / "status", status)))) {
+        return std::nullopt;
+      }
+    }
+    summary.processes++;
+    summary.threads += threads;
+    next_pid += threads;
+  }
+  return summary;
+}
+
+} // namespace process_affinity
@@ -0,0 +1,103 @@
+#include "classify_process_affinity.hh"
+#include "synthetic_procfs.hh"
+#include "test_temp_dir.hh"
+
+#include "gtest/gtest.h"
+
+namespace process_affinity {
+namespace local_testing {
+
+using SyntheticProcfsTest = test_util::TempDirTest;
+
+TEST(SyntheticStatLineTest, Parses) {
+  const std::string line =
+      synthetic_stat_line(42, "foo) (bar)", 'R', 1, 69238848U, 3, 1234U, 5);
+  std::optional<stat_fields> fields = parse_thread_stat(line);
+  ASSERT_TRUE(fields.has_value());
+  EXPECT_EQ(42, fields->tid);
+  EXPECT_EQ("foo) (bar)", fields->thread_name);
+  EXPECT_EQ(69238848U, fields->flags);
+  EXPECT_EQ(1234U, fields->starttime);
+
+  StatSnapshot snapshot;
+  ASSERT_TRUE(snapshot.add(line));
+  EXPECT_EQ('R', snapshot.state[0]);
+  EXPECT_EQ(3, snapshot.num_threads[0]);
+  EXPECT_EQ(5, snapshot.processor[0]);
+  EXPECT_EQ(0, snapshot.exit_code[0]);
+}
+
+TEST(SyntheticStatusFileTest, Parses) {
+  const std::string status =
+      synthetic_status_file(40, 42, "foo", 'S', 1, 3, {1U, 2U, 3U, 33U}, 5, 6);
+  EXPECT_EQ("foo", parse_status_field(status, "Name").value());
+  EXPECT_EQ("40", parse_status_field(status, "Tgid").value());
+  EXPECT_EQ("42", parse_status_field(status, "Pid").value());
+  EXPECT_EQ("2,0000000e", parse_status_field(status, "Cpus_allowed").value());
+  EXPECT_EQ("1-3,33", parse_status_field(status, "Cpus_allowed_list").value());
+  EXPECT_EQ("5",
+            parse_status_field(status, "voluntary_ctxt_switches").value());
+  EXPECT_EQ("6",
+            parse_status_field(status, "nonvoluntary_ctxt_switches").value());
+}
+
+TEST_F(SyntheticProcfsTest, Classify) {
+  synthetic_procfs_options options{};
+  options.tasks = 500U;
+  options.nasty_name_fraction = 0.5;
+  std::optional<synthetic_procfs_summary> summary =
+      make_synthetic_procfs(dir, options);
+  ASSERT_TRUE(summary.has_value());
+  EXPECT_EQ(500U, summary->threads);
+  EXPECT_LT(summary->processes, summary->threads);
+  EXPECT_LT(0U, summary->kthreads);
+  EXPECT_LT(0U, summary->unpinnable);
+
+  TaskTable leaders;
+  read_task_table(leaders, dir);
+  EXPECT_EQ(summary->processes, leaders.size());
+  size_t unpinnable = 0U;
+  for (size_t row = 0U; row < leaders.size(); row++) {
+    unpinnable += !leaders.is_settable(row);
+  }
+  EXPECT_EQ(summary->unpinnable_processes, unpinnable);
+
+  TaskTable threads;
+  read_task_table(threads, dir, true);
+  EXPECT_EQ(summary->threads, threads.size());
+  EXPECT_FALSE(threads.find_name("foo) (bar)").empty());
+
+  StatSnapshot snapshot;
+  read_stat_snapshot(snapshot, dir, true);
+  EXPECT_EQ(summary->threads, snapshot.size());
+}
+
+TEST_F(SyntheticProcfsTest, Deterministic) {
+  synthetic_procfs_options options{};
+  options.tasks = 100U;
+  const std::filesystem::path first = dir / "first";
+  const std::filesystem::path second = dir / "second";
+  std::filesystem::create_directory(first);
+  std::filesystem::create_directory(second);
+  ASSERT_TRUE(make_synthetic_procfs(first, options).has_value());
+  ASSERT_TRUE(make_synthetic_procfs(second, options).has_value());
+  TaskTable a, b;
+  read_task_table(a, first, true);
+  read_task_table(b, second, true);
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t row = 0U; row < a.size(); row++) {
+    EXPECT_EQ(a.tid(row), b.tid(row));
+    EXPECT_EQ(a.name(row), b.name(row));
+  }
+}
+
+TEST_F(SyntheticProcfsTest, BadDirectory) {
+  synthetic_procfs_options options{};
+  ::testing::internal::CaptureStderr();
+  EXPECT_FALSE(make_synthetic_procfs("/proc/nonexistent", options).has_value());
+  EXPECT_NE(std::string::npos,
+            ::testing::internal::GetCapturedStderr().find("Unable to create"));
+}
+
+} // namespace local_testing
+} // namespace process_affinity
@@ -0,0 +1,41 @@
+#ifndef TEST_TEMP_DIR_H
+#define TEST_TEMP_DIR_H
+
+// A test fixture which gives each test an empty directory of its own under
+// /tmp, and removes it with everything in it when the test ends.
+
+#include <stdlib.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace test_util {
+
+class TempDirTest : public testing::Test {
+protected:
+  void SetUp() override {
+    std::string tmpl = std::string("/tmp/") +
+                       testing::UnitTest::GetInstance()
+                           ->current_test_info()
+                           ->test_suite_name() +
+                       "XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(tmpl.data()))
+        << "Unable to create " << tmpl << ": " << strerror(errno);
+    dir = tmpl;
+  }
+  void TearDown() override {
+    if (!dir.empty()) {
+      std::filesystem::remove_all(dir);
+    }
+  }
+
+  std::filesystem::path dir;
+};
+
+} // namespace test_util
+
+#endif
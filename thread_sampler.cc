@@ -0,0 +1,184 @@
+#include "cpulist.hh"
+#include "thread_sampler.hh"
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace process_affinity;
+
+void usage(const char *prog) {
+  std::cerr << prog
+            << " [-t] [-s] [-i HZ] [-n COUNT] [-k TOP] [-r SECONDS] "
+               "[-c CPULIST]"
+            << std::endl;
+  std::cerr << "  -t  sample every thread, not only thread-group leaders"
+            << std::endl;
+  std::cerr << "  -s  skip the status files and the context switch counts"
+            << std::endl;
+  std::cerr << "  -i  sample HZ times per second, 10 by default" << std::endl;
+  std::cerr << "  -n  stop after COUNT intervals rather than running forever"
+            << std::endl;
+  std::cerr << "  -k  print the TOP threads by CPU time in each interval, 10 "
+               "by default"
+            << std::endl;
+  std::cerr << "  -r  look for new threads every SECONDS, 1 by default"
+            << std::endl;
+  std::cerr << "  -c  print only threads which last ran on a CPU in CPULIST"
+            << std::endl;
+}
+
+// Allow as many descriptors as the hard limit, since every sampled thread
+// keeps one or two open.
+void raise_fd_limit() {
+  struct rlimit limit;
+  if (0 == getrlimit(RLIMIT_NOFILE, &limit)) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+double cpu_seconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void advance(struct timespec &when, long ns) {
+  when.tv_nsec += ns;
+  while (when.tv_nsec >= 1000000000L) {
+    when.tv_nsec -= 1000000000L;
+    when.tv_sec++;
+  }
+}
+
+int main(int argc, char **argv) {
+  bool all_threads = false;
+  bool read_status = true;
+  unsigned long hz = 10U;
+  unsigned long count = 0U;
+  unsigned long top = 10U;
+  unsigned long rescan = 1U;
+  std::optional<std::vector<uint32_t>> cpus{};
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "tsi:n:k:r:c:"))) {
+    switch (opt) {
+    case 't':
+      all_threads = true;
+      break;
+    case 's':
+      read_status = false;
+      break;
+    case 'i':
+      hz = strtoul(optarg, nullptr, 10);
+      if ((0U == hz) || (1000U < hz)) {
+        std::cerr << "Illegal rate " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'n':
+      count = strtoul(optarg, nullptr, 10);
+      break;
+    case 'k':
+      top = strtoul(optarg, nullptr, 10);
+      break;
+    case 'r':
+      rescan = strtoul(optarg, nullptr, 10);
+      if (0U == rescan) {
+        std::cerr << "Illegal rescan interval " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'c':
+      cpus = cpulist::parse_cpulist(optarg);
+      if (!cpus.has_value()) {
+        std::cerr << "Illegal cpulist " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  raise_fd_limit();
+  ThreadSampler sampler("/proc/", read_status);
+  if (!sampler.available()) {
+    exit(EXIT_FAILURE);
+  }
+  sampler.add_all(all_threads);
+  const double ms_per_tick = 1000.0 / sysconf(_SC_CLK_TCK);
+  const long period_ns = 1000000000L / hz;
+  std::vector<size_t> rows{};
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  double cpu_before = cpu_seconds();
+  for (unsigned long interval = 1U; !count || (interval <= count);
+       interval++) {
+    // Sleep until an absolute time, so that the time spent sampling does not
+    // lower the rate.
+    advance(next, period_ns);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    const size_t exited = sampler.sample();
+
+    rows.clear();
+    for (size_t row = 0U; row < sampler.size(); row++) {
+      const thread_times &delta = sampler.delta(row);
+      // A thread which only woke briefly may have accrued no ticks, yet
+      // still disturbed an isolated CPU, so voluntary switches count too.
+      if ((0U == (delta.utime | delta.stime | delta.nvcsw | delta.nivcsw)) ||
+          (cpus.has_value() &&
+           !std::binary_search(cpus->begin(), cpus->end(),
+                               sampler.processor(row)))) {
+        continue;
+      }
+      rows.push_back(row);
+    }
+    const size_t shown = std::min<size_t>(top, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + shown, rows.end(),
+                      [&](size_t a, size_t b) {
+                        const thread_times &da = sampler.delta(a);
+                        const thread_times &db = sampler.delta(b);
+                        return (da.utime + da.stime) > (db.utime + db.stime);
+                      });
+    std::cout << "interval " << interval << ": " << sampler.size()
+              << " threads, " << exited << " exited\n";
+    for (size_t i = 0U; i < shown; i++) {
+      const size_t row = rows[i];
+      const thread_times &delta = sampler.delta(row);
+      std::cout << "  " << sampler.tid(row) << " " << sampler.name(row)
+                << " cpu " << sampler.processor(row) << " usr "
+                << delta.utime * ms_per_tick << " ms sys "
+                << delta.stime * ms_per_tick << " ms";
+      if (read_status) {
+        std::cout << " vcsw " << delta.nvcsw << " ivcsw " << delta.nivcsw;
+      }
+      std::cout << "\n";
+    }
+
+    if (0U == interval % (rescan * hz)) {
+      sampler.add_all(all_threads);
+      const double cpu_now = cpu_seconds();
+      std::cout << "sampler used " << std::fixed << std::setprecision(2)
+                << 100.0 * (cpu_now - cpu_before) / rescan
+                << std::defaultfloat << "% of a CPU\n";
+      cpu_before = cpu_now;
+    }
+    std::cout.flush();
+  }
+  exit(EXIT_SUCCESS);
+}
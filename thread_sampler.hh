@@ -0,0 +1,105 @@
+#ifndef THREAD_SAMPLER_H
+#define THREAD_SAMPLER_H
+
+// Periodic sampling of the CPU time and context switches of many threads, at
+// rates like 10 to 100 Hz, to see which threads disturb a CPU and when.
+// Reopening /proc/<tid>/stat for every sample would cost a path lookup, an
+// openat() and a close() per thread, so ThreadSampler keeps each thread's stat
+// and status files open and rereads them with pread() at offset 0, which
+// regenerates the contents.  Samples are parsed in place in fixed buffers, so
+// that a sample allocates nothing.
+
+#include "classify_process_affinity.hh"
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace process_affinity {
+
+struct thread_times {
+  // Clock ticks in user and kernel mode, stat fields STAT_UTIME and STAT_STIME.
+  uint64_t utime = 0U;
+  uint64_t stime = 0U;
+  // voluntary_ctxt_switches and nonvoluntary_ctxt_switches from the status
+  // file, or 0 if the sampler does not read it.
+  uint64_t nvcsw = 0U;
+  uint64_t nivcsw = 0U;
+};
+
+class ThreadSampler {
+public:
+  // Sample threads of procfs_top.  Unless read_status is set, only the stat
+  // file is read, which halves the cost of a sample but leaves the context
+  // switch counts 0.
+  explicit ThreadSampler(const std::string &procfs_top = "/proc/",
+                         bool read_status = true);
+  ~ThreadSampler();
+  ThreadSampler(const ThreadSampler &) = delete;
+  ThreadSampler &operator=(const ThreadSampler &) = delete;
+
+  // Whether procfs_top could be opened.
+  bool available() const { return -1 != proc_fd_; }
+  // Start sampling thread tid.  Returns false if its files cannot be read, as
+  // when it has exited.  Adding a thread which is already sampled does
+  // nothing.
+  bool add(pid_t tid);
+  // Add every thread in procfs_top, or every thread-group leader unless
+  // all_threads is set, which is not yet sampled.  Returns the number added.
+  // Each thread costs one or two file descriptors, so callers which sample
+  // every thread should raise RLIMIT_NOFILE.
+  size_t add_all(bool all_threads);
+  // Reread every thread's files, so that delta() is the change since the
+  // previous sample(), or since add() for a new thread.  Threads which have
+  // exited are dropped, which moves other threads to new rows.  Returns the
+  // number dropped.
+  size_t sample();
+
+  size_t size() const { return tids_.size(); }
+  pid_t tid(size_t row) const { return tids_[row]; }
+  // The name when the thread was added.
+  std::string_view name(size_t row) const {
+    return names_.name(name_ids_[row]);
+  }
+  const thread_times &total(size_t row) const { return totals_[row]; }
+  const thread_times &delta(size_t row) const { return deltas_[row]; }
+  // Stat field STAT_PROCESSOR, the CPU on which the thread last ran.
+  uint32_t processor(size_t row) const { return processors_[row]; }
+
+private:
+  bool add_at(int dirfd, const char *name, pid_t tid);
+  // Also point stat_line, if given, at the stat file in stat_buf_.
+  bool read_times(int stat_fd, int status_fd, thread_times &times,
+                  uint32_t &processor, std::string_view *stat_line = nullptr);
+  void remove(size_t row);
+
+  std::string procfs_top_;
+  int proc_fd_ = -1;
+  bool read_status_;
+  // Set once running out of file descriptors has been reported.
+  bool reported_emfile_ = false;
+  std::vector<pid_t> tids_{};
+  std::vector<int> stat_fds_{};
+  // -1 if read_status_ is not set.
+  std::vector<int> status_fds_{};
+  std::vector<uint32_t> name_ids_{};
+  std::vector<thread_times> totals_{};
+  std::vector<thread_times> deltas_{};
+  std::vector<uint32_t> processors_{};
+  NamePool names_{};
+  // The sampled tids, which add_all() skips.
+  std::unordered_set<pid_t> known_{};
+  stat_buf_t stat_buf_{};
+  // A status file is about 1.4 kB, but reread() grows the buffer for larger
+  // ones.
+  std::string status_buf_ = std::string(STATUS_BUF_SIZE, '\0');
+};
+
+} // namespace process_affinity
+
+#endif
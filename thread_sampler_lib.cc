@@ -0,0 +1,261 @@
+#include "thread_sampler.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+namespace process_affinity {
+
+namespace {
+
+// Read the regenerated contents of fd from its start into buf until EOF.
+// Returns how much was read, which is size if buf filled first, or -1.  Once
+// the thread has been reaped, pread() fails with ESRCH.
+ssize_t reread_at_most(int fd, char *buf, size_t size) {
+  size_t total = 0U;
+  while (total < size) {
+    const ssize_t bytes_read = pread(fd, buf + total, size - total, total);
+    if (0 > bytes_read) {
+      return -1;
+    }
+    if (0 == bytes_read) {
+      break;
+    }
+    total += bytes_read;
+  }
+  return total;
+}
+
+// A stat line is far shorter than buf, so one which fills it is malformed.
+template <size_t N>
+std::optional<std::string_view> reread(int fd, std::array<char, N> &buf) {
+  const ssize_t bytes_read = reread_at_most(fd, buf.data(), buf.size());
+  if ((0 >= bytes_read) || (buf.size() == static_cast<size_t>(bytes_read))) {
+    return std::nullopt;
+  }
+  return std::string_view(buf.data(), bytes_read);
+}
+
+// The CPU masks in a status file grow with the number of CPUs, so grow buf
+// until the whole file fits, rather than parse a truncated one.
+std::optional<std::string_view> reread(int fd, std::string &buf) {
+  ssize_t bytes_read = reread_at_most(fd, buf.data(), buf.size());
+  while (buf.size() == static_cast<size_t>(bytes_read)) {
+    buf.resize(2U * buf.size());
+    bytes_read = reread_at_most(fd, buf.data(), buf.size());
+  }
+  if (0 >= bytes_read) {
+    return std::nullopt;
+  }
+  return std::string_view(buf.data(), bytes_read);
+}
+
+std::optional<uint64_t> parse_status_count(std::string_view status,
+                                           std::string_view key) {
+  const std::optional<std::string_view> value =
+      parse_status_field(status, key);
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  uint64_t count = 0U;
+  const std::from_chars_result res = std::from_chars(
+      value->data(), value->data() + value->size(), count);
+  if (res.ec != std::errc()) {
+    return std::nullopt;
+  }
+  return count;
+}
+
+} // namespace
+
+ThreadSampler::ThreadSampler(const std::string &procfs_top, bool read_status)
+    : procfs_top_(procfs_top), read_status_(read_status) {
+  proc_fd_ = open(procfs_top.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == proc_fd_) {
+    std::cerr << "Unable to open " << procfs_top << ": " << strerror(errno)
+              << std::endl;
+  }
+}
+
+ThreadSampler::~ThreadSampler() {
+  for (size_t row = 0U; row < tids_.size(); row++) {
+    close(stat_fds_[row]);
+    if (-1 != status_fds_[row]) {
+      close(status_fds_[row]);
+    }
+  }
+  if (-1 != proc_fd_) {
+    close(proc_fd_);
+  }
+}
+
+bool ThreadSampler::read_times(int stat_fd, int status_fd,
+                               thread_times &times, uint32_t &processor,
+                               std::string_view *stat_line) {
+  const std::optional<std::string_view> stat = reread(stat_fd, stat_buf_);
+  if (!stat.has_value()) {
+    return false;
+  }
+  if (nullptr != stat_line) {
+    *stat_line = stat.value();
+  }
+  static constexpr stat_field fields[] = {STAT_UTIME, STAT_STIME,
+                                          STAT_PROCESSOR};
+  uint64_t values[3];
+  if (!parse_stat_fields(stat.value(), fields, 3U, values)) {
+    return false;
+  }
+  times.utime = values[0];
+  times.stime = values[1];
+  processor = values[2];
+  if (-1 == status_fd) {
+    return true;
+  }
+  const std::optional<std::string_view> status =
+      reread(status_fd, status_buf_);
+  if (!status.has_value()) {
+    return false;
+  }
+  const std::optional<uint64_t> nvcsw =
+      parse_status_count(status.value(), "voluntary_ctxt_switches");
+  const std::optional<uint64_t> nivcsw =
+      parse_status_count(status.value(), "nonvoluntary_ctxt_switches");
+  if (!nvcsw.has_value() || !nivcsw.has_value()) {
+    return false;
+  }
+  times.nvcsw = nvcsw.value();
+  times.nivcsw = nivcsw.value();
+  return true;
+}
+
+bool ThreadSampler::add_at(int dirfd, const char *name, pid_t tid) {
+  if (known_.count(tid)) {
+    return true;
+  }
+  // Holds "<tid>/status".
+  char relpath[NAME_MAX + sizeof("/status")];
+  snprintf(relpath, sizeof(relpath), "%s/stat", name);
+  const int stat_fd = openat(dirfd, relpath, O_RDONLY | O_CLOEXEC);
+  int status_fd = -1;
+  if ((-1 != stat_fd) && read_status_) {
+    snprintf(relpath, sizeof(relpath), "%s/status", name);
+    status_fd = openat(dirfd, relpath, O_RDONLY | O_CLOEXEC);
+  }
+  if ((-1 == stat_fd) || (read_status_ && (-1 == status_fd))) {
+    if ((EMFILE == errno) && !reported_emfile_) {
+      std::cerr << "Out of file descriptors after " << tids_.size()
+                << " threads; raise RLIMIT_NOFILE to sample more."
+                << std::endl;
+      reported_emfile_ = true;
+    }
+    if (-1 != stat_fd) {
+      close(stat_fd);
+    }
+    return false;
+  }
+  thread_times times{};
+  uint32_t processor = 0U;
+  std::string_view stat{};
+  if (!read_times(stat_fd, status_fd, times, processor, &stat)) {
+    close(stat_fd);
+    if (-1 != status_fd) {
+      close(status_fd);
+    }
+    return false;
+  }
+  // The name is read only once, since ThreadSampler does not track renames.
+  const std::optional<stat_fields> fields = parse_thread_stat(stat);
+  tids_.push_back(tid);
+  stat_fds_.push_back(stat_fd);
+  status_fds_.push_back(status_fd);
+  name_ids_.push_back(
+      names_.intern(fields.has_value() ? fields->thread_name : ""));
+  totals_.push_back(times);
+  deltas_.push_back(thread_times{});
+  processors_.push_back(processor);
+  known_.insert(tid);
+  return true;
+}
+
+bool ThreadSampler::add(pid_t tid) {
+  if (!available()) {
+    return false;
+  }
+  char name[sizeof("-2147483648")];
+  snprintf(name, sizeof(name), "%d", tid);
+  // /proc/<tid> exists for every thread, although only thread-group leaders
+  // are listed.
+  return add_at(proc_fd_, name, tid);
+}
+
+size_t ThreadSampler::add_all(bool all_threads) {
+  if (!available()) {
+    return 0U;
+  }
+  size_t added = 0U;
+  for_each_task_dir(procfs_top_, all_threads,
+                    [&](int dirfd, const char *name, pid_t tid) {
+                      if (!known_.count(tid) && add_at(dirfd, name, tid)) {
+                        added++;
+                      }
+                      return !reported_emfile_;
+                    });
+  return added;
+}
+
+void ThreadSampler::remove(size_t row) {
+  close(stat_fds_[row]);
+  if (-1 != status_fds_[row]) {
+    close(status_fds_[row]);
+  }
+  known_.erase(tids_[row]);
+  const size_t last = tids_.size() - 1U;
+  tids_[row] = tids_[last];
+  stat_fds_[row] = stat_fds_[last];
+  status_fds_[row] = status_fds_[last];
+  name_ids_[row] = name_ids_[last];
+  totals_[row] = totals_[last];
+  deltas_[row] = deltas_[last];
+  processors_[row] = processors_[last];
+  tids_.pop_back();
+  stat_fds_.pop_back();
+  status_fds_.pop_back();
+  name_ids_.pop_back();
+  totals_.pop_back();
+  deltas_.pop_back();
+  processors_.pop_back();
+}
+
+size_t ThreadSampler::sample() {
+  size_t dropped = 0U;
+  size_t row = 0U;
+  while (row < tids_.size()) {
+    thread_times now{};
+    if (!read_times(stat_fds_[row], status_fds_[row], now,
+                    processors_[row])) {
+      // Move the last row here, and then examine it.
+      remove(row);
+      dropped++;
+      continue;
+    }
+    // The descriptors refer to the thread rather than to its tid, so a new
+    // thread which reuses the tid cannot be mistaken for it, and the counters
+    // never go backward.
+    const thread_times &before = totals_[row];
+    deltas_[row].utime = now.utime - before.utime;
+    deltas_[row].stime = now.stime - before.stime;
+    deltas_[row].nvcsw = now.nvcsw - before.nvcsw;
+    deltas_[row].nivcsw = now.nivcsw - before.nivcsw;
+    totals_[row] = now;
+    row++;
+  }
+  return dropped;
+}
+
+} // namespace process_affinity
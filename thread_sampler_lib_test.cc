@@ -0,0 +1,152 @@
+#include "thread_sampler.hh"
+#include "synthetic_procfs.hh"
+#include "test_temp_dir.hh"
+
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace process_affinity {
+namespace local_testing {
+
+using ThreadSamplerTest = test_util::TempDirTest;
+
+// A stat line whose fields are 0 except for those which ThreadSampler reads.
+std::string stat_line(uint64_t utime, uint64_t stime, int32_t processor) {
+  std::string line = "42 (worker) R 1 42 42 0 -1 4194560 0 0 0 0 " +
+                     std::to_string(utime) + " " + std::to_string(stime);
+  for (uint32_t field = STAT_CUTIME; field < STAT_PROCESSOR; field++) {
+    line += " 0";
+  }
+  line += " " + std::to_string(processor) + " 0 0 0 0 0\n";
+  return line;
+}
+
+// Rewrite path in place, so that a descriptor which is already open sees the
+// new contents, as for a procfs file.
+void rewrite(const std::filesystem::path &path, const std::string &contents) {
+  std::ofstream out(path, std::ios::trunc);
+  out << contents;
+}
+
+TEST_F(ThreadSamplerTest, Synthetic) {
+  std::filesystem::create_directory(dir / "42");
+  rewrite(dir / "42/stat", stat_line(100U, 20U, 3));
+  rewrite(dir / "42/status", synthetic_status_file(42, 42, "worker", 'R', 1,
+                                                   1, {0U, 1U, 2U, 3U}, 5U,
+                                                   7U));
+
+  ThreadSampler sampler(dir.string() + "/");
+  EXPECT_FALSE(sampler.add(43));
+  EXPECT_TRUE(sampler.add(42));
+  EXPECT_TRUE(sampler.add(42));
+  EXPECT_EQ(0U, sampler.add_all(true));
+  ASSERT_EQ(1U, sampler.size());
+  EXPECT_EQ(42, sampler.tid(0U));
+  EXPECT_EQ("worker", sampler.name(0U));
+  EXPECT_EQ(100U, sampler.total(0U).utime);
+  EXPECT_EQ(7U, sampler.total(0U).nivcsw);
+  EXPECT_EQ(3U, sampler.processor(0U));
+
+  rewrite(dir / "42/stat", stat_line(112U, 21U, 1));
+  rewrite(dir / "42/status", synthetic_status_file(42, 42, "worker", 'R', 1,
+                                                   1, {0U, 1U, 2U, 3U}, 9U,
+                                                   7U));
+  EXPECT_EQ(0U, sampler.sample());
+  ASSERT_EQ(1U, sampler.size());
+  EXPECT_EQ(12U, sampler.delta(0U).utime);
+  EXPECT_EQ(1U, sampler.delta(0U).stime);
+  EXPECT_EQ(4U, sampler.delta(0U).nvcsw);
+  EXPECT_EQ(0U, sampler.delta(0U).nivcsw);
+  EXPECT_EQ(1U, sampler.processor(0U));
+
+  // A malformed sample is treated like an exited thread.
+  rewrite(dir / "42/stat", "42 (worker");
+  EXPECT_EQ(1U, sampler.sample());
+  EXPECT_EQ(0U, sampler.size());
+}
+
+// On a machine with thousands of CPUs, the CPU masks push the context-switch
+// counts at the end of a status file far beyond STATUS_BUF_SIZE.
+TEST_F(ThreadSamplerTest, LargeStatus) {
+  std::vector<uint32_t> cpus{};
+  for (uint32_t cpu = 0U; cpu < 8192U; cpu += 2U) {
+    cpus.push_back(cpu);
+  }
+  const std::string status =
+      synthetic_status_file(42, 42, "worker", 'R', 1, 1, cpus, 5U, 7U);
+  ASSERT_LT(2U * STATUS_BUF_SIZE, status.size());
+  std::filesystem::create_directory(dir / "42");
+  rewrite(dir / "42/stat", stat_line(100U, 20U, 3));
+  rewrite(dir / "42/status", status);
+
+  ThreadSampler sampler(dir.string() + "/");
+  ASSERT_TRUE(sampler.add(42));
+  EXPECT_EQ(5U, sampler.total(0U).nvcsw);
+  EXPECT_EQ(7U, sampler.total(0U).nivcsw);
+  rewrite(dir / "42/status",
+          synthetic_status_file(42, 42, "worker", 'R', 1, 1, cpus, 9U, 7U));
+  EXPECT_EQ(0U, sampler.sample());
+  EXPECT_EQ(4U, sampler.delta(0U).nvcsw);
+}
+
+TEST_F(ThreadSamplerTest, Live) {
+  ThreadSampler sampler;
+  ASSERT_TRUE(sampler.available());
+  ASSERT_TRUE(sampler.add(gettid()));
+  EXPECT_LT(0U, sampler.add_all(false));
+
+  // Spin for 50 ms of CPU time, five clock ticks at the usual USER_HZ of 100.
+  struct timespec start, now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+  do {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  } while (((now.tv_sec - start.tv_sec) * 1000000000L +
+            (now.tv_nsec - start.tv_nsec)) < 50000000L);
+  sampler.sample();
+  bool found = false;
+  for (size_t row = 0U; row < sampler.size(); row++) {
+    if (gettid() == sampler.tid(row)) {
+      found = true;
+      EXPECT_LE(1U, sampler.delta(row).utime + sampler.delta(row).stime);
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST_F(ThreadSamplerTest, DropsExited) {
+  ThreadSampler sampler("/proc/", false);
+  std::atomic<pid_t> tid{0};
+  std::atomic<bool> done{false};
+  std::thread worker([&] {
+    tid = gettid();
+    while (!done) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  while (0 == tid) {
+    std::this_thread::yield();
+  }
+  ASSERT_TRUE(sampler.add(tid));
+  EXPECT_EQ(0U, sampler.total(0U).nvcsw);
+  done = true;
+  worker.join();
+  // The thread may linger briefly after join() returns.
+  size_t dropped = 0U;
+  for (int tries = 0; (0U == dropped) && (tries < 100); tries++) {
+    dropped = sampler.sample();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(1U, dropped);
+  EXPECT_EQ(0U, sampler.size());
+}
+
+} // namespace local_testing
+} // namespace process_affinity
@@ -1,64 +1,165 @@
 // Reimplement linux/tools/tracing/rtla/sample/timerlat_load.py as C++.
 
+#include "cpulist.hh"
+#include "load_kernel.hh"
 #include "timerlat_load.hh"
 
+#include <fcntl.h>
 #include <sched.h>
+#include <signal.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
 #include <iostream>
+#include <map>
 
 using namespace std;
 using namespace timerlat_load;
 
-void usage(const std::string &prog) {
-  cerr << prog << " PRIORITY (<= " << MAX_PRIO << ") CPU (<" << CORES << ")"
+namespace {
+// Set by SIGINT or SIGTERM to stop every worker.
+std::atomic<bool> stop_requested{false};
+
+void request_stop(int) { stop_requested = true; }
+
+// The kernel which every worker runs.
+load_options options{};
+
+// What each worker achieved, by CPU.  The entries are created before the
+// workers start, so that each writes only its own.
+map<uint32_t, load_stats> achieved{};
+} // namespace
+
+void usage(const std::string &prog, const vector<uint32_t> &online) {
+  cerr << prog << " [-k KERNEL] [-s BYTES] [-n OPS] PRIORITY (<= "
+       << MAX_PRIO << ") [CPULIST (of " << cpulist::format_cpulist(online)
+       << ")]" << endl;
+  cerr << "Load every CPU in CPULIST, by default every online CPU, with one "
+          "thread each until interrupted."
+       << endl;
+  cerr << "  -k  run devfull (the default), triad, chase, fma or syscall "
+          "each timer period"
        << endl;
+  cerr << "  -s  read BYTES from " << DEVPATH << " per timer period, "
+       << BYTES << " by default, or size triad's arrays or chase's ring, "
+       << "twice the " << llc_bytes() << "-byte LLC by default" << endl;
+  cerr << "  -n  run OPS loads, vector iterations or system calls per timer "
+          "period in chase, fma or syscall"
+       << endl;
+}
+
+// Open the timerlat file descriptor of cpu, on which the calling thread runs,
+// and run the load kernel each timer period until stop is set.
+int load_cpu(const uint32_t cpu, WorkerGate &gate, const atomic<bool> &stop) {
+  // Constructed by the pinned worker, so that its memory is local to its CPU.
+  const unique_ptr<LoadKernel> kernel = make_load_kernel(options);
+  const string tl_path = string{TRACETLD} + to_string(cpu) + "/timerlat_fd"s;
+  const int tlfd = open(tl_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (-1 == tlfd) {
+    cerr << "Unable to open file " << tl_path << ": " << strerror(errno)
+         << endl;
+  }
+  int ret = EXIT_FAILURE;
+  const bool ready = kernel->valid() && (-1 != tlfd);
+  if (gate.wait(ready)) {
+    const optional<load_stats> stats = run_load(tlfd, *kernel, stop);
+    if (stats.has_value()) {
+      achieved.at(cpu) = stats.value();
+      ret = EXIT_SUCCESS;
+    } else {
+      cerr << "Unable to read " << tl_path << ": " << strerror(errno) << endl;
+    }
+  } else if (ready) {
+    // Another worker failed.
+    ret = EXIT_SUCCESS;
+  }
+  if (-1 != tlfd) {
+    close(tlfd);
+  }
+  return ret;
 }
 
 int main(int argc, char **argv) {
+  const vector<uint32_t> online = cpulist::online_cpus();
   if (geteuid()) {
     cerr << argv[0] << " is only runnable as root." << endl;
     exit(EXIT_FAILURE);
   }
-  if ((3 > argc) || (4 < argc)) {
-    usage(argv[0]);
-    exit(EXIT_FAILURE);
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "k:s:n:"))) {
+    switch (opt) {
+    case 'k': {
+      const optional<load_kind> kind = parse_load_kind(optarg);
+      if (!kind.has_value()) {
+        cerr << "Illegal kernel " << optarg << endl;
+        usage(argv[0], online);
+        exit(EXIT_FAILURE);
+      }
+      options.kind = kind.value();
+      break;
+    }
+    case 's':
+      options.bytes = strtoul(optarg, nullptr, 10);
+      if (0U == options.bytes) {
+        cerr << "Illegal size " << optarg << endl;
+        usage(argv[0], online);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'n':
+      options.ops = strtoull(optarg, nullptr, 10);
+      if (0U == options.ops) {
+        cerr << "Illegal count " << optarg << endl;
+        usage(argv[0], online);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      usage(argv[0], online);
+      exit(EXIT_FAILURE);
+    }
   }
-  const int32_t prio = strtol(argv[1], nullptr, 10);
-  if (errno || (0 >= prio) || (MAX_PRIO < prio)) {
-    cerr << "Illegal priority " << argv[1] << endl;
-    usage(argv[0]);
+  if ((1 > argc - optind) || (2 < argc - optind)) {
+    usage(argv[0], online);
     exit(EXIT_FAILURE);
   }
-  const uint16_t cpu = strtol(argv[2], nullptr, 10);
-  if (errno || (CORES <= cpu)) {
-    cerr << "Illegal cpu " << argv[2] << endl;
-    usage(argv[0]);
+  errno = 0;
+  const int32_t prio = strtol(argv[optind], nullptr, 10);
+  if (errno || (0 >= prio) || (MAX_PRIO < prio)) {
+    cerr << "Illegal priority " << argv[optind] << endl;
+    usage(argv[0], online);
     exit(EXIT_FAILURE);
   }
-
-  const pid_t pid = getpid();
-  if ((set_affinity(pid, cpu)) || set_prio(pid, prio)) {
-    exit(EXIT_FAILURE);
+  vector<uint32_t> cpus = online;
+  if (2 == argc - optind) {
+    const char *list = argv[optind + 1];
+    const optional<vector<uint32_t>> parsed = cpulist::parse_cpulist(list);
+    if (!parsed.has_value() ||
+        !includes(online.begin(), online.end(), parsed->begin(),
+                  parsed->end())) {
+      cerr << "Illegal cpulist " << list << endl;
+      usage(argv[0], online);
+      exit(EXIT_FAILURE);
+    }
+    cpus = parsed.value();
   }
 
-  const string tl_path = string{TRACETLD} + to_string(cpu) + "/timerlat_fd"s;
-  ifstream tlfs(tl_path, ifstream::in);
-  if (!tlfs.good()) {
-    cerr << "Unable to open file " << tl_path << endl;
-    exit(EXIT_FAILURE);
+  for (const uint32_t cpu : cpus) {
+    achieved[cpu] = load_stats{};
   }
-  const string dev_path = DEVPATH;
-  ifstream devfs(dev_path, ifstream::in);
-  if (!devfs.good()) {
-    cerr << "Unable to open file " << dev_path << endl;
-    exit(EXIT_FAILURE);
+  struct sigaction action {};
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  const int ret = run_workers(cpus, prio, stop_requested, load_cpu);
+  for (const auto &[cpu, stats] : achieved) {
+    cout << "cpu " << cpu << ": " << load_kind_name(options.kind) << " "
+         << stats.rate() << " "
+         << load_kind_unit(options.kind) << "/s over " << stats.iterations
+         << " iterations" << endl;
   }
-  read_buffs(tlfs, devfs);
-  tlfs.close();
-  devfs.close();
-  exit(EXIT_SUCCESS);
+  exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -9,18 +9,20 @@
 // As of v6.9-rc5, the file Documentation/tools/rtla/common_timerlat_options.rst
 // appears in git on localhost, but not at github.com/torvalds.
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <vector>
 
 // A file that the test reads just to keep busy since it is never empty.
 constexpr char DEVPATH[] = "/dev/full";
 // The directory in which the timerlat file descriptor opened by RTLA appears.
 constexpr char TRACETLD[] = "/sys/kernel/tracing/osnoise/per_cpu/cpu";
-// The core count on both of my test systems.
-constexpr uint16_t CORES = 8U;
-// The size of the reads from /dev/full.
+// The default size of the reads from /dev/full.
 constexpr uint32_t BYTES = 20 * 1024 * 1024;
 // 20 is perhaps already too high for safety on a non-PREEMPT_RT system.
 constexpr int MAX_PRIO = 20;
@@ -35,8 +37,56 @@ int set_affinity(const pid_t pid, const uint16_t cpu);
 // Requires root privilege for RT priorities < 0.
 int set_prio(const pid_t pid, const int prio);
 
-// Read the file paths.   Reading tracefs requires root privilege.
-ssize_t read_buffs(std::ifstream &tlfs, std::ifstream &devfs);
+// A page-aligned buffer for the load, mapped with every page present and, if
+// the memory lock limit allows, locked, so that filling it causes no page
+// faults.  The faults, and the malloc() and zeroing of a fresh buffer for each
+// read, would otherwise be noise of their own in the latency under test.
+// Allocating it from the pinned worker places it on the worker's NUMA node.
+class LoadBuffer {
+public:
+  explicit LoadBuffer(size_t size = BYTES);
+  ~LoadBuffer();
+  LoadBuffer(const LoadBuffer &) = delete;
+  LoadBuffer &operator=(const LoadBuffer &) = delete;
+
+  // False if the buffer could not be mapped.
+  bool valid() const { return nullptr != data_; }
+  char *data() { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  char *data_ = nullptr;
+  size_t size_;
+};
+
+// Holds worker threads until every one has finished its setup, so that none
+// starts loading its CPU before the others are ready or after one has failed.
+class WorkerGate {
+public:
+  explicit WorkerGate(size_t workers) : waiting_(workers) {}
+  // Report whether this worker's setup succeeded and wait for the others.
+  // Returns true only if every worker's setup did.
+  bool wait(bool ready);
+
+private:
+  std::mutex lock_;
+  std::condition_variable opened_;
+  size_t waiting_;
+  bool failed_ = false;
+};
+
+// The work of one thread, which runs pinned to cpu.  It must call
+// gate.wait() exactly once, after opening its files, and then return once
+// stop is set.
+using worker_fn = std::function<int(uint32_t cpu, WorkerGate &gate,
+                                    const std::atomic<bool> &stop)>;
+
+// Run work in one thread per CPU in cpus, each pinned to its CPU and, unless
+// prio is 0, set to SCHED_FIFO priority prio.  When any worker returns, stop
+// is set so that the rest do too.  Returns 0, or, in the order of cpus, the
+// first nonzero value which a worker or its pinning returned.
+int run_workers(const std::vector<uint32_t> &cpus, int prio,
+                std::atomic<bool> &stop, const worker_fn &work);
 
 } // namespace timerlat_load
 
@@ -1,10 +1,12 @@
 #include "timerlat_load.hh"
 
 #include <sched.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <array>
 #include <memory>
+#include <thread>
 
 namespace timerlat_load {
 
@@ -37,17 +39,67 @@ int set_prio(const pid_t pid, const int prio) {
   return 0;
 }
 
-ssize_t read_buffs(std::ifstream &tlfs, std::ifstream &devfs) {
-  //  The timerlatfd  is always EOF.
-  if (!tlfs.good()) {
-    return 0;
+LoadBuffer::LoadBuffer(size_t size) : size_(size ? size : 1U) {
+  void *data = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (MAP_FAILED == data) {
+    std::cerr << "Unable to map a " << size_
+              << " byte buffer: " << strerror(errno) << std::endl;
+    return;
   }
-  while (devfs.good()) {
-    std::string snippet(BYTES, '\0');
-    tlfs.read(&snippet[0], 1);
-    devfs.read(&snippet[0], BYTES - 1);
+  data_ = static_cast<char *>(data);
+  // Without privilege, the lock limit is usually too small, and the pages
+  // already present will do.
+  mlock(data_, size_);
+}
+
+LoadBuffer::~LoadBuffer() {
+  if (nullptr != data_) {
+    munmap(data_, size_);
+  }
+}
+
+bool WorkerGate::wait(bool ready) {
+  std::unique_lock<std::mutex> guard(lock_);
+  failed_ = failed_ || !ready;
+  if (0U == --waiting_) {
+    opened_.notify_all();
+  } else {
+    opened_.wait(guard, [this] { return 0U == waiting_; });
   }
-  return (tlfs.gcount() + devfs.gcount());
+  return !failed_;
+}
+
+int run_workers(const std::vector<uint32_t> &cpus, int prio,
+                std::atomic<bool> &stop, const worker_fn &work) {
+  WorkerGate gate(cpus.size());
+  std::vector<int> results(cpus.size(), 0);
+  std::vector<std::thread> workers{};
+  for (size_t i = 0U; i < cpus.size(); i++) {
+    workers.emplace_back([&, i]() {
+      const pid_t tid = gettid();
+      int ret = set_affinity(tid, cpus[i]);
+      if (!ret && prio) {
+        ret = set_prio(tid, prio);
+      }
+      if (ret) {
+        gate.wait(false);
+      } else {
+        ret = work(cpus[i], gate, stop);
+      }
+      results[i] = ret;
+      stop = true;
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  for (const int ret : results) {
+    if (ret) {
+      return ret;
+    }
+  }
+  return 0;
 }
 
 } // namespace timerlat_load
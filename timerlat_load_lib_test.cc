@@ -1,9 +1,13 @@
+#include "cpulist.hh"
 #include "timerlat_load.hh"
 
 #include <fcntl.h>
 #include <sched.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "gtest/gtest.h"
 
 using namespace std;
@@ -11,9 +15,6 @@ using namespace std;
 namespace timerlat_load {
 namespace local_testing {
 
-constexpr char TESTFILE0[] = "/etc/hosts";
-constexpr char TESTFILE1[] = "/dev/null";
-
 // Test which runs only with root UID.
 struct TimerlatLoadCoresTest : public testing::TestWithParam<int> {
   TimerlatLoadCoresTest() {
@@ -45,8 +46,12 @@ TEST_P(TimerlatLoadCoresTest, SetAffinity) {
     EXPECT_EQ(0, errno);
   }
 }
+std::vector<int> online_cores() {
+  const std::vector<uint32_t> online = cpulist::online_cpus();
+  return std::vector<int>(online.begin(), online.end());
+}
 INSTANTIATE_TEST_SUITE_P(AllCores, TimerlatLoadCoresTest,
-                         testing::Values(0, 1, 2, 3, 4, 5, 6, 7));
+                         testing::ValuesIn(online_cores()));
 
 // Without the new name, INSTANTIATE_TEST_SUITE below will rerun the test above
 // with the bad values.
@@ -100,25 +105,69 @@ INSTANTIATE_TEST_SUITE_P(BadPrios, TimerlatLoadBadPriosTest,
                          testing::Values(-120, 500));
 
 // Test which runs with ordinary UID.
-TEST(TimerlatLoadTest, ReadBuffs) {
-  struct statx stats {};
-  ASSERT_EQ(0,
-            statx(0 /*dirfd */, TESTFILE0, 0 /* flags */, STATX_SIZE, &stats));
-  std::ifstream tlfs0(TESTFILE0);
-  std::ifstream devfs0(TESTFILE0);
-  // stx_size for the read of devfs plus one for read of the timerlatfd.
-  // /etc/hosts is not empty.
-  EXPECT_EQ(static_cast<ssize_t>(stats.stx_size) + 1,
-            read_buffs(tlfs0, devfs0));
-  tlfs0.close();
-  devfs0.close();
-
-  std::ifstream tlfs1(TESTFILE1);
-  std::ifstream devfs1(TESTFILE1);
-  // /dev/null is still empty.
-  EXPECT_EQ(0, read_buffs(tlfs1, devfs1));
-  tlfs1.close();
-  devfs1.close();
+TEST(TimerlatLoadTest, LoadBuffer) {
+  LoadBuffer buf(10000U);
+  ASSERT_TRUE(buf.valid());
+  EXPECT_EQ(10000U, buf.size());
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(buf.data()) %
+                    static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)));
+  buf.data()[buf.size() - 1U] = 'x';
+}
+
+// Test which runs with ordinary UID, since priority 0 leaves the scheduling
+// policy alone.
+TEST(TimerlatLoadTest, RunWorkers) {
+  const std::vector<uint32_t> online = cpulist::online_cpus();
+  std::atomic<bool> stop{false};
+  std::mutex lock;
+  std::vector<uint32_t> ran{};
+  EXPECT_EQ(0, run_workers(online, 0, stop,
+                           [&](uint32_t cpu, WorkerGate &gate,
+                               const std::atomic<bool> &) {
+                             EXPECT_TRUE(gate.wait(true));
+                             EXPECT_EQ(static_cast<int>(cpu), sched_getcpu());
+                             std::lock_guard<std::mutex> guard(lock);
+                             ran.push_back(cpu);
+                             return 0;
+                           }));
+  std::sort(ran.begin(), ran.end());
+  EXPECT_EQ(online, ran);
+  EXPECT_TRUE(stop);
+
+  // A worker which fails its setup keeps the others from starting, and one
+  // which returns stops the others.
+  stop = false;
+  std::atomic<size_t> started{0U};
+  const std::vector<uint32_t> twice = {online[0], online[0]};
+  EXPECT_EQ(ENODEV, run_workers(twice, 0, stop,
+                                [&](uint32_t, WorkerGate &gate,
+                                    const std::atomic<bool> &) {
+                                  if (0U == started++) {
+                                    gate.wait(false);
+                                    return ENODEV;
+                                  }
+                                  EXPECT_FALSE(gate.wait(true));
+                                  return 0;
+                                }));
+  EXPECT_EQ(2U, started);
+
+  // Pinning to a CPU which does not exist fails before the worker runs.
+  stop = false;
+  started = 0U;
+  testing::internal::CaptureStderr();
+  EXPECT_EQ(EINVAL, run_workers({online[0], 1000U}, 0, stop,
+                                [&](uint32_t, WorkerGate &gate,
+                                    const std::atomic<bool> &worker_stop) {
+                                  started++;
+                                  if (gate.wait(true)) {
+                                    while (!worker_stop) {
+                                      std::this_thread::yield();
+                                    }
+                                  }
+                                  return 0;
+                                }));
+  testing::internal::GetCapturedStderr();
+  EXPECT_EQ(1U, started);
 }
 
 } // namespace local_testing
@@ -0,0 +1,368 @@
+// Measure the one-way latency of each IPC transport between two pinned
+// threads, and print the distributions side by side, or with -M, half the
+// round-trip latency between every pair of CPUs, grouped by where they sit in
+// the machine.
+
+#include "cpulist.hh"
+#include "ipc_transport.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+using namespace timerlat_load;
+
+constexpr transport_kind MATRIX_TRANSPORT = transport_kind::shm_spin;
+constexpr size_t MATRIX_SAMPLES = 200U;
+
+void usage(const char *prog) {
+  std::cerr << prog
+            << " [-m] [-n SAMPLES] [-i NANOSECONDS] [-R RATE [-d SECONDS]] "
+               "[-p PRIORITY] [-s CPU] [-r CPU] [-o PREFIX | -M [-c CPULIST]] "
+               "[TRANSPORT ...]"
+            << std::endl;
+  std::cerr << "Measure each TRANSPORT in turn, by default all of:";
+  for (const transport_kind kind : all_transport_kinds()) {
+    std::cerr << " " << transport_kind_name(kind);
+  }
+  std::cerr << std::endl;
+  std::cerr << "  -m  timestamp with CLOCK_MONOTONIC_RAW even if the TSC is "
+               "usable"
+            << std::endl;
+  std::cerr << "  -n  send SAMPLES timestamps over each, 1000 by default"
+            << std::endl;
+  std::cerr << "  -i  wait NANOSECONDS between samples, 10000 by default"
+            << std::endl;
+  std::cerr << "  -R  send RATE samples per second on a fixed schedule, "
+               "whether or not"
+            << std::endl
+            << "      the receiver keeps up, and measure from when each was due"
+            << std::endl;
+  std::cerr << "  -d  with -R, send for SECONDS rather than SAMPLES"
+            << std::endl;
+  std::cerr << "  -p  run both threads at SCHED_FIFO PRIORITY (<= " << MAX_PRIO
+            << "), which requires root" << std::endl;
+  std::cerr << "  -s  pin the sender to CPU, by default the first online one"
+            << std::endl;
+  std::cerr << "  -r  pin the receiver to CPU, by default the last online one"
+            << std::endl;
+  std::cerr << "  -o  record every sample over TRANSPORT in "
+               "PREFIX.TRANSPORT.trace, for latency_trace"
+            << std::endl;
+  std::cerr << "  -M  instead measure between every ordered pair of CPUs, over "
+            << transport_kind_name(MATRIX_TRANSPORT) << " by default"
+            << std::endl;
+  std::cerr << "  -c  with -M, only the CPUs in CPULIST, by default all online"
+            << std::endl;
+}
+
+uint32_t parse_cpu(const char *arg, const std::vector<uint32_t> &online,
+                   const char *prog) {
+  char *end;
+  const unsigned long cpu = strtoul(arg, &end, 10);
+  if (('\0' == *arg) || ('\0' != *end) ||
+      !std::binary_search(online.begin(), online.end(), cpu)) {
+    std::cerr << "Illegal CPU " << arg << " (online are "
+              << cpulist::format_cpulist(online) << ")" << std::endl;
+    usage(prog);
+    exit(EXIT_FAILURE);
+  }
+  return cpu;
+}
+
+// Print one statistic of matrix as a table whose rows and columns follow
+// topology, with a gap between groups which share a last-level cache.
+void print_matrix(const latency_matrix &matrix,
+                  const std::vector<cpulist::cpu_topology> &topology,
+                  uint64_t pair_latency::*stat) {
+  const auto new_group = [&topology](size_t i) {
+    return (0U != i) && ((topology[i].package != topology[i - 1U].package) ||
+                         (topology[i].llc != topology[i - 1U].llc));
+  };
+  std::cout << std::setw(8) << "from\\to";
+  for (size_t to = 0U; to < topology.size(); to++) {
+    std::cout << (new_group(to) ? "  " : "") << std::setw(7)
+              << topology[to].cpu;
+  }
+  std::cout << std::endl;
+  for (size_t from = 0U; from < topology.size(); from++) {
+    if (new_group(from)) {
+      std::cout << std::endl;
+    }
+    std::cout << std::setw(8) << topology[from].cpu;
+    for (size_t to = 0U; to < topology.size(); to++) {
+      std::cout << (new_group(to) ? "  " : "") << std::setw(7);
+      if (from == to) {
+        std::cout << "-";
+      } else {
+        std::cout << matrix[from][to].*stat;
+      }
+    }
+    std::cout << std::endl;
+  }
+}
+
+// Measure kind between every pair of cpus and print the median and p99
+// tables, then a summary for each distance between CPUs.
+bool run_matrix(transport_kind kind, const std::vector<uint32_t> &cpus,
+                const transport_options &options,
+                const Timestamper &timestamper) {
+  std::vector<cpulist::cpu_topology> topology{};
+  for (const uint32_t cpu : cpus) {
+    topology.push_back(cpulist::read_topology(cpu));
+  }
+  cpulist::sort_by_topology(topology);
+  std::vector<uint32_t> ordered{};
+  for (const cpulist::cpu_topology &cpu : topology) {
+    ordered.push_back(cpu.cpu);
+  }
+  const std::optional<latency_matrix> matrix =
+      measure_matrix(kind, ordered, options, timestamper);
+  if (!matrix.has_value()) {
+    return false;
+  }
+
+  std::cout << "Half the round-trip latency in ns over "
+            << transport_kind_name(kind) << ", " << options.samples
+            << " samples per pair" << std::endl;
+  for (size_t first = 0U; first < topology.size();) {
+    size_t last = first;
+    std::vector<uint32_t> group{};
+    while ((last < topology.size()) &&
+           (topology[last].package == topology[first].package) &&
+           (topology[last].llc == topology[first].llc)) {
+      group.push_back(topology[last++].cpu);
+    }
+    std::sort(group.begin(), group.end());
+    std::cout << "  package " << topology[first].package << ", last-level "
+              << "cache shared by CPUs " << cpulist::format_cpulist(group)
+              << std::endl;
+    first = last;
+  }
+  std::cout << "Median:" << std::endl;
+  print_matrix(matrix.value(), topology, &pair_latency::p50);
+  std::cout << "99th percentile:" << std::endl;
+  print_matrix(matrix.value(), topology, &pair_latency::p99);
+
+  // The median of the pairs' medians and the worst of their p99s.
+  std::map<cpulist::cpu_distance, std::vector<pair_latency>> by_distance{};
+  for (size_t from = 0U; from < topology.size(); from++) {
+    for (size_t to = 0U; to < topology.size(); to++) {
+      if (from != to) {
+        by_distance[cpulist::distance(topology[from], topology[to])]
+            .push_back(matrix.value()[from][to]);
+      }
+    }
+  }
+  std::cout << std::left << std::setw(16) << "distance" << std::right
+            << std::setw(10) << "pairs" << std::setw(10) << "p50"
+            << std::setw(10) << "worst p99" << std::endl;
+  for (auto &[distance, pairs] : by_distance) {
+    std::sort(pairs.begin(), pairs.end(),
+              [](const pair_latency &a, const pair_latency &b) {
+                return a.p50 < b.p50;
+              });
+    uint64_t worst = 0U;
+    for (const pair_latency &pair : pairs) {
+      worst = std::max(worst, pair.p99);
+    }
+    std::cout << std::left << std::setw(16)
+              << cpulist::cpu_distance_name(distance) << std::right
+              << std::setw(10) << pairs.size() << std::setw(10)
+              << pairs[pairs.size() / 2U].p50 << std::setw(10) << worst
+              << std::endl;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const std::vector<uint32_t> online = cpulist::online_cpus();
+  transport_options options{};
+  clock_source clock = clock_source::tsc;
+  options.sender_cpu = online.front();
+  options.receiver_cpu = online.back();
+  uint64_t seconds = 0U;
+  bool matrix = false;
+  bool samples_set = false;
+  std::vector<uint32_t> matrix_cpus = online;
+  std::string trace_prefix{};
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "mn:i:R:d:p:s:r:o:Mc:"))) {
+    switch (opt) {
+    case 'm':
+      clock = clock_source::monotonic_raw;
+      break;
+    case 'n':
+      options.samples = strtoul(optarg, nullptr, 10);
+      if (0U == options.samples) {
+        std::cerr << "Illegal count " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      samples_set = true;
+      break;
+    case 'i':
+      options.interval = std::chrono::nanoseconds(strtoul(optarg, nullptr, 10));
+      break;
+    case 'R':
+      options.rate = strtoull(optarg, nullptr, 10);
+      if (0U == options.rate) {
+        std::cerr << "Illegal rate " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'd':
+      seconds = strtoull(optarg, nullptr, 10);
+      if (0U == seconds) {
+        std::cerr << "Illegal duration " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      options.prio = strtol(optarg, nullptr, 10);
+      if ((0 >= options.prio) || (MAX_PRIO < options.prio)) {
+        std::cerr << "Illegal priority " << optarg << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 's':
+      options.sender_cpu = parse_cpu(optarg, online, argv[0]);
+      break;
+    case 'r':
+      options.receiver_cpu = parse_cpu(optarg, online, argv[0]);
+      break;
+    case 'o':
+      trace_prefix = optarg;
+      break;
+    case 'M':
+      matrix = true;
+      break;
+    case 'c': {
+      const std::optional<std::vector<uint32_t>> cpus =
+          cpulist::parse_cpulist(optarg);
+      if (!cpus.has_value() ||
+          !std::includes(online.begin(), online.end(), cpus->begin(),
+                         cpus->end())) {
+        std::cerr << "Illegal CPU list " << optarg << " (online are "
+                  << cpulist::format_cpulist(online) << ")" << std::endl;
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      matrix_cpus = cpus.value();
+      break;
+    }
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (0U != seconds) {
+    if (0U == options.rate) {
+      std::cerr << "-d requires -R." << std::endl;
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    options.samples = options.rate * seconds;
+  }
+  if (matrix && !trace_prefix.empty()) {
+    std::cerr << "-o does not apply to -M." << std::endl;
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  std::vector<transport_kind> kinds{};
+  for (int i = optind; i < argc; i++) {
+    const std::optional<transport_kind> kind = parse_transport_kind(argv[i]);
+    if (!kind.has_value()) {
+      std::cerr << "Illegal transport " << argv[i] << std::endl;
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+    kinds.push_back(kind.value());
+  }
+  // Only an explicitly requested transport which cannot be paced is an error.
+  const bool skip_unpaceable = kinds.empty() && (0U != options.rate);
+  if (kinds.empty()) {
+    kinds = matrix ? std::vector<transport_kind>{MATRIX_TRANSPORT}
+                   : all_transport_kinds();
+  }
+
+  const Timestamper timestamper(clock);
+  // A timestamp costing as much as the latencies would distort them.
+  std::cout << "Timestamps from " << clock_source_name(timestamper.source())
+            << " at " << timestamper.frequency() << " Hz cost "
+            << timestamper.cost_ns() << " ns each" << std::endl;
+  if (matrix) {
+    if (2U > matrix_cpus.size()) {
+      std::cerr << "A matrix needs at least two CPUs." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    // Each of the N * (N - 1) pairs needs only a short run.
+    if (!samples_set && (0U == seconds)) {
+      options.samples = MATRIX_SAMPLES;
+    }
+    int ret = EXIT_SUCCESS;
+    for (const transport_kind kind : kinds) {
+      if (!run_matrix(kind, matrix_cpus, options, timestamper)) {
+        ret = EXIT_FAILURE;
+      }
+    }
+    exit(ret);
+  }
+  std::cout << "Sender on CPU " << options.sender_cpu << ", receiver on CPU "
+            << options.receiver_cpu << ", latencies in ns";
+  if (0U != options.rate) {
+    std::cout << " from when each of " << options.rate
+              << " samples per second was due";
+  }
+  std::cout << std::endl;
+  std::cout << std::left << std::setw(16) << "transport" << std::right;
+  for (const char *column :
+       {"samples", "min", "p50", "p99", "p99.9", "p99.99", "max"}) {
+    std::cout << std::setw(10) << column;
+  }
+  std::cout << std::endl;
+  auto histogram = make_latency_histogram();
+  int ret = EXIT_SUCCESS;
+  for (const transport_kind kind : kinds) {
+    histogram->reset();
+    const std::unique_ptr<Transport> transport = make_transport(kind);
+    if (skip_unpaceable && !transport->queues()) {
+      std::cout << std::left << std::setw(16) << transport_kind_name(kind)
+                << "skipped, as it does not queue" << std::endl;
+      continue;
+    }
+    TraceWriter trace;
+    if (!trace_prefix.empty() &&
+        !trace.open(trace_prefix + "." + transport_kind_name(kind) + ".trace",
+                    options.samples, timestamper)) {
+      ret = EXIT_FAILURE;
+      continue;
+    }
+    transport_recorders recorders{};
+    recorders.trace = trace.is_open() ? &trace : nullptr;
+    if (!measure_transport(*transport, options, *histogram, timestamper,
+                           recorders)) {
+      std::cerr << "Measuring " << transport_kind_name(kind) << " failed."
+                << std::endl;
+      ret = EXIT_FAILURE;
+      continue;
+    }
+    std::cout << std::left << std::setw(16) << transport_kind_name(kind)
+              << std::right;
+    for (const uint64_t value :
+         {histogram->count(), histogram->min(), histogram->percentile(50.0),
+          histogram->percentile(99.0), histogram->percentile(99.9),
+          histogram->percentile(99.99), histogram->max()}) {
+      std::cout << std::setw(10) << value;
+    }
+    std::cout << std::endl;
+  }
+  exit(ret);
+}
@@ -1,5 +1,5 @@
-#ifndef TIMERLAT_LOAD_LIB
-#define TIMERLAT_LOAD_LIB
+#ifndef TIMERLAT_PIPE_LOAD_H
+#define TIMERLAT_PIPE_LOAD_H
 
 // A reimplementation of
 // https://github.com/torvalds/linux/blob/master/tools/tracing/rtla/sample/timerlat_load.py
@@ -9,49 +9,60 @@
 // As of v6.9-rc5, the file Documentation/tools/rtla/common_timerlat_options.rst
 // appears in git on localhost, but not at github.com/torvalds.
 
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <unistd.h>
+#include "ipc_transport.hh"
+#include "latency_histogram.hh"
+#include "latency_trace.hh"
 
 #include <chrono>
 #include <cstdint>
-#include <cstring>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <functional>
-#include <iostream>
+#include <memory>
 #include <optional>
+#include <string>
 #include <thread>
 
 namespace timerlat_load {
 
-// The directory in which the timerlat file descriptor opened by RTLA appears.
-constexpr char TRACETLD[] = "/sys/kernel/tracing/osnoise/per_cpu/cpu";
-// The core count on both of my test systems.
-constexpr uint16_t CORES = 8U;
-// Size of container which holds a std::chrono::duration<uint64_t,
-// std::nano>.count().
-constexpr size_t PIPE_BUF_SIZE =
-    sizeof(std::chrono::steady_clock::duration::max()) + 1U;
+// What the responder writes into the FIFO for each message: the Timestamper
+// tick at which it was due.  The reader sees the end of the FIFO when the
+// responder is done.
+constexpr size_t PIPE_BUF_SIZE = sizeof(uint64_t);
 constexpr size_t LIMIT = 100;
 constexpr std::chrono::duration<int, std::nano> SLEEP_TIME =
     std::chrono::duration<int, std::nano>{1};
-constexpr std::chrono::duration<int, std::nano> THRESHOLD =
-    std::chrono::duration<int, std::nano>{100};
-// Copied from
-// https://github.com/frc971/971-Robot-Code/blob/acfda878d17c2981040c6904fab3d718e2d4bc67/aos/ipc_lib/named_pipe_latency.cc#L76
-constexpr char STOP_WORD[] = "00000000";
 namespace fs = std::filesystem;
 
+// nanoseconds holds at least 64 bits, so this is exact for any time of the
+// next 292 years.
 constexpr std::chrono::nanoseconds convert_ns(const struct timespec &ts) {
-  std::chrono::duration<int, std::nano> nanosecs{
-      static_cast<int>((1e9 * ts.tv_sec) + ts.tv_nsec)};
-  return nanosecs;
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
 }
 
+// How the responder schedules its messages.
+struct pacing_options {
+  // Messages per second, or 0 to send each as soon as SLEEP_TIME has passed
+  // since the last, so that the intended and actual send times are the same.
+  uint64_t rate = 0U;
+  // How many messages to send before closing the FIFO.
+  uint64_t count = LIMIT;
+};
+
+// Create an empty directory for a FIFO under /tmp.
 std::optional<std::filesystem::path> create_fifo_dir();
+// Write LIMIT messages into the FIFO in fifopath, then close it.
 void responding_fn(const std::string &fifopath);
+// The same, but scheduled as pacing specifies, recording when each message
+// was actually written in send_times unless it is nullptr.  Both send through
+// a Transport with send_timestamps(), as measure_transport()'s sender does.
+void paced_responding_fn(const std::string &fifopath,
+                         const pacing_options &pacing,
+                         SendTimes *send_times = nullptr);
+// Send the intended send times of the messages which paced_responding_fn()
+// would write into the FIFO through ring instead, and then close it.
+void ring_responding_fn(SpscRing &ring, const pacing_options &pacing);
 
 class FifoTimer {
 public:
@@ -69,9 +80,29 @@ public:
     }
   }
 
+  // Create the FIFO and a responder which paces its messages as
+  // set_pacing() last specified.
   bool start();
+  void set_pacing(const pacing_options &pacing) { pacing_ = pacing; }
+  // Also append every message which calculate_roundtrip_delays() receives to
+  // trace, which must outlive it, or stop if trace is nullptr.
+  void set_trace(TraceWriter *trace) { trace_ = trace; }
   bool create_responder(std::function<void(const std::string &)> fn);
+  // Read the messages from the responder through ifs with
+  // receive_timestamps(), as measure_transport()'s receiver does, reading a
+  // byte of tlfs before each.  Record the delay of every message since it was
+  // due in histogram(), and since it was written in service_histogram(), until
+  // the responder closes the FIFO or the read fails, then print the
+  // histograms.
   void calculate_roundtrip_delays(std::ifstream &tlfs);
+  // The same, but for the times which ring_responding_fn() sends through
+  // ring, so that a kernel pipe can be compared with a handoff through memory.
+  // Only histogram() is recorded.
+  void calculate_roundtrip_delays(std::ifstream &tlfs, SpscRing &ring);
+  const LatencyHistogram &histogram() const { return *histogram_; }
+  const LatencyHistogram &service_histogram() const {
+    return *service_histogram_;
+  }
   std::string fifodir() const { return fifodir_.string(); }
   // Only for unit tests.
   void set_fifodir(const std::string &fifodir) { fifodir_ = fifodir; }
@@ -81,6 +112,14 @@ public:
 private:
   std::thread responder_;
   std::filesystem::path fifodir_;
+  pacing_options pacing_;
+  // When start()'s responder wrote each message.
+  std::unique_ptr<SendTimes> send_times_{};
+  TraceWriter *trace_ = nullptr;
+  // Tests and tools construct FifoTimers on the stack.
+  std::unique_ptr<LatencyHistogram> histogram_ = make_latency_histogram();
+  std::unique_ptr<LatencyHistogram> service_histogram_ =
+      make_latency_histogram();
 };
 
 } // namespace timerlat_load
@@ -1,57 +1,98 @@
 #include "timerlat_pipe_load.hh"
 
-#include <cassert>
-#include <charconv>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
 #include <cstring>
-#include <fstream>
-#include <iomanip>
-#include <sstream>
+#include <iostream>
+#include <limits>
 
 namespace timerlat_load {
 
-using namespace std::chrono;
-using namespace std::chrono_literals;
 namespace fs = std::filesystem;
 
+namespace {
+
+// The reading end of FifoTimer's FIFO, through its ifstream.
+class IstreamTransport : public Transport {
+public:
+  explicit IstreamTransport(std::istream &in) : in_(in) {}
+  bool valid() const override { return in_.good(); }
+  bool send(uint64_t) override { return false; }
+  std::optional<uint64_t> receive() override {
+    uint64_t value;
+    in_.read(reinterpret_cast<char *>(&value), sizeof(value));
+    if (sizeof(value) != static_cast<size_t>(in_.gcount())) {
+      return std::nullopt;
+    }
+    return value;
+  }
+  void close_sender() override {}
+
+private:
+  std::istream &in_;
+};
+
+// Read a byte of the timerlat file descriptor tlfs before each message.
+std::function<int32_t()> tickle(std::ifstream &tlfs) {
+  return [&tlfs]() {
+    char trash;
+    tlfs.read(&trash, 1);
+    return tlfs.fail() ? -1 : static_cast<int32_t>(tlfs.gcount());
+  };
+}
+
+// However many messages the responder sends, received on this thread's CPU.
+transport_options receiver_options() {
+  transport_options options{};
+  options.samples = std::numeric_limits<size_t>::max();
+  options.receiver_cpu = static_cast<uint32_t>(sched_getcpu());
+  return options;
+}
+
+transport_options pacing_transport_options(const pacing_options &pacing) {
+  transport_options options{};
+  options.samples = pacing.count;
+  options.interval = SLEEP_TIME;
+  options.rate = pacing.rate;
+  return options;
+}
+
+} // namespace
+
+std::optional<std::filesystem::path> create_fifo_dir() {
+  char dir_template[] = "/tmp/timerlat_pipe_load.XXXXXX";
+  if (nullptr == mkdtemp(dir_template)) {
+    std::cerr << "Unable to create a FIFO directory: " << strerror(errno)
+              << std::endl;
+    return std::nullopt;
+  }
+  return fs::path(dir_template);
+}
+
 void responding_fn(const std::string &fifopath) {
-  const std::string fifoname{fifopath + "/myfifo"};
-  int write_fd = openat(-1 /*NOT USED*/, fifoname.c_str(), O_WRONLY);
-  if (-1 == write_fd) {
-    std::cerr << "Unable to open FIFO " << fifoname
-              << " for writing: " << strerror(errno) << std::endl;
-    std::cerr.flush();
+  paced_responding_fn(fifopath, pacing_options{});
+}
+
+void paced_responding_fn(const std::string &fifopath,
+                         const pacing_options &pacing,
+                         SendTimes *send_times) {
+  const std::unique_ptr<Transport> transport =
+      open_fifo_end(fifopath + "/myfifo", true);
+  if (!transport->valid()) {
     return;
   }
-  size_t ctr = 0;
-  char pipe_buf[PIPE_BUF_SIZE];
-  while (ctr++ < LIMIT) {
-    time_point<steady_clock> tp = steady_clock::now();
-    duration<uint64_t, std::nano> now_ref = tp.time_since_epoch();
-    memcpy(pipe_buf, &now_ref, sizeof(now_ref));
-    //    pipe_buf[PIPE_BUF_SIZE-1U] = '\0';
-    // Include terminating NULL.
-    ssize_t bytes_written = write(write_fd, pipe_buf, PIPE_BUF_SIZE);
-    if ((-1 == bytes_written) &&
-        ((EAGAIN != errno) || (EWOULDBLOCK != errno))) {
-      std::cerr << "Unable to write pipe: " << strerror(errno) << std::endl;
-      break;
-    }
-    if (0 == bytes_written) {
-      std::cerr << "Wrote 0 bytes from : " << pipe_buf << std::endl;
-    }
-    /*
-      Use of sched_yield() with nondeterministic scheduling  policies  such  as
-      SCHED_OTHER is unspecified and very likely means your application design
-      is broken. If the calling thread is the only thread in the highest
-      priority list at that time, it will continue to run after a call to
-      sched_yield().
-    */
-    // sched_yield();
-    std::this_thread::sleep_for(SLEEP_TIME);
-  }
-  strncpy(pipe_buf, STOP_WORD, PIPE_BUF_SIZE);
-  write(write_fd, pipe_buf, PIPE_BUF_SIZE);
-  close(write_fd);
+  send_timestamps(*transport, pacing_transport_options(pacing),
+                  default_timestamper(), send_times);
+  transport->close_sender();
+}
+
+void ring_responding_fn(SpscRing &ring, const pacing_options &pacing) {
+  const std::unique_ptr<Transport> transport = ring_transport(ring);
+  send_timestamps(*transport, pacing_transport_options(pacing),
+                  default_timestamper());
+  transport->close_sender();
 }
 
 FifoTimer::FifoTimer() {
@@ -88,7 +129,14 @@ bool FifoTimer::start() {
   }
   std::cout << "Created fifo at " << fifoname << std::endl;
 
-  std::function<void(const std::string &)> fn = responding_fn;
+  const pacing_options pacing = pacing_;
+  send_times_ = std::make_unique<SendTimes>(0U == pacing.rate ? 0U
+                                                              : pacing.count);
+  SendTimes *send_times = send_times_.get();
+  std::function<void(const std::string &)> fn =
+      [pacing, send_times](const std::string &fifopath) {
+        paced_responding_fn(fifopath, pacing, send_times);
+      };
   if (!create_responder(fn)) {
     std::cerr << "Unable to spawn responder thread." << std::endl;
     return false;
@@ -106,44 +154,43 @@ void FifoTimer::calculate_roundtrip_delays(std::ifstream &tlfs) {
   if (!tlfs.good()) {
     return;
   }
-  std::string trash(2, '\0');
-  char pipe_buffer[PIPE_BUF_SIZE];
-  while (!ifs.eof()) {
-    // Tickle the timerlat file descriptor.
-    tlfs.read(&trash[0], 1);
-
-    const fs::path fifopath(fifodir_.string() + "/myfifo");
-    if (!(ifs.is_open() && ifs.good() && fs::is_fifo(fifopath))) {
-      std::cerr << "Pipe is closed." << std::endl;
-      return;
-    }
-    errno = 0;
-    ifs.read(pipe_buffer, PIPE_BUF_SIZE);
-    if (!strcmp(STOP_WORD, pipe_buffer)) {
-      std::cout << "DONE" << std::endl;
-      return;
-    }
-    if (!ifs.good()) {
-      std::cerr << "Pipe read failed: " << strerror(errno) << std::endl;
-      if ((EAGAIN != errno) && (EWOULDBLOCK != errno)) {
-        return;
-      }
-    }
-    size_t bytes_read = ifs.gcount();
-    if (PIPE_BUF_SIZE != bytes_read) {
-      std::cerr << "Bad read of " << bytes_read << " bytes." << std::endl;
-      continue;
-    }
-    duration<uint64_t, std::nano> then;
-    // Don't need the NULL for a time_point.
-    memcpy(&then, pipe_buffer, PIPE_BUF_SIZE - 1U);
-
-    time_point<steady_clock> tp = steady_clock::now();
-    duration<uint64_t, std::nano> delay = tp.time_since_epoch() - then;
-    if ((delay / 1000) > THRESHOLD) {
-      std::cout << std::to_string(delay.count()) << +" micros" << std::endl;
-    }
+  IstreamTransport transport(ifs);
+  if (!(ifs.is_open() && transport.valid())) {
+    std::cerr << "Pipe is closed." << std::endl;
+    return;
+  }
+  transport_recorders recorders{};
+  recorders.service = service_histogram_.get();
+  recorders.trace = trace_;
+  recorders.send_times = send_times_.get();
+  recorders.before_receive = tickle(tlfs);
+  // Nothing in the loop prints, except on failure, so as not to perturb the
+  // measurement.
+  receive_timestamps(transport, receiver_options(), *histogram_,
+                     default_timestamper(), recorders);
+  std::cout << "Round trip delays:" << std::endl;
+  histogram_->print(std::cout);
+  if (0U != pacing_.rate) {
+    // Only an open-loop sender has a schedule to fall behind.
+    std::cout << "Without coordinated-omission correction:" << std::endl;
+    service_histogram_->print(std::cout);
+  }
+}
+
+void FifoTimer::calculate_roundtrip_delays(std::ifstream &tlfs,
+                                           SpscRing &ring) {
+  if (!tlfs.good()) {
+    return;
   }
+  const std::unique_ptr<Transport> transport = ring_transport(ring);
+  transport_recorders recorders{};
+  recorders.trace = trace_;
+  recorders.before_receive = tickle(tlfs);
+  receive_timestamps(*transport, receiver_options(), *histogram_,
+                     default_timestamper(), recorders);
+  std::cout << "Round trip delays through a " << ring_wait_name(ring.wait())
+            << " ring:" << std::endl;
+  histogram_->print(std::cout);
 }
 
 } // namespace timerlat_load
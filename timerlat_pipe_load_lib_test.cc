@@ -116,8 +116,75 @@ TEST(TimerlatPipeLoadTest, CalculateDelay) {
   // Re-open as ifstream.
   ifstream tlfs0(ft.fifodir() + "/rtlafile");
 
+  ::testing::internal::CaptureStdout();
   ft.calculate_roundtrip_delays(tlfs0);
+  const std::string output = ::testing::internal::GetCapturedStdout();
   tlfs0.close();
+  // Every message before the STOP_WORD is counted, and only the summary is
+  // printed.
+  EXPECT_EQ(LIMIT, ft.histogram().count());
+  EXPECT_THAT(output, ::testing::HasSubstr("Round trip delays:\n100 samples"));
+}
+
+TEST(TimerlatPipeLoadTest, CalculatePacedDelay) {
+  FifoTimer ft;
+  ft.set_pacing(pacing_options{10000U, 500U});
+  ASSERT_TRUE(ft.start());
+  TraceWriter trace;
+  ASSERT_TRUE(trace.open(ft.fifodir() + "/trace", 1000U,
+                         default_timestamper()));
+  ft.set_trace(&trace);
+  ofstream(ft.fifodir() + "/rtlafile") << "111111111";
+  ifstream tlfs(ft.fifodir() + "/rtlafile");
+
+  ::testing::internal::CaptureStdout();
+  ft.calculate_roundtrip_delays(tlfs);
+  const std::string output = ::testing::internal::GetCapturedStdout();
+  EXPECT_EQ(500U, ft.histogram().count());
+  EXPECT_EQ(500U, ft.service_histogram().count());
+  // No message is written before it is due, so measuring from when it was due
+  // never makes the delay shorter.
+  EXPECT_LE(ft.service_histogram().min(), ft.histogram().min());
+  EXPECT_LE(ft.service_histogram().max(), ft.histogram().max());
+  EXPECT_THAT(output, ::testing::HasSubstr(
+                          "Without coordinated-omission correction:\n500"));
+  trace.close();
+
+  LatencyTrace recorded;
+  ASSERT_TRUE(recorded.open(ft.fifodir() + "/trace"));
+  ASSERT_EQ(500U, recorded.size());
+  for (size_t i = 0U; i < recorded.size(); i++) {
+    EXPECT_EQ(i, recorded[i].sequence);
+    EXPECT_LE(recorded[i].intended, recorded[i].sent);
+  }
+  // The test's timerlat stand-in holds only 9 bytes.
+  EXPECT_EQ(1, recorded[0].timerlat);
+  EXPECT_EQ(-1, recorded[recorded.size() - 1U].timerlat);
+}
+
+TEST(TimerlatPipeLoadTest, ConvertNs) {
+  EXPECT_EQ(1500000000ns, convert_ns(timespec{1, 500000000}));
+  // An int of nanoseconds overflows after 2.1 s.
+  EXPECT_EQ(3000000000ns, convert_ns(timespec{3, 0}));
+  // A timestamp a year after boot.
+  EXPECT_EQ(31536000000000123ns, convert_ns(timespec{31536000, 123}));
+}
+
+TEST(TimerlatPipeLoadTest, CalculateRingDelay) {
+  FifoTimer ft;
+  ASSERT_TRUE(fs::create_directory(ft.fifodir()));
+  ofstream(ft.fifodir() + "/rtlafile") << "111111111";
+  ifstream tlfs(ft.fifodir() + "/rtlafile");
+
+  SpscRing ring(ring_wait::block);
+  std::thread responder(ring_responding_fn, std::ref(ring), pacing_options{});
+  ::testing::internal::CaptureStdout();
+  ft.calculate_roundtrip_delays(tlfs, ring);
+  const std::string output = ::testing::internal::GetCapturedStdout();
+  responder.join();
+  EXPECT_EQ(LIMIT, ft.histogram().count());
+  EXPECT_THAT(output,
+              ::testing::HasSubstr("through a block ring:\n100 samples"));
 }
 
 } // namespace local_testing
@@ -0,0 +1,123 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+// Cheap timestamps for latency measurements.  std::chrono::steady_clock is
+// CLOCK_MONOTONIC, which NTP slews, and costs a vDSO call of perhaps 20 ns.
+// Where the CPU has an invariant TSC which the kernel also trusts as its
+// clocksource, reading it directly costs a few nanoseconds and is consistent
+// across CPUs, so Timestamper uses it after calibrating it against
+// CLOCK_MONOTONIC_RAW.  Otherwise it falls back to clock_gettime() of
+// CLOCK_MONOTONIC_RAW, which the vDSO serves without a system call.
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace timerlat_load {
+
+enum class clock_source { tsc, monotonic_raw };
+
+const char *clock_source_name(clock_source source);
+
+// True if the CPU's TSC is invariant and the kernel's clocksource, from the
+// file at clocksource_path, is "tsc".  An unreadable file is not held against
+// the TSC.
+bool tsc_usable(const std::string &clocksource_path =
+                    "/sys/devices/system/clocksource/clocksource0/"
+                    "current_clocksource");
+
+class Timestamper {
+public:
+  // Use the TSC if preferred is tsc and tsc_usable().  Calibrating the TSC
+  // takes about 20 ms.
+  explicit Timestamper(clock_source preferred = clock_source::tsc);
+
+  clock_source source() const {
+    return tsc_ ? clock_source::tsc : clock_source::monotonic_raw;
+  }
+  // Ticks per second.
+  uint64_t frequency() const { return hz_; }
+
+  // A timestamp in ticks, taken after every earlier instruction has
+  // executed.
+  uint64_t now() const {
+#if defined(__x86_64__) || defined(__i386__)
+    if (tsc_) {
+      unsigned int aux;
+      return __rdtscp(&aux);
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000U + ts.tv_nsec;
+  }
+  // Convert ticks to nanoseconds without overflow for any 64-bit count.
+  uint64_t to_ns(uint64_t ticks) const {
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(ticks) * mult_) >> SHIFT);
+  }
+  // Convert nanoseconds to ticks.  Slower than to_ns().
+  uint64_t from_ns(uint64_t ns) const {
+    return tsc_ ? static_cast<uint64_t>(static_cast<unsigned __int128>(ns) *
+                                        hz_ / 1000000000U)
+                : ns;
+  }
+  // The nanoseconds from start to end, or 0 if end precedes start, as it may
+  // by a few ticks between CPUs.
+  uint64_t elapsed_ns(uint64_t start, uint64_t end) const {
+    return (end > start) ? to_ns(end - start) : 0U;
+  }
+
+  // Sleep until now() reaches deadline.
+  void sleep_until(uint64_t deadline) const;
+
+  // The mean cost in nanoseconds of now(), over calls calls.
+  double cost_ns(size_t calls = 100000U) const;
+
+private:
+  static constexpr unsigned SHIFT = 32U;
+
+  bool tsc_ = false;
+  uint64_t hz_ = 1000000000U;
+  // Nanoseconds per tick, times 2^SHIFT.
+  uint64_t mult_ = uint64_t{1} << SHIFT;
+};
+
+// The send times of a fixed-rate, open-loop schedule, in Timestamper ticks.
+// Each deadline is computed from the start rather than from the previous one,
+// so that late wakeups do not accumulate into drift over a long run.
+class Pacer {
+public:
+  Pacer(const Timestamper &timestamper, uint64_t rate)
+      : timestamper_(timestamper), rate_(rate), start_(timestamper.now()) {}
+  // When message i is due.
+  uint64_t deadline(uint64_t i) const {
+    return start_ + timestamper_.from_ns(static_cast<uint64_t>(
+                        static_cast<unsigned __int128>(i) * 1000000000U /
+                        rate_));
+  }
+  // Sleep until message i is due, unless it already is, and return when it
+  // was due.
+  uint64_t wait(uint64_t i) const {
+    const uint64_t due = deadline(i);
+    timestamper_.sleep_until(due);
+    return due;
+  }
+
+private:
+  const Timestamper &timestamper_;
+  const uint64_t rate_;
+  const uint64_t start_;
+};
+
+// One Timestamper for the process, calibrated on first use.
+const Timestamper &default_timestamper();
+
+} // namespace timerlat_load
+
+#endif
@@ -0,0 +1,132 @@
+#include "timestamp.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+namespace timerlat_load {
+
+namespace {
+
+constexpr const char *SOURCE_NAMES[] = {"tsc", "monotonic_raw"};
+// Long enough that the error of the readings at either end is below a part
+// per million.
+constexpr std::chrono::milliseconds CALIBRATION_TIME{20};
+
+uint64_t raw_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000U + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+struct paired_reading {
+  uint64_t tsc;
+  uint64_t ns;
+};
+
+// Read the TSC between two readings of CLOCK_MONOTONIC_RAW, and pair it with
+// their midpoint.  The tightest of a few tries is least disturbed by
+// interrupts.
+paired_reading read_pair() {
+  paired_reading best{};
+  uint64_t best_window = UINT64_MAX;
+  for (int i = 0; i < 5; i++) {
+    const uint64_t before = raw_ns();
+    unsigned int aux;
+    const uint64_t tsc = __rdtscp(&aux);
+    const uint64_t after = raw_ns();
+    if (after - before < best_window) {
+      best_window = after - before;
+      best = {tsc, before + (after - before) / 2U};
+    }
+  }
+  return best;
+}
+#endif
+
+} // namespace
+
+const char *clock_source_name(clock_source source) {
+  return SOURCE_NAMES[static_cast<size_t>(source)];
+}
+
+bool tsc_usable(const std::string &clocksource_path) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  // CPUID.80000007H:EDX[8] is the invariant TSC flag.
+  if (!__get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1U << 8))) {
+    return false;
+  }
+  // The kernel switches away from the TSC if it finds the TSCs of different
+  // CPUs out of step.
+  std::ifstream clocksource(clocksource_path);
+  std::string current;
+  if (clocksource >> current) {
+    return "tsc" == current;
+  }
+  return true;
+#else
+  (void)clocksource_path;
+  return false;
+#endif
+}
+
+Timestamper::Timestamper(clock_source preferred) {
+#if defined(__x86_64__) || defined(__i386__)
+  if ((clock_source::tsc != preferred) || !tsc_usable()) {
+    return;
+  }
+  const paired_reading start = read_pair();
+  std::this_thread::sleep_for(CALIBRATION_TIME);
+  const paired_reading end = read_pair();
+  if ((end.tsc <= start.tsc) || (end.ns <= start.ns)) {
+    return;
+  }
+  hz_ = static_cast<uint64_t>(
+      static_cast<unsigned __int128>(end.tsc - start.tsc) * 1000000000U /
+      (end.ns - start.ns));
+  mult_ = static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(1000000000U) << SHIFT) / hz_);
+  tsc_ = true;
+#else
+  (void)preferred;
+#endif
+}
+
+void Timestamper::sleep_until(uint64_t deadline) const {
+  uint64_t current;
+  while ((current = now()) < deadline) {
+    const uint64_t ns = to_ns(deadline - current);
+    const struct timespec remaining {
+      static_cast<time_t>(ns / 1000000000U), static_cast<long>(ns % 1000000000U)
+    };
+    // An interruption just means another trip around the loop.
+    nanosleep(&remaining, nullptr);
+  }
+}
+
+double Timestamper::cost_ns(size_t calls) const {
+  if (0U == calls) {
+    return 0.0;
+  }
+  // Summing the readings keeps them from being optimized away.
+  volatile uint64_t sink = 0U;
+  const uint64_t start = raw_ns();
+  for (size_t i = 0U; i < calls; i++) {
+    sink = sink + now();
+  }
+  return static_cast<double>(raw_ns() - start) / calls;
+}
+
+const Timestamper &default_timestamper() {
+  static const Timestamper timestamper;
+  return timestamper;
+}
+
+} // namespace timerlat_load
@@ -0,0 +1,78 @@
+#include "timestamp.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace timerlat_load {
+namespace local_testing {
+
+TEST(TimestampTest, MonotonicRaw) {
+  const Timestamper timestamper(clock_source::monotonic_raw);
+  EXPECT_EQ(clock_source::monotonic_raw, timestamper.source());
+  EXPECT_STREQ("monotonic_raw", clock_source_name(timestamper.source()));
+  // The ticks are nanoseconds.
+  EXPECT_EQ(UINT64_MAX, timestamper.to_ns(UINT64_MAX));
+  const uint64_t start = timestamper.now();
+  EXPECT_LE(start, timestamper.now());
+  EXPECT_EQ(0U, timestamper.elapsed_ns(start + 5U, start));
+}
+
+TEST(TimestampTest, TscUsable) {
+  const std::string path = testing::TempDir() + "clocksource";
+  std::ofstream(path) << "kvm-clock\n";
+  EXPECT_FALSE(tsc_usable(path));
+  std::ofstream(path) << "tsc\n";
+  const bool usable = tsc_usable(path);
+  // An unreadable clocksource leaves the decision to CPUID.
+  remove(path.c_str());
+  EXPECT_EQ(usable, tsc_usable(path));
+}
+
+TEST(TimestampTest, Elapsed) {
+  const Timestamper &timestamper = default_timestamper();
+  const uint64_t start = timestamper.now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  const uint64_t elapsed = timestamper.elapsed_ns(start, timestamper.now());
+  EXPECT_LE(10000000U, elapsed);
+  EXPECT_GT(200000000U, elapsed);
+  EXPECT_LT(0.0, timestamper.cost_ns(1000U));
+}
+
+TEST(TimestampTest, TscConversion) {
+  const Timestamper &timestamper = default_timestamper();
+  if (clock_source::tsc != timestamper.source()) {
+    GTEST_SKIP() << "The TSC is not usable.";
+  }
+  EXPECT_LT(100000000U, timestamper.frequency());
+  // Neither a second's nor fifty years of ticks overflows.
+  for (const uint64_t seconds : {uint64_t{1}, uint64_t{50 * 365 * 86400}}) {
+    const double expected = 1e9 * seconds;
+    EXPECT_NEAR(expected,
+                timestamper.to_ns(seconds * timestamper.frequency()),
+                expected * 1e-6);
+  }
+}
+
+TEST(TimestampTest, Pacer) {
+  const Timestamper &timestamper = default_timestamper();
+  EXPECT_NEAR(1e6, timestamper.to_ns(timestamper.from_ns(1000000U)), 1.0);
+  // 1000 messages a second.
+  const Pacer pacer(timestamper, 1000U);
+  EXPECT_NEAR(1e9, timestamper.to_ns(pacer.deadline(1000U) -
+                                     pacer.deadline(0U)),
+              1.0);
+  const uint64_t due = pacer.wait(5U);
+  EXPECT_EQ(pacer.deadline(5U), due);
+  EXPECT_LE(due, timestamper.now());
+  // A deadline in the past does not wait.
+  const uint64_t before = timestamper.now();
+  pacer.wait(0U);
+  EXPECT_GT(1000000U, timestamper.elapsed_ns(before, timestamper.now()));
+}
+
+} // namespace local_testing
+} // namespace timerlat_load